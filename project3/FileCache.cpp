@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FileCache.h"
+
+using namespace std;
+
+FileCache::FileCache(size_t maxEntries, long ttlMillis, long missingTtlMillis, size_t maxMissing) {
+  m_maxEntries = maxEntries;
+  m_ttlMillis = ttlMillis;
+  m_missingTtlMillis = missingTtlMillis;
+  m_maxMissing = maxMissing;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+FileCache::~FileCache() {
+  while (!m_lru.empty()) {
+    CachedFile *file = m_lru.back();
+    evict(file);
+    unref(file);
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+long FileCache::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool FileCache::sameFile(const struct stat &a, const struct stat &b) {
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+    a.st_mtime == b.st_mtime;
+}
+
+CachedFile *FileCache::acquire(string_view path) {
+  string key(path);
+
+  pthread_mutex_lock(&m_lock);
+  if (isMissing(key)) {
+    pthread_mutex_unlock(&m_lock);
+    errno = ENOENT;
+    return NULL;
+  }
+
+  unordered_map<string, CachedFile *>::iterator it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    CachedFile *file = it->second;
+    file->refs++;
+    m_lru.splice(m_lru.begin(), m_lru, file->lru);
+    bool fresh = now() - file->validatedAt < m_ttlMillis;
+    pthread_mutex_unlock(&m_lock);
+
+    if (fresh) {
+      return file;
+    }
+
+    // past its TTL, make sure the path still names the same file
+    struct stat st;
+    if (::stat(file->path.c_str(), &st) == 0 && sameFile(st, file->st)) {
+      pthread_mutex_lock(&m_lock);
+      file->validatedAt = now();
+      pthread_mutex_unlock(&m_lock);
+      return file;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    it = m_entries.find(key);
+    if (it != m_entries.end() && it->second == file) {
+      evict(file);
+      unref(file);
+    }
+    unref(file);
+    pthread_mutex_unlock(&m_lock);
+  } else {
+    pthread_mutex_unlock(&m_lock);
+  }
+
+  CachedFile *file = open(path);
+  if (file == NULL) {
+    if (errno == ENOENT || errno == ENOTDIR) {
+      int saved = errno;
+      pthread_mutex_lock(&m_lock);
+      addMissing(key);
+      pthread_mutex_unlock(&m_lock);
+      errno = saved;
+    }
+    return NULL;
+  }
+
+  pthread_mutex_lock(&m_lock);
+  // another worker may have opened it while we weren't holding the lock
+  it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    CachedFile *other = it->second;
+    evict(other);
+    unref(other);
+  }
+  if (m_entries.size() >= m_maxEntries) {
+    CachedFile *oldest = m_lru.back();
+    evict(oldest);
+    unref(oldest);
+  }
+  m_lru.push_front(file);
+  file->lru = m_lru.begin();
+  m_entries[key] = file;
+  pthread_mutex_unlock(&m_lock);
+
+  return file;
+}
+
+CachedFile *FileCache::open(string_view path) {
+  string name(path);
+  int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int saved = errno;
+    ::close(fd);
+    errno = saved;
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    ::close(fd);
+    errno = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+    return NULL;
+  }
+
+  CachedFile *file = new CachedFile();
+  file->path = name;
+  file->fd = fd;
+  file->st = st;
+  file->validatedAt = now();
+  // one for the cache, one for the caller
+  file->refs = 2;
+  return file;
+}
+
+void FileCache::retain(CachedFile *file) {
+  pthread_mutex_lock(&m_lock);
+  file->refs++;
+  pthread_mutex_unlock(&m_lock);
+}
+
+void FileCache::release(CachedFile *file) {
+  pthread_mutex_lock(&m_lock);
+  unref(file);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void FileCache::evict(CachedFile *file) {
+  m_entries.erase(file->path);
+  m_lru.erase(file->lru);
+}
+
+void FileCache::unref(CachedFile *file) {
+  if (--file->refs == 0) {
+    ::close(file->fd);
+    delete file;
+  }
+}
+
+bool FileCache::isMissing(const string &path) {
+  unordered_map<string, long>::iterator it = m_missing.find(path);
+  if (it == m_missing.end()) {
+    return false;
+  }
+  if (it->second <= now()) {
+    m_missing.erase(it);
+    return false;
+  }
+  return true;
+}
+
+void FileCache::addMissing(const string &path) {
+  long time = now();
+  if (m_missing.size() >= m_maxMissing) {
+    // make room by dropping whatever has expired, and if that isn't
+    // enough start over rather than let a flood of junk paths grow
+    // the table without bound
+    for (unordered_map<string, long>::iterator it = m_missing.begin(); it != m_missing.end();) {
+      if (it->second <= time) {
+        it = m_missing.erase(it);
+      } else {
+        it++;
+      }
+    }
+    if (m_missing.size() >= m_maxMissing) {
+      m_missing.clear();
+    }
+  }
+  m_missing[path] = time + m_missingTtlMillis;
+}
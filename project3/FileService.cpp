@@ -1,18 +1,29 @@
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <string>
 
 #include "FileService.h"
+#include "HttpUtils.h"
 
 using namespace std;
 
-FileService::FileService(string basedir) : HttpService("/")
+FileService::FileService(string basedir, bool compress) : HttpService("/")
 {
+  this->m_compress = compress;
+  this->m_compressedBytes = 0;
+  pthread_mutex_init(&this->m_compressedLock, NULL);
+
   while (endswith(basedir, "/"))
   {
     basedir = basedir.substr(0, basedir.length() - 1);
@@ -29,9 +40,10 @@ FileService::FileService(string basedir) : HttpService("/")
 
 FileService::~FileService()
 {
+  pthread_mutex_destroy(&this->m_compressedLock);
 }
 
-bool FileService::endswith(string str, string suffix)
+bool FileService::endswith(string_view str, string_view suffix)
 {
   size_t pos = str.rfind(suffix);
   return pos == (str.length() - suffix.length());
@@ -39,7 +51,19 @@ bool FileService::endswith(string str, string suffix)
 
 void FileService::get(HTTPRequest *request, HTTPResponse *response)
 {
-  string path = this->m_basedir + request->getPath();
+  this->serve(request, response, true);
+}
+
+void FileService::head(HTTPRequest *request, HTTPResponse *response)
+{
+  // HEAD gets the same headers as GET, but only needs to fstat the file
+  this->serve(request, response, false);
+}
+
+void FileService::serve(HTTPRequest *request, HTTPResponse *response, bool sendBody)
+{
+  pmr::string path(this->m_basedir, request->memory());
+  path.append(request->getPathView());
   // For Security :: Check for ".." in the path to prevent directory traversal attacks
   if (path.find("..") != string::npos)
   {
@@ -47,50 +71,486 @@ void FileService::get(HTTPRequest *request, HTTPResponse *response)
     return;
   }
 
-  string fileContents = this->readFile(path);
-  if (fileContents.size() == 0)
+  // the type follows the name that was asked for, whichever encoding
+  // of it we end up sending
+  if (this->endswith(path, ".css"))
   {
-    response->setStatus(403);
-    return;
+    response->setContentType("text/css");
   }
-  else
+  else if (this->endswith(path, ".js"))
   {
-    if (this->endswith(path, ".css"))
+    response->setContentType("text/javascript");
+  }
+  response->setHeader("Vary", "Accept-Encoding");
+
+  string_view acceptEncoding;
+  bool hasAcceptEncoding = request->findHeader("Accept-Encoding", &acceptEncoding);
+
+  const char *encoding = NULL;
+  CachedFile *file = NULL;
+  if (hasAcceptEncoding)
+  {
+    file = this->openPrecompressed(path, acceptEncoding, &encoding);
+  }
+
+  if (file == NULL)
+  {
+    file = this->m_files.acquire(path);
+    if (file == NULL)
     {
-      response->setContentType("text/css");
+      // only a path that isn't there is a 404, anything else we can't
+      // read (permissions, directories) stays forbidden
+      response->setStatus((errno == ENOENT || errno == ENOTDIR) ? 404 : 403);
+      return;
     }
-    else if (this->endswith(path, ".js"))
+
+    if (file->st.st_size == 0)
     {
-      response->setContentType("text/javascript");
+      this->m_files.release(file);
+      response->setStatus(403);
+      return;
     }
-    response->setBody(fileContents);
+
+    if (this->m_compress && hasAcceptEncoding && this->isCompressible(path) &&
+        HttpUtils::acceptsEncoding(acceptEncoding, "gzip") && file->st.st_size > MAX_COMPRESS_SIZE)
+    {
+      // too big to keep a compressed copy of, so it's compressed on
+      // its way out instead
+      try
+      {
+        this->streamCompressed(request, response, file, sendBody);
+      }
+      catch (...)
+      {
+        this->m_files.release(file);
+        throw;
+      }
+      this->m_files.release(file);
+      return;
+    }
+
+    if (this->m_compress && hasAcceptEncoding && this->isCompressible(path) &&
+        HttpUtils::acceptsEncoding(acceptEncoding, "gzip"))
+    {
+      shared_ptr<const string> compressed = this->compressedAsset(path, file->fd, file->st);
+      if (compressed)
+      {
+        this->sendCompressed(request, response, *compressed, file->st, sendBody);
+        this->m_files.release(file);
+        return;
+      }
+    }
+  }
+
+  if (encoding != NULL)
+  {
+    response->setHeader("Content-Encoding", encoding);
   }
+  this->sendFile(request, response, file, sendBody);
+  this->m_files.release(file);
 }
 
-string FileService::readFile(string path)
+CachedFile *FileService::openPrecompressed(const pmr::string &path, string_view acceptEncoding,
+                                           const char **encoding)
 {
-  int fd = open(path.c_str(), O_RDONLY);
-  if (fd < 0)
+  // best compression first
+  static const char *encodings[][2] = {{"br", ".br"}, {"gzip", ".gz"}};
+
+  for (size_t idx = 0; idx < sizeof(encodings) / sizeof(encodings[0]); idx++)
   {
-    return "";
+    if (!HttpUtils::acceptsEncoding(acceptEncoding, encodings[idx][0]))
+    {
+      continue;
+    }
+
+    pmr::string variant(path, path.get_allocator());
+    variant.append(encodings[idx][1]);
+    CachedFile *file = this->m_files.acquire(variant);
+    if (file == NULL)
+    {
+      continue;
+    }
+    if (file->st.st_size > 0)
+    {
+      *encoding = encodings[idx][0];
+      return file;
+    }
+    this->m_files.release(file);
   }
+  return NULL;
+}
 
-  string result;
-  int ret;
-  char buffer[4096];
-  while ((ret = read(fd, buffer, sizeof(buffer))) > 0)
+bool FileService::isCompressible(string_view path)
+{
+  static const char *extensions[] = {".html", ".htm", ".css", ".js", ".json",
+                                     ".svg", ".txt", ".xml"};
+  for (size_t idx = 0; idx < sizeof(extensions) / sizeof(extensions[0]); idx++)
   {
-    result.append(buffer, ret);
+    if (this->endswith(path, extensions[idx]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+shared_ptr<const string> FileService::compressedAsset(const pmr::string &path, int fd,
+                                                      const struct stat &st)
+{
+  if (st.st_size < MIN_COMPRESS_SIZE || st.st_size > MAX_COMPRESS_SIZE)
+  {
+    return NULL;
+  }
+
+  string key(path);
+  pthread_mutex_lock(&this->m_compressedLock);
+  unordered_map<string, CompressedAsset>::iterator it = this->m_compressed.find(key);
+  if (it != this->m_compressed.end() && it->second.ino == st.st_ino &&
+      it->second.size == st.st_size && it->second.mtime == st.st_mtime)
+  {
+    shared_ptr<const string> data = it->second.data;
+    pthread_mutex_unlock(&this->m_compressedLock);
+    return data;
+  }
+  pthread_mutex_unlock(&this->m_compressedLock);
+
+  // compress outside the lock; if two requests race to do it the
+  // second one's copy replaces the first
+  string contents(st.st_size, '\0');
+  if (pread(fd, &contents[0], st.st_size, 0) != st.st_size)
+  {
+    return NULL;
+  }
+  shared_ptr<string> compressed = make_shared<string>();
+  if (!this->gzip(contents, compressed.get()) || compressed->size() >= contents.size())
+  {
+    // not worth it, remember that so we don't try again
+    compressed.reset();
+  }
+
+  pthread_mutex_lock(&this->m_compressedLock);
+  CompressedAsset &asset = this->m_compressed[key];
+  this->m_compressedBytes -= asset.data ? asset.data->size() : 0;
+  if (compressed && this->m_compressedBytes + compressed->size() > MAX_COMPRESSED_BYTES)
+  {
+    // the cache is full, send this one without keeping it
+    this->m_compressed.erase(key);
+  }
+  else
+  {
+    asset.ino = st.st_ino;
+    asset.size = st.st_size;
+    asset.mtime = st.st_mtime;
+    asset.data = compressed;
+    this->m_compressedBytes += compressed ? compressed->size() : 0;
+  }
+  pthread_mutex_unlock(&this->m_compressedLock);
+
+  return compressed;
+}
+
+bool FileService::gzip(const string &data, string *out)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 15 window bits plus 16 asks for a gzip header instead of zlib's
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    return false;
   }
 
-  close(fd);
+  out->resize(deflateBound(&stream, data.size()));
+  stream.next_in = (Bytef *)data.data();
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef *)&(*out)[0];
+  stream.avail_out = out->size();
+  int ret = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
 
-  return result;
+  return ret == Z_STREAM_END;
 }
 
-void FileService::head(HTTPRequest *request, HTTPResponse *response)
+void FileService::sendCompressed(HTTPRequest *request, HTTPResponse *response,
+                                 const string &compressed, const struct stat &st, bool sendBody)
+{
+  // The compressed copy is its own representation, so it gets its own
+  // ETag. Ranges aren't offered on it.
+  char etag[64];
+  int etagLength = snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx-gz\"",
+                            (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                            (unsigned long)st.st_mtime);
+  char lastModified[32];
+  size_t lastModifiedLength = HttpUtils::formatDate(st.st_mtime, lastModified);
+  response->setHeader("ETag", string_view(etag, etagLength));
+  response->setHeader("Last-Modified", string_view(lastModified, lastModifiedLength));
+  response->setHeader("Content-Encoding", "gzip");
+
+  if (this->notModified(request, string_view(etag, etagLength), st.st_mtime))
+  {
+    response->setStatus(304);
+  }
+  else if (sendBody)
+  {
+    response->setBody(compressed);
+  }
+  else
+  {
+    response->setContentLength(compressed.size());
+  }
+}
+
+void FileService::streamCompressed(HTTPRequest *request, HTTPResponse *response, CachedFile *file,
+                                   bool sendBody)
 {
-  // HEAD is the same as get but with no body
-  this->get(request, response);
-  response->setBody("");
+  // same representation, and so the same ETag, as a cached copy
+  const struct stat &st = file->st;
+  char etag[64];
+  int etagLength = snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx-gz\"",
+                            (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                            (unsigned long)st.st_mtime);
+  char lastModified[32];
+  size_t lastModifiedLength = HttpUtils::formatDate(st.st_mtime, lastModified);
+  response->setHeader("ETag", string_view(etag, etagLength));
+  response->setHeader("Last-Modified", string_view(lastModified, lastModifiedLength));
+  response->setHeader("Content-Encoding", "gzip");
+
+  if (this->notModified(request, string_view(etag, etagLength), st.st_mtime))
+  {
+    response->setStatus(304);
+    return;
+  }
+  if (!sendBody)
+  {
+    // the length isn't known until it's been compressed
+    response->withStreaming();
+    return;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // a faster level than the cached copies get, since this runs on
+  // every request
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    throw runtime_error("could not start compressing");
+  }
+
+  // the writer asks for more only once the client has taken the last
+  // chunk, so a slow client holds up the reading and compressing
+  char input[16 * 1024];
+  off_t offset = 0;
+  bool finished = false;
+  try
+  {
+    ChunkedWriter *writer = this->streamResponse(request, response);
+    writer->writeFrom([&](char *buffer, size_t size) -> size_t {
+      stream.next_out = (Bytef *)buffer;
+      stream.avail_out = size;
+      while (stream.avail_out > 0 && !finished)
+      {
+        if (stream.avail_in == 0 && offset < st.st_size)
+        {
+          ssize_t ret = pread(file->fd, input, min((off_t)sizeof(input), st.st_size - offset), offset);
+          if (ret <= 0)
+          {
+            // the file shrank underneath us
+            throw runtime_error("could not read the file");
+          }
+          stream.next_in = (Bytef *)input;
+          stream.avail_in = ret;
+          offset += ret;
+        }
+        int ret = deflate(&stream, offset == st.st_size ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+          finished = true;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+          throw runtime_error("could not compress the file");
+        }
+      }
+      return size - stream.avail_out;
+    });
+  }
+  catch (...)
+  {
+    deflateEnd(&stream);
+    throw;
+  }
+  deflateEnd(&stream);
+}
+
+void FileService::sendFile(HTTPRequest *request, HTTPResponse *response, CachedFile *file,
+                           bool sendBody)
+{
+  const struct stat &st = file->st;
+
+  // validators come straight from the inode, so revalidating never
+  // reads the file
+  char etag[64];
+  int etagLength = snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"",
+                            (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                            (unsigned long)st.st_mtime);
+  char lastModified[32];
+  size_t lastModifiedLength = HttpUtils::formatDate(st.st_mtime, lastModified);
+  response->setHeader("ETag", string_view(etag, etagLength));
+  response->setHeader("Last-Modified", string_view(lastModified, lastModifiedLength));
+  response->setHeader("Accept-Ranges", "bytes");
+
+  if (this->notModified(request, string_view(etag, etagLength), st.st_mtime))
+  {
+    response->setStatus(304);
+    return;
+  }
+
+  // Range only applies to GET, and If-Range drops it when the client's
+  // copy is out of date
+  pmr::vector<HttpUtils::ByteRange> ranges(request->memory());
+  HttpUtils::RangeResult rangeResult = HttpUtils::RANGE_IGNORE;
+  string_view value;
+  if (sendBody && request->findHeader("Range", &value))
+  {
+    string_view ifRange;
+    if (!request->findHeader("If-Range", &ifRange) ||
+        ifRange == string_view(etag, etagLength) ||
+        ifRange == string_view(lastModified, lastModifiedLength))
+    {
+      rangeResult = HttpUtils::parseRange(value, st.st_size, &ranges);
+    }
+  }
+
+  bool ok = true;
+  if (rangeResult == HttpUtils::RANGE_NOT_SATISFIABLE)
+  {
+    char contentRange[64];
+    int length = snprintf(contentRange, sizeof(contentRange), "bytes */%lld", (long long)st.st_size);
+    response->setHeader("Content-Range", string_view(contentRange, length));
+    response->setStatus(416);
+  }
+  else if (rangeResult == HttpUtils::RANGE_SATISFIABLE && ranges.size() == 1)
+  {
+    char contentRange[96];
+    int length = snprintf(contentRange, sizeof(contentRange), "bytes %lld-%lld/%lld",
+                          (long long)ranges[0].first, (long long)ranges[0].last, (long long)st.st_size);
+    response->setHeader("Content-Range", string_view(contentRange, length));
+    response->setStatus(206);
+    ok = this->sendRange(response, file, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+  }
+  else if (rangeResult == HttpUtils::RANGE_SATISFIABLE)
+  {
+    response->setStatus(206);
+    ok = this->readRanges(file->fd, st, ranges, response);
+  }
+  else if (sendBody)
+  {
+    ok = this->sendRange(response, file, 0, st.st_size);
+  }
+  else
+  {
+    response->setContentLength(st.st_size);
+  }
+
+  if (!ok)
+  {
+    response->setBody("");
+    response->setStatus(500);
+  }
+}
+
+bool FileService::notModified(HTTPRequest *request, string_view etag, time_t mtime)
+{
+  // If-None-Match wins when both are present
+  string_view value;
+  if (request->findHeader("If-None-Match", &value))
+  {
+    return HttpUtils::matchesETag(value, etag);
+  }
+
+  time_t since;
+  if (request->findHeader("If-Modified-Since", &value) && HttpUtils::parseDate(value, &since))
+  {
+    return mtime <= since;
+  }
+  return false;
+}
+
+bool FileService::sendRange(HTTPResponse *response, CachedFile *file, off_t offset, size_t length)
+{
+  // Small bodies are copied into the response so they go out in the
+  // same writev() as the header. Bigger ones are sent straight from the
+  // cached descriptor, which the response keeps a reference to until
+  // it has been written.
+  if (length < SENDFILE_THRESHOLD)
+  {
+    response->reserveBody(length);
+    return this->readRange(file->fd, offset, length, response);
+  }
+
+  FileCache *files = &this->m_files;
+  files->retain(file);
+  response->setBodyFile(file->fd, offset, length, [files, file]() { files->release(file); });
+  return true;
+}
+
+bool FileService::readRange(int fd, off_t offset, size_t length, HTTPResponse *response)
+{
+  char buffer[4096];
+  while (length > 0)
+  {
+    ssize_t ret = pread(fd, buffer, min(length, sizeof(buffer)), offset);
+    if (ret <= 0)
+    {
+      // the file shrank underneath us
+      return false;
+    }
+    response->appendBody(buffer, ret);
+    offset += ret;
+    length -= ret;
+  }
+  return true;
+}
+
+bool FileService::readRanges(int fd, const struct stat &st,
+                             const pmr::vector<HttpUtils::ByteRange> &ranges,
+                             HTTPResponse *response)
+{
+  // each range becomes one part of a multipart/byteranges body, and
+  // every part carries the type the whole file would have had
+  char boundary[64];
+  int boundaryLength = snprintf(boundary, sizeof(boundary), "gunrock-%lx-%lx",
+                                (unsigned long)st.st_ino, (unsigned long)st.st_mtime);
+  char partType[128];
+  snprintf(partType, sizeof(partType), "%.*s",
+           (int)response->getContentType().size(), response->getContentType().data());
+  char contentType[160];
+  int contentTypeLength = snprintf(contentType, sizeof(contentType),
+                                   "multipart/byteranges; boundary=%.*s", boundaryLength, boundary);
+  response->setContentType(string_view(contentType, contentTypeLength));
+
+  size_t total = 0;
+  for (size_t idx = 0; idx < ranges.size(); idx++)
+  {
+    total += ranges[idx].last - ranges[idx].first + 1 + 256;
+  }
+  response->reserveBody(total);
+
+  char partHeader[256];
+  for (size_t idx = 0; idx < ranges.size(); idx++)
+  {
+    int length = snprintf(partHeader, sizeof(partHeader),
+                          "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                          boundary, partType, (long long)ranges[idx].first,
+                          (long long)ranges[idx].last, (long long)st.st_size);
+    response->appendBody(partHeader, min(length, (int)sizeof(partHeader) - 1));
+    if (!this->readRange(fd, ranges[idx].first, ranges[idx].last - ranges[idx].first + 1, response))
+    {
+      return false;
+    }
+  }
+
+  int length = snprintf(partHeader, sizeof(partHeader), "\r\n--%s--\r\n", boundary);
+  response->appendBody(partHeader, length);
+  return true;
 }
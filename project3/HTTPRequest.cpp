@@ -1,11 +1,13 @@
 #include "HTTPRequest.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
 #include <assert.h>
 #include <errno.h>
 
+#include "ClientError.h"
 #include "HttpUtils.h"
 #include "StringUtils.h"
 
@@ -13,10 +15,13 @@ using namespace std;
 
 #define CONNECT_REPLY "HTTP/1.1 200 Connection Established\r\n\r\n"
 
-HTTPRequest::HTTPRequest(MySocket *sock, int serverPort)
+HTTPRequest::HTTPRequest(MySocket *sock, int serverPort, pmr::memory_resource *memory)
 {
     m_sock = sock;
-    m_http = new HTTP();
+    m_memory = memory;
+    m_http = new (memory->allocate(sizeof(HTTP), alignof(HTTP))) HTTP(HTTP_REQUEST, memory);
+    m_readBufferSize = INITIAL_READ_BUFFER_SIZE;
+    m_readBuffer = (char *) memory->allocate(m_readBufferSize);
     m_serverPort = serverPort;
     m_totalBytesRead = 0;
     m_totalBytesWritten = 0;
@@ -24,7 +29,9 @@ HTTPRequest::HTTPRequest(MySocket *sock, int serverPort)
 
 HTTPRequest::~HTTPRequest()
 {
-    delete m_http;
+    m_http->~HTTP();
+    m_memory->deallocate(m_http, sizeof(HTTP), alignof(HTTP));
+    m_memory->deallocate(m_readBuffer, m_readBufferSize);
 }
 
 void HTTPRequest::printDebugInfo()
@@ -48,53 +55,99 @@ string HTTPRequest::getPath() {
   return m_http->getPath();
 }
 
-string HTTPRequest::getHeader(string key) {
-  vector<pair<string *, string *> >::iterator iter;
-  vector<pair<string *, string *> > headers = m_http->getHeaders();
-  for (iter = headers.begin(); iter != headers.end(); iter++) {
-    string header_key = *(iter->first);
-    if (header_key == key) {
-      return *(iter->second);
-    }
+string_view HTTPRequest::getPathView() {
+  return m_http->getPathView();
+}
+
+string_view HTTPRequest::getQueryView() {
+  return m_http->getQueryView();
+}
+
+bool HTTPRequest::findHeader(string_view key, string_view *value) {
+  return m_http->findHeader(key, value);
+}
+
+string_view HTTPRequest::getHeaderView(string_view key) {
+  string_view value;
+  if (!m_http->findHeader(key, &value)) {
+    return string_view();
   }
+  return value;
+}
 
-  throw "could not find header";
+string HTTPRequest::getHeader(string key) {
+  string_view value;
+  if (!m_http->findHeader(key, &value)) {
+    throw "could not find header";
+  }
+  return string(value);
 }
 
 bool HTTPRequest::hasAuthToken() {
-  try {
-    getHeader("x-auth-token");
-    return true;
-  } catch (...) {
-    return false;
-  }
+  return findHeader("x-auth-token", NULL);
 }
 
 string HTTPRequest::getAuthToken() {
-  try {
-    return getHeader("x-auth-token");
-  } catch (...) {
-    return "";
-  }
+  return string(getHeaderView("x-auth-token"));
 }
 
 vector<string> HTTPRequest::getPathComponents() {
   return StringUtils::split(getPath(), '/');
 }
 
-bool HTTPRequest::readRequest()
+bool HTTPRequest::readHeader()
 {
-    assert(!m_http->isDone());
+    while(!m_http->isHeaderDone()) {
+        readMore();
+    }
 
-    string readData;
+    return true;
+}
+
+bool HTTPRequest::readRequest()
+{
     while(!m_http->isDone()) {
-        readData = m_sock->read();
-	onRead(readData.c_str(), readData.size());
+        readMore();
+    }
+    if(m_requestRead) {
+        m_requestRead();
     }
 
     return true;
 }
 
+void HTTPRequest::readMore()
+{
+    // When more is already waiting than fits, grow the buffer so a big
+    // body takes a few large reads instead of many small ones.
+    int pending = m_sock->pendingBytes();
+    if(pending > m_readBufferSize) {
+        int size = max(pending, min(m_readBufferSize * 2, MySocket::readHighWaterMark()));
+        m_memory->deallocate(m_readBuffer, m_readBufferSize);
+        m_readBuffer = (char *) m_memory->allocate(size);
+        m_readBufferSize = size;
+    }
+
+    int ret = m_sock->read(m_readBuffer, m_readBufferSize);
+    onRead(m_readBuffer, ret);
+}
+
+bool HTTPRequest::readBody(const HTTP::BodySink &consumer)
+{
+    readHeader();
+
+    m_http->setBodySink(&consumer);
+    try {
+        readRequest();
+    } catch (...) {
+        m_http->setBodySink(NULL);
+        throw;
+    }
+    m_http->setBodySink(NULL);
+
+    return true;
+}
+
 void HTTPRequest::onRead(const char *buffer, unsigned int len)
 {
     m_totalBytesRead += len;
@@ -102,23 +155,16 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
     unsigned int bytesRead = 0;
     assert(len > 0);
 
-    while(bytesRead < len) {
-        assert(!m_http->isDone());
+    // Anything left once the request is done is dropped: a request
+    // pipelined behind this one, or the last newline of some CONNECTs,
+    // which the parser finishes before. The connection closes after
+    // the response, so a pipelining client sends the rest again.
+    while(bytesRead < len && !m_http->isDone()) {
         int ret = m_http->addData((const unsigned char *) (buffer + bytesRead), len - bytesRead);
-        assert(ret > 0);
-        bytesRead += ret;
-        
-        // This is a workaround for a parsing bug that sometimes
-        // crops up with connect commands.  The parser will think
-        // it is done before it reads the last newline of some
-        // properly formatted connect requests
-        if(m_http->isDone() && (bytesRead < len)) {
-            if(m_http->isConnect() && ((len-bytesRead) == 1) && (buffer[bytesRead] == '\n')) {
-                break;
-            } else {
-                assert(false);
-            }
+        if(m_http->hasError() || ret <= 0) {
+            throw ClientError::badRequest();
         }
+        bytesRead += ret;
     }
 }
 
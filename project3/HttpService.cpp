@@ -17,10 +17,18 @@ User *HttpService::getAuthenticatedUser(HTTPRequest *request)  {
   return NULL;
 }
 
-string HttpService::pathPrefix() {
+ChunkedWriter *HttpService::streamResponse(HTTPRequest *request, HTTPResponse *response) {
+  return response->beginStreaming(request->getSocket());
+}
+
+const string &HttpService::pathPrefix() {
   return m_pathPrefix;
 }
 
+bool HttpService::streamsRequestBody(HTTPRequest *request) {
+  return false;
+}
+
 void HttpService::head(HTTPRequest *request, HTTPResponse *response) {
   cout << "HEAD " << request->getPath() << endl;
   throw ClientError::methodNotAllowed();
@@ -1,6 +1,8 @@
 #include "MyServerSocket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -8,7 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-MyServerSocket::MyServerSocket(int port)
+MyServerSocket::MyServerSocket(int port, int backlog)
 {
     struct sockaddr_in server;
     int one = 1;
@@ -31,7 +33,20 @@ MyServerSocket::MyServerSocket(int port)
     }	
     
     //set up a listen queue
-    listen(serverFd, 10);
+    listen(serverFd, backlog);
+}
+
+MyServerSocket *MyServerSocket::inherit(int fd)
+{
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 || type != SOCK_STREAM) {
+      throw SocketError("inherited descriptor is not a stream socket");
+    }
+
+    MyServerSocket *server = new MyServerSocket();
+    server->serverFd = fd;
+    return server;
 }
 
 MySocket *MyServerSocket::accept()
@@ -40,11 +55,32 @@ MySocket *MyServerSocket::accept()
     
     struct sockaddr_in client;
     socklen_t len = sizeof(client);
+#ifdef __linux__
+    // close-on-exec so a reloaded binary doesn't hold our clients open
+    int clientFd = ::accept4(serverFd, (struct sockaddr *) &client, &len, SOCK_CLOEXEC);
+#else
     int clientFd = ::accept(serverFd, (struct sockaddr *) &client, &len);
+    if (clientFd >= 0) {
+      fcntl(clientFd, F_SETFD, FD_CLOEXEC);
+      // BSDs hand the listening socket's O_NONBLOCK down
+      fcntl(clientFd, F_SETFL, fcntl(clientFd, F_GETFL) & ~O_NONBLOCK);
+    }
+#endif
     
     if(clientFd<0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+        return NULL;
+      }
       throw SocketError("accept error");
     }
     
     return new MySocket(clientFd);
 }
+
+void MyServerSocket::close()
+{
+    if (serverFd < 0) return;
+
+    ::close(serverFd);
+    serverFd = -1;
+}
@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "ServiceRouter.h"
+
+using namespace std;
+
+ServiceRouter::ServiceRouter() {
+  for (int idx = 0; idx < MAX_METHODS; idx++) {
+    m_handlers[idx] = NULL;
+  }
+}
+
+void ServiceRouter::addService(HttpService *service) {
+  m_services.push_back(service);
+}
+
+void ServiceRouter::addMethod(int method, Handler handler) {
+  if (method >= 0 && method < MAX_METHODS) {
+    m_handlers[method] = handler;
+  }
+}
+
+int ServiceRouter::child(uint32_t node, unsigned char c) {
+  const vector<pair<unsigned char, uint32_t> > &children = m_nodes[node].children;
+  // most nodes have one or two children, a linear scan beats bisecting
+  for (size_t idx = 0; idx < children.size(); idx++) {
+    if (children[idx].first == c) {
+      return children[idx].second;
+    }
+    if (children[idx].first > c) {
+      break;
+    }
+  }
+  return -1;
+}
+
+void ServiceRouter::compile() {
+  m_nodes.clear();
+  m_nodes.push_back(Node());
+  m_nodes[0].service = -1;
+
+  // insert every prefix, keeping the first service registered for it
+  for (size_t idx = 0; idx < m_services.size(); idx++) {
+    const string &prefix = m_services[idx]->pathPrefix();
+    uint32_t node = 0;
+    for (size_t pos = 0; pos < prefix.size(); pos++) {
+      unsigned char c = prefix[pos];
+      int next = child(node, c);
+      if (next < 0) {
+        next = m_nodes.size();
+        m_nodes.push_back(Node());
+        m_nodes[next].service = -1;
+        vector<pair<unsigned char, uint32_t> > &children = m_nodes[node].children;
+        children.insert(lower_bound(children.begin(), children.end(), make_pair(c, (uint32_t) 0)),
+                        make_pair(c, (uint32_t) next));
+      }
+      node = next;
+    }
+    if (m_nodes[node].service < 0) {
+      m_nodes[node].service = idx;
+    }
+  }
+
+  // Push the winners down: a node's service is the earliest registered
+  // of its own and every shorter prefix's. Children are always created
+  // after their parent, so one pass in node order sees parents first.
+  vector<int> parent(m_nodes.size(), -1);
+  for (uint32_t node = 0; node < m_nodes.size(); node++) {
+    for (size_t idx = 0; idx < m_nodes[node].children.size(); idx++) {
+      parent[m_nodes[node].children[idx].second] = node;
+    }
+  }
+  for (uint32_t node = 1; node < m_nodes.size(); node++) {
+    int inherited = m_nodes[parent[node]].service;
+    int own = m_nodes[node].service;
+    if (own < 0 || (inherited >= 0 && inherited < own)) {
+      m_nodes[node].service = inherited;
+    }
+  }
+}
+
+HttpService *ServiceRouter::findService(string_view path) {
+  if (m_nodes.empty()) {
+    return NULL;
+  }
+
+  // the deepest node on the path has the answer
+  uint32_t node = 0;
+  for (size_t pos = 0; pos < path.size(); pos++) {
+    int next = child(node, path[pos]);
+    if (next < 0) {
+      break;
+    }
+    node = next;
+  }
+
+  int service = m_nodes[node].service;
+  return service < 0 ? NULL : m_services[service];
+}
+
+ServiceRouter::Handler ServiceRouter::findHandler(int method) {
+  if (method < 0 || method >= MAX_METHODS) {
+    return NULL;
+  }
+  return m_handlers[method];
+}
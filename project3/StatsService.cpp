@@ -0,0 +1,52 @@
+#include "StatsService.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+using namespace std;
+using namespace rapidjson;
+
+StatsService::StatsService(ServerStats *stats) : HttpService("/stats") {
+  m_stats = stats;
+}
+
+void StatsService::get(HTTPRequest *request, HTTPResponse *response) {
+  StringBuffer buffer;
+  Writer<StringBuffer> writer(buffer);
+
+  writer.StartObject();
+  writer.Key("accepted");
+  writer.Uint64(m_stats->accepted);
+  writer.Key("served");
+  writer.Uint64(m_stats->served);
+  writer.Key("queued");
+  writer.Uint64(m_stats->queued);
+  writer.Key("shed");
+  writer.StartObject();
+  writer.Key("rejected");
+  writer.Uint64(m_stats->rejected);
+  writer.Key("dropped_oldest");
+  writer.Uint64(m_stats->droppedOldest);
+  writer.Key("codel");
+  writer.Uint64(m_stats->codelDropped);
+  writer.EndObject();
+  writer.Key("timed_out");
+  writer.Uint64(m_stats->timedOut);
+  writer.Key("workers");
+  writer.StartObject();
+  writer.Key("running");
+  writer.Uint64(m_stats->workers);
+  writer.Key("idle");
+  writer.Uint64(m_stats->idleWorkers);
+  writer.Key("spawned");
+  writer.Uint64(m_stats->spawned);
+  writer.Key("retired");
+  writer.Uint64(m_stats->retired);
+  writer.EndObject();
+  writer.EndObject();
+
+  response->setContentType("application/json");
+  response->setHeader("Cache-Control", "no-store");
+  response->setBody(buffer.GetString());
+}
@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "WorkerPool.h"
+#include "dthread.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool(Handler handler, Shedder shed, ServerStats *stats) {
+  m_handler = handler;
+  m_shed = shed;
+  m_stats = stats;
+
+  m_minThreads = 1;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  // workers spend most of their time blocked on clients
+  m_maxThreads = 4 * (cores > 0 ? cores : 1);
+  m_queueSize = 1;
+  m_policy = BLOCK;
+  m_spawnWait = 10000;
+  m_idleTimeout = 10000;
+
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_notEmpty, NULL);
+  pthread_cond_init(&m_notFull, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&m_stalled, &attr);
+  pthread_condattr_destroy(&attr);
+  m_idle = 0;
+  m_draining = false;
+  m_monitorRunning = false;
+}
+
+WorkerPool::~WorkerPool() {
+  if (m_monitorRunning) {
+    dthread_mutex_lock(&m_lock);
+    m_draining = true;
+    dthread_cond_broadcast(&m_stalled);
+    dthread_mutex_unlock(&m_lock);
+    dthread_join(m_monitor, NULL);
+  }
+  pthread_cond_destroy(&m_stalled);
+  pthread_cond_destroy(&m_notFull);
+  pthread_cond_destroy(&m_notEmpty);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void WorkerPool::setThreads(int minThreads, int maxThreads) {
+  m_minThreads = minThreads > 0 ? minThreads : 1;
+  if (maxThreads > 0) {
+    m_maxThreads = maxThreads;
+  }
+  if (m_maxThreads < m_minThreads) {
+    m_maxThreads = m_minThreads;
+  }
+}
+
+void WorkerPool::setQueueSize(size_t size) {
+  m_queueSize = size > 0 ? size : 1;
+}
+
+void WorkerPool::setOverloadPolicy(OverloadPolicy policy) {
+  m_policy = policy;
+}
+
+void WorkerPool::setSpawnWait(long micros) {
+  m_spawnWait = micros;
+}
+
+void WorkerPool::setIdleTimeout(long millis) {
+  m_idleTimeout = millis;
+}
+
+long WorkerPool::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void WorkerPool::start() {
+  dthread_mutex_lock(&m_lock);
+  while ((int) m_threads.size() < m_minThreads) {
+    spawn();
+  }
+  dthread_mutex_unlock(&m_lock);
+
+  if (dthread_create(&m_monitor, NULL, runMonitor, this) == 0) {
+    m_monitorRunning = true;
+  }
+}
+
+void WorkerPool::submit(MySocket *client) {
+  MySocket *shed = NULL;
+
+  dthread_mutex_lock(&m_lock);
+  if (m_queue.size() >= m_queueSize) {
+    switch (m_policy) {
+    case BLOCK:
+      // Wait if buffer is full
+      while (m_queue.size() >= m_queueSize) {
+        dthread_cond_wait(&m_notFull, &m_lock);
+      }
+      break;
+    case DROP_OLDEST:
+      shed = m_queue.front().client;
+      m_queue.pop_front();
+      m_stats->queued--;
+      m_stats->droppedOldest++;
+      break;
+    case REJECT:
+    case CODEL:
+      shed = client;
+      client = NULL;
+      m_stats->rejected++;
+      break;
+    }
+  }
+
+  if (client != NULL) {
+    QueuedConnection queued = {client, now()};
+    m_queue.push_back(queued);
+    m_stats->queued++;
+    grow(queued.enqueuedAt);
+
+    // Signal worker threads that a connection is available
+    dthread_cond_signal(&m_notEmpty);
+    if (m_idle == 0) {
+      dthread_cond_signal(&m_stalled);
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+
+  if (shed != NULL) {
+    m_shed(shed);
+  }
+}
+
+void WorkerPool::drain() {
+  dthread_mutex_lock(&m_lock);
+  m_draining = true;
+  dthread_cond_broadcast(&m_notEmpty);
+  dthread_cond_broadcast(&m_stalled);
+  dthread_mutex_unlock(&m_lock);
+
+  // the monitor may be starting a worker, which then has to be joined
+  if (m_monitorRunning) {
+    dthread_join(m_monitor, NULL);
+    m_monitorRunning = false;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  vector<pthread_t> threads = m_threads;
+  threads.insert(threads.end(), m_retired.begin(), m_retired.end());
+  m_retired.clear();
+  dthread_mutex_unlock(&m_lock);
+
+  // workers only exit once the queue is empty
+  for (size_t idx = 0; idx < threads.size(); idx++) {
+    dthread_join(threads[idx], NULL);
+  }
+}
+
+void *WorkerPool::run(void *arg) {
+  ((WorkerPool *) arg)->work();
+  return NULL;
+}
+
+void WorkerPool::work() {
+  Arena arena;
+  bool retire = false;
+  // spawn() already counted us as idle
+  bool first = true;
+
+  dthread_mutex_lock(&m_lock);
+  while (true) {
+    // Wait for available connections
+    if (!first) {
+      m_idle++;
+      m_stats->idleWorkers++;
+    }
+    first = false;
+    while (m_queue.empty() && !m_draining) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += m_idleTimeout / 1000;
+      deadline.tv_nsec += (m_idleTimeout % 1000) * 1000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      int ret = dthread_cond_timedwait(&m_notEmpty, &m_lock, &deadline);
+      if (ret == ETIMEDOUT && m_queue.empty() && (int) m_threads.size() > m_minThreads) {
+        retire = true;
+        break;
+      }
+    }
+    m_idle--;
+    m_stats->idleWorkers--;
+    if (retire || m_queue.empty()) {
+      // idle for too long, or the pool is draining and there's
+      // nothing left to do
+      break;
+    }
+
+    // Retrieve connection
+    QueuedConnection queued = m_queue.front();
+    m_queue.pop_front();
+    m_stats->queued--;
+
+    long time = now();
+    bool shed = m_policy == CODEL && m_codel.shouldDrop(time - queued.enqueuedAt, time);
+    // whoever is behind it may need another worker
+    grow(time);
+    if (m_idle == 0 && !m_queue.empty()) {
+      dthread_cond_signal(&m_stalled);
+    }
+
+    // Signal main thread if space is available in the queue
+    dthread_cond_signal(&m_notFull);
+    dthread_mutex_unlock(&m_lock);
+
+    if (shed) {
+      m_stats->codelDropped++;
+      m_shed(queued.client);
+    } else {
+      m_handler(queued.client, &arena);
+      arena.reset();
+    }
+
+    dthread_mutex_lock(&m_lock);
+  }
+
+  if (retire) {
+    // drain() or the next spawn() joins us
+    pthread_t self = pthread_self();
+    for (size_t idx = 0; idx < m_threads.size(); idx++) {
+      if (pthread_equal(m_threads[idx], self)) {
+        m_threads.erase(m_threads.begin() + idx);
+        break;
+      }
+    }
+    m_retired.push_back(self);
+    m_stats->retired++;
+  }
+  m_stats->workers--;
+  dthread_mutex_unlock(&m_lock);
+}
+
+void WorkerPool::grow(long time) {
+  if (m_idle == 0 && !m_draining && (int) m_threads.size() < m_maxThreads &&
+      !m_queue.empty() && time - m_queue.front().enqueuedAt >= m_spawnWait) {
+    spawn();
+  }
+}
+
+void WorkerPool::spawn() {
+  reap();
+
+  pthread_t thread;
+  if (dthread_create(&thread, NULL, run, this) != 0) {
+    return;
+  }
+  m_threads.push_back(thread);
+  // count it as free from the start, so the queue doesn't look stuck
+  // while it's still starting up
+  m_idle++;
+  m_stats->idleWorkers++;
+  m_stats->workers++;
+  m_stats->spawned++;
+}
+
+void WorkerPool::reap() {
+  // retired workers have already let go of the lock, so they'll exit
+  // without needing it
+  for (size_t idx = 0; idx < m_retired.size(); idx++) {
+    dthread_join(m_retired[idx], NULL);
+  }
+  m_retired.clear();
+}
+
+void *WorkerPool::runMonitor(void *arg) {
+  ((WorkerPool *) arg)->monitor();
+  return NULL;
+}
+
+void WorkerPool::monitor() {
+  dthread_mutex_lock(&m_lock);
+  while (!m_draining) {
+    if (m_queue.empty() || m_idle > 0 || (int) m_threads.size() >= m_maxThreads) {
+      // nothing is stuck; submit() and the workers say when that changes
+      dthread_cond_wait(&m_stalled, &m_lock);
+      continue;
+    }
+
+    long deadline = m_queue.front().enqueuedAt + m_spawnWait;
+    if (now() < deadline) {
+      struct timespec ts;
+      ts.tv_sec = deadline / 1000000;
+      ts.tv_nsec = (deadline % 1000000) * 1000;
+      dthread_cond_timedwait(&m_stalled, &m_lock, &ts);
+      continue;
+    }
+    size_t threads = m_threads.size();
+    grow(now());
+    if (m_threads.size() == threads) {
+      // no thread to be had for now; try again once something changes
+      dthread_cond_wait(&m_stalled, &m_lock);
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+}
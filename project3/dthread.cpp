@@ -12,7 +12,7 @@ std::vector<pthread_t> thread_list;
 int logFd = -1;
 
 void set_log_file(std::string file_name) {
-  logFd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  logFd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
   if (logFd < 0) {
     std::cerr << "Could not open log file: " << file_name << std::endl;
     exit(1);
@@ -95,6 +95,14 @@ int dthread_detach(pthread_t thread) {
   return ret;
 }
 
+int dthread_join(pthread_t thread, void **retval) {
+  sync_print_thread("dthread_join_enter", NULL, NULL);
+  int ret = pthread_join(thread, retval);
+  sync_print_thread("dthread_join_return", NULL, NULL);
+
+  return ret;
+}
+
 int dthread_mutex_lock(pthread_mutex_t *mutex) {
   sync_print_thread("dthread_mutex_lock_enter", mutex, NULL);
   int ret = pthread_mutex_lock(mutex);
@@ -119,6 +127,15 @@ int dthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
   return ret;
 }
 
+int dthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+			   const struct timespec *abstime) {
+  sync_print_thread("dthread_cond_timedwait_enter", mutex, cond);
+  int ret = pthread_cond_timedwait(cond, mutex, abstime);
+  sync_print_thread("dthread_cond_timedwait_return", mutex, cond);
+
+  return ret;
+}
+
 int dthread_cond_signal(pthread_cond_t *cond) {
   sync_print_thread("dthread_cond_signal_enter", NULL, cond);
   int ret = pthread_cond_signal(cond);
@@ -1,16 +1,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <string.h>
 
 #include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 #include <sstream>
-#include <deque>
 
+#include "Arena.h"
+#include "ClientError.h"
+#include "ConnectionTimer.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
 #include "HttpService.h"
@@ -18,94 +24,184 @@
 #include "FileService.h"
 #include "MySocket.h"
 #include "MyServerSocket.h"
+#include "ServiceRouter.h"
+#include "ServerStats.h"
+#include "StatsService.h"
+#include "TimerWheel.h"
+#include "WorkerPool.h"
 #include "dthread.h"
 
 using namespace std;
 
 int PORT = 8080;
 int THREAD_POOL_SIZE = 1;
+// 0 lets the pool pick from the number of cores
+int MAX_THREADS = 0;
 size_t BUFFER_SIZE = 1;
 string BASEDIR = "static";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
+bool COMPRESS = false;
+int LISTEN_BACKLOG = 10;
+WorkerPool::OverloadPolicy OVERLOAD = WorkerPool::BLOCK;
 
-vector<HttpService *> services;
+// services by path prefix, and the methods this server implements
+ServiceRouter router;
 
-// Connection queue and synchronization constructs
-std::deque<MySocket *> connection_queue;
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
-pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+// read and write deadlines for every connection
+TimerWheel timers;
 
-HttpService *find_service(HTTPRequest *request)
-{
-  // find a service that is registered for this path prefix
-  for (unsigned int idx = 0; idx < services.size(); idx++)
-  {
-    if (request->getPath().find(services[idx]->pathPrefix()) == 0)
-    {
-      return services[idx];
-    }
-  }
+ServerStats stats;
+
+// signal handlers write the signal number here to wake the accept
+// loop up
+int signal_pipe[2] = {-1, -1};
+
+// how a reloaded binary finds the listening socket, and the pipe it
+// tells the old process it's up on
+#define LISTEN_FD_ENV "GUNROCK_LISTEN_FD"
+#define READY_FD_ENV "GUNROCK_READY_FD"
 
-  return NULL;
+extern char **environ;
+
+static const char SERVICE_UNAVAILABLE[] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\n"
+  "Connection: close\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n";
+
+// Turn a connection away without reading its request. This never
+// blocks, so it's safe to do from the accept loop.
+void shed_connection(MySocket *client)
+{
+  client->shutdown(SERVICE_UNAVAILABLE, strlen(SERVICE_UNAVAILABLE));
+  client->close();
+  delete client;
 }
 
 void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPResponse *response)
 {
   stringstream payload;
 
-  // invoke the service if we found one
-  if (service == NULL)
-  {
-    // not found status
-    response->setStatus(404);
-  }
-  else if (request->isHead())
+  try
   {
-    service->head(request, response);
+    // invoke the service if we found one
+    if (service == NULL)
+    {
+      // not found status
+      response->setStatus(404);
+    }
+    else if (router.findHandler(request->getMethod()) == NULL)
+    {
+      // The server doesn't know about this method
+      response->setStatus(501);
+    }
+    else
+    {
+      (service->*router.findHandler(request->getMethod()))(request, response);
+    }
   }
-  else if (request->isGet())
+  catch (ClientError &ce)
   {
-    service->get(request, response);
+    if (response->isSent())
+    {
+      // too late for a status, the body just mustn't look complete
+      response->abortStreaming();
+    }
+    else
+    {
+      response->setStatus(ce.status_code);
+    }
   }
-  else
+  catch (...)
   {
-    // The server doesn't know about this method
-    response->setStatus(501);
+    // reset the response object and return an error, unless the
+    // service already started streaming
+    if (response->isSent())
+    {
+      response->abortStreaming();
+    }
+    else
+    {
+      response->setBody("");
+      response->setStatus(500);
+    }
   }
 }
 
-void handle_request(MySocket *client)
+void handle_request(MySocket *client, Arena *arena)
 {
-  HTTPRequest *request = new HTTPRequest(client, PORT);
-  HTTPResponse *response = new HTTPResponse();
+  // everything for this request comes out of the worker's arena, which
+  // the worker resets once we return
+  HTTPRequest *request = arena->create<HTTPRequest>(client, PORT, arena);
+  HTTPResponse *response = arena->create<HTTPResponse>(arena);
+  ConnectionTimer *timer = arena->create<ConnectionTimer>(&timers, client);
   stringstream payload;
 
-  // read in the request
+  // read in the request; services that stream the body read it
+  // themselves once they're invoked
   bool readResult = false;
+  HttpService *service = NULL;
   try
   {
     payload << "client: " << (void *)client;
     sync_print("read_request_enter", payload.str());
-    readResult = request->readRequest();
+    // the read deadline stops once the whole request is in, even when a
+    // streaming service is the one that reads it and then has work to do
+    request->onRequestRead([timer]() { timer->done(); });
+    timer->readingHeader();
+    readResult = request->readHeader();
+    timer->readingBody();
+    service = router.findService(request->getPathView());
+    if (service == NULL || !service->streamsRequestBody(request))
+    {
+      readResult = request->readRequest();
+    }
     sync_print("read_request_return", payload.str());
   }
+  catch (ClientError &ce)
+  {
+    // a request we can't parse still gets an answer
+    readResult = false;
+    response->setStatus(ce.status_code);
+  }
   catch (...)
   {
     // swallow it
+    readResult = false;
   }
 
-  if (!readResult)
+  if (!readResult || timer->timedOut())
   {
-    // there was a problem reading in the request, bail
-    delete response;
-    delete request;
+    // there was a problem reading in the request, or the client took
+    // too long and has already been sent a 408, bail
+    if (timer->timedOut())
+    {
+      stats.timedOut++;
+    }
+    else if (response->getStatus() != 200)
+    {
+      try
+      {
+        timer->writing();
+        response->write(client);
+      }
+      catch (...)
+      {
+        // the client went away
+      }
+    }
+    timer->done();
+    arena->destroy(timer);
+    arena->destroy(response);
+    arena->destroy(request);
     sync_print("read_request_error", payload.str());
+    client->close();
+    delete client;
     return;
   }
 
-  HttpService *service = find_service(request);
   invoke_service_method(service, request, response);
 
   // send data back to the client and clean up
@@ -114,10 +210,33 @@ void handle_request(MySocket *client)
   payload << " RESPONSE " << response->getStatus() << " client: " << (void *)client;
   sync_print("write_response", payload.str());
   cout << payload.str() << endl;
-  client->write(response->response());
+  try
+  {
+    timer->writing();
+    if (response->isSent())
+    {
+      // the service streamed its response itself
+      response->finishStreaming();
+    }
+    else
+    {
+      response->write(client);
+    }
+  }
+  catch (...)
+  {
+    // the client went away, nothing more to send
+  }
+  timer->done();
+  if (timer->timedOut())
+  {
+    stats.timedOut++;
+  }
+  stats.served++;
 
-  delete response;
-  delete request;
+  arena->destroy(timer);
+  arena->destroy(response);
+  arena->destroy(request);
 
   payload.str("");
   payload.clear();
@@ -127,34 +246,65 @@ void handle_request(MySocket *client)
   delete client;
 }
 
-// Worker thread function
-void *worker_thread_func(void *arg)
+void handle_signal(int signum)
 {
-  while (true)
+  int saved = errno;
+  unsigned char sig = signum;
+  if (write(signal_pipe[1], &sig, 1) < 0)
   {
-    dthread_mutex_lock(&queue_mutex);
+    // the loop already has a wakeup pending
+  }
+  errno = saved;
+}
 
-    // Wait for available connections
-    while (connection_queue.empty())
+// Start a fresh copy of our binary (whatever is at argv[0] now) that
+// inherits the listening socket. Returns the child's pid, or -1, and
+// the read end of the pipe it will write to once it is serving.
+pid_t start_reload(char *argv[], int listenFd, int *readyFd)
+{
+  int ready[2];
+  if (pipe(ready) != 0)
+  {
+    return -1;
+  }
+  fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+
+  // everything the child needs is built before fork(), the child may
+  // only make async-signal-safe calls until it execs
+  vector<string> env;
+  for (char **var = environ; *var != NULL; var++)
+  {
+    if (strncmp(*var, LISTEN_FD_ENV "=", strlen(LISTEN_FD_ENV) + 1) != 0 &&
+        strncmp(*var, READY_FD_ENV "=", strlen(READY_FD_ENV) + 1) != 0)
     {
-      dthread_cond_wait(&queue_not_empty, &queue_mutex);
+      env.push_back(*var);
     }
+  }
+  env.push_back(string(LISTEN_FD_ENV "=") + to_string(listenFd));
+  env.push_back(string(READY_FD_ENV "=") + to_string(ready[1]));
+  vector<char *> envp;
+  for (size_t idx = 0; idx < env.size(); idx++)
+  {
+    envp.push_back((char *)env[idx].c_str());
+  }
+  envp.push_back(NULL);
 
-    // Retrieve connection
-    MySocket *client = connection_queue.front();
-    connection_queue.pop_front();
-
-    // Signal main thread if space is available in the queue
-    dthread_cond_signal(&queue_not_full);
-
-    dthread_mutex_unlock(&queue_mutex);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    environ = envp.data();
+    execvp(argv[0], argv);
+    _exit(127);
+  }
 
-    if (client != nullptr)
-    {
-      handle_request(client);
-    }
+  close(ready[1]);
+  if (pid < 0)
+  {
+    close(ready[0]);
+    return -1;
   }
-  return nullptr;
+  *readyFd = ready[0];
+  return pid;
 }
 
 int main(int argc, char *argv[])
@@ -163,7 +313,7 @@ int main(int argc, char *argv[])
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:")) != -1)
+  while ((option = getopt(argc, argv, "d:p:t:m:b:s:l:zo:q:")) != -1)
   {
     switch (option)
     {
@@ -176,6 +326,9 @@ int main(int argc, char *argv[])
     case 't':
       THREAD_POOL_SIZE = atoi(optarg);
       break;
+    case 'm':
+      MAX_THREADS = atoi(optarg);
+      break;
     case 'b':
       BUFFER_SIZE = atoi(optarg);
       break;
@@ -185,8 +338,38 @@ int main(int argc, char *argv[])
     case 'l':
       LOGFILE = string(optarg);
       break;
+    case 'z':
+      COMPRESS = true;
+      break;
+    case 'o':
+      if (string(optarg) == "block")
+      {
+        OVERLOAD = WorkerPool::BLOCK;
+      }
+      else if (string(optarg) == "reject")
+      {
+        OVERLOAD = WorkerPool::REJECT;
+      }
+      else if (string(optarg) == "drop-oldest")
+      {
+        OVERLOAD = WorkerPool::DROP_OLDEST;
+      }
+      else if (string(optarg) == "codel")
+      {
+        OVERLOAD = WorkerPool::CODEL;
+      }
+      else
+      {
+        cerr << "unknown overload policy " << optarg << endl;
+        exit(1);
+      }
+      break;
+    case 'q':
+      LISTEN_BACKLOG = atoi(optarg);
+      break;
     default:
-      cerr << "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers]" << endl;
+      cerr << "usage: " << argv[0] << " [-p port] [-t min threads] [-m max threads] [-b buffers] [-z]"
+           << " [-o block|reject|drop-oldest|codel] [-q listen backlog]" << endl;
       exit(1);
     }
   }
@@ -194,12 +377,35 @@ int main(int argc, char *argv[])
   set_log_file(LOGFILE);
 
   sync_print("init", "");
-  MyServerSocket *server = new MyServerSocket(PORT);
+
+  // a reload hands us the socket the previous binary was listening on
+  MyServerSocket *server;
+  int ready_fd = -1;
+  if (getenv(LISTEN_FD_ENV) != NULL)
+  {
+    server = MyServerSocket::inherit(atoi(getenv(LISTEN_FD_ENV)));
+    if (getenv(READY_FD_ENV) != NULL)
+    {
+      ready_fd = atoi(getenv(READY_FD_ENV));
+      fcntl(ready_fd, F_SETFD, FD_CLOEXEC);
+    }
+    unsetenv(LISTEN_FD_ENV);
+    unsetenv(READY_FD_ENV);
+  }
+  else
+  {
+    server = new MyServerSocket(PORT, LISTEN_BACKLOG);
+  }
   MySocket *client;
 
-  // The order that you push services dictates the search order
+  // The order that you add services dictates the search order
   // for path prefix matching
-  services.push_back(new FileService(BASEDIR));
+  router.addService(new StatsService(&stats));
+  router.addService(new FileService(BASEDIR, COMPRESS));
+  router.compile();
+
+  router.addMethod(HTTP_HEAD, &HttpService::head);
+  router.addMethod(HTTP_GET, &HttpService::get);
 
   // while (true)
   // {
@@ -209,33 +415,138 @@ int main(int argc, char *argv[])
   //   handle_request(client);
   // }
 
-  // Create a thread pool
-  for (int i = 0; i < THREAD_POOL_SIZE; ++i)
+  // SIGTERM drains and exits; SIGHUP and SIGUSR2 start a new binary
+  // on the same socket and drain once it's up
+  if (pipe(signal_pipe) != 0)
   {
-    pthread_t thread;
-    dthread_create(&thread, nullptr, worker_thread_func, nullptr);
-    dthread_detach(thread); // Detach so we don’t need to manage thread join
+    cerr << "could not create the signal pipe" << endl;
+    exit(1);
   }
+  fcntl(signal_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(signal_pipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGHUP, &action, NULL);
+  sigaction(SIGUSR2, &action, NULL);
+
+  // we wait in poll(), and another process may take the connection
+  // first after a reload, so accept() must not block
+  int listen_fd = server->getFd();
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+  timers.start();
+
+  WorkerPool pool(handle_request, shed_connection, &stats);
+  pool.setThreads(THREAD_POOL_SIZE, MAX_THREADS);
+  pool.setQueueSize(BUFFER_SIZE);
+  pool.setOverloadPolicy(OVERLOAD);
+  pool.start();
+
+  if (ready_fd >= 0)
+  {
+    // the old binary can stop accepting now
+    if (write(ready_fd, "1", 1) < 0)
+    {
+      cerr << "could not tell the previous binary we're up" << endl;
+    }
+    close(ready_fd);
+  }
+
+  // the binary we're handing over to, while it starts up
+  pid_t reload_pid = -1;
+  int reload_fd = -1;
+  bool stopping = false;
 
-  while (true)
+  while (!stopping)
   {
     sync_print("waiting_to_accept", "");
-    client = server->accept();
-    sync_print("client_accepted", "");
+    struct pollfd fds[3];
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = signal_pipe[0];
+    fds[1].events = POLLIN;
+    fds[2].fd = reload_fd;
+    fds[2].events = POLLIN;
+    if (poll(fds, 3, -1) < 0)
+    {
+      continue;
+    }
 
-    dthread_mutex_lock(&queue_mutex);
+    if (fds[1].revents & POLLIN)
+    {
+      unsigned char sig;
+      if (read(signal_pipe[0], &sig, 1) == 1)
+      {
+        if (sig == SIGTERM)
+        {
+          stopping = true;
+        }
+        else if (reload_pid < 0)
+        {
+          reload_pid = start_reload(argv, listen_fd, &reload_fd);
+          if (reload_pid < 0)
+          {
+            cerr << "reload failed: " << strerror(errno) << endl;
+          }
+        }
+      }
+    }
 
-    // Wait if buffer is full
-    while (connection_queue.size() >= BUFFER_SIZE)
+    if (reload_fd >= 0 && fds[2].revents != 0)
     {
-      dthread_cond_wait(&queue_not_full, &queue_mutex);
+      char ready;
+      if (read(reload_fd, &ready, 1) == 1)
+      {
+        // it's serving on the same socket, leave the rest to it
+        cerr << "new binary is up (pid " << reload_pid << ")" << endl;
+        stopping = true;
+      }
+      else
+      {
+        // it died or couldn't exec, keep serving
+        cerr << "new binary failed to start" << endl;
+        waitpid(reload_pid, NULL, 0);
+        reload_pid = -1;
+      }
+      close(reload_fd);
+      reload_fd = -1;
     }
 
-    connection_queue.push_back(client);
+    if (stopping || !(fds[0].revents & POLLIN))
+    {
+      continue;
+    }
 
-    // Signal worker threads that a connection is available
-    dthread_cond_signal(&queue_not_empty);
+    try
+    {
+      client = server->accept();
+    }
+    catch (SocketError &e)
+    {
+      // out of descriptors for the moment, give the workers a chance
+      // to close some
+      usleep(10000);
+      continue;
+    }
+    if (client == NULL)
+    {
+      // someone else got it
+      continue;
+    }
+    sync_print("client_accepted", "");
+    stats.accepted++;
 
-    dthread_mutex_unlock(&queue_mutex);
+    pool.submit(client);
   }
+
+  // stop listening and finish what was already accepted; after a
+  // reload the new binary keeps the socket open
+  server->close();
+  cerr << "shutting down, draining requests" << endl;
+  pool.drain();
+  return 0;
 }
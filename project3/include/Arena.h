@@ -0,0 +1,73 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+/**
+ * A monotonic (bump pointer) allocator for request-scoped memory.
+ *
+ * Each worker thread owns one Arena. Everything that lives only as
+ * long as a single request -- the HTTPRequest and HTTPResponse objects,
+ * the raw request buffer, parsed headers, response headers and body --
+ * is carved out of it, and when the response has been written the
+ * whole lot is thrown away at once with reset().
+ *
+ * Arena is a std::pmr::memory_resource so standard containers can use
+ * it directly (std::pmr::string, std::pmr::vector, ...). Deallocation
+ * is a no-op; memory is only reclaimed by reset(). An Arena is not
+ * thread safe.
+ */
+class Arena : public std::pmr::memory_resource {
+ public:
+  Arena(size_t blockSize = 64 * 1024);
+  ~Arena();
+
+  /**
+   * Release everything allocated since the last reset. The first block
+   * is kept for reuse, so in the common case where a request fits in
+   * it this is O(1); overflow blocks are returned to the heap.
+   */
+  void reset();
+
+  // bytes handed out since the last reset
+  size_t bytesUsed() { return m_used; }
+
+  template<typename T, typename... Args>
+  T *create(Args&&... args) {
+    void *memory = allocate(sizeof(T), alignof(T));
+    return new (memory) T(std::forward<Args>(args)...);
+  }
+
+  template<typename T>
+  void destroy(T *object) {
+    if (object != NULL) {
+      object->~T();
+    }
+  }
+
+ protected:
+  void *do_allocate(size_t bytes, size_t alignment);
+  void do_deallocate(void *p, size_t bytes, size_t alignment);
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept;
+
+ private:
+  struct Block {
+    Block *next;
+    size_t size;
+  };
+
+  void *allocateOverflow(size_t bytes, size_t alignment);
+
+  size_t m_blockSize;
+  char *m_first;
+  char *m_current;
+  char *m_end;
+  Block *m_overflow;
+  size_t m_used;
+};
+
+#endif
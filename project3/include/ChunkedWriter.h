@@ -0,0 +1,63 @@
+#ifndef _CHUNKED_WRITER_H_
+#define _CHUNKED_WRITER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory_resource>
+#include <string_view>
+
+#include "MySocket.h"
+
+/**
+ * Writes a response body to the client incrementally using chunked
+ * transfer encoding.
+ *
+ * Data is collected in a fixed-size buffer and sent one chunk at a
+ * time, so memory use is bounded by the buffer no matter how large
+ * the body is. Each chunk (size line, data and trailing CRLF) goes out
+ * in a single writev(). Writes block until the kernel has accepted
+ * the previous chunk, which is what pushes back on a handler that
+ * produces data faster than the client reads it.
+ *
+ * Services get one from HttpService::streamResponse(); the framework
+ * calls finish() for them if they don't.
+ */
+class ChunkedWriter {
+ public:
+  ChunkedWriter(MySocket *client, size_t bufferSize = 64 * 1024,
+                std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+  ~ChunkedWriter();
+
+  // append to the body, sending a chunk whenever the buffer fills
+  void write(const void *data, size_t len);
+  void write(std::string_view data) { write(data.data(), data.size()); }
+
+  /**
+   * Pull the body from `producer`, which is handed free buffer space
+   * and returns how many bytes it put there; returning 0 ends the
+   * loop. The producer is only called again once the previous chunk
+   * has been written.
+   */
+  void writeFrom(std::function<size_t(char *buffer, size_t size)> producer);
+
+  // send whatever is buffered as a chunk
+  void flush();
+
+  // flush and send the terminating zero-length chunk
+  void finish();
+  bool isFinished() { return m_finished; }
+
+  size_t bytesWritten() { return m_bytesWritten; }
+
+ private:
+  MySocket *m_client;
+  std::pmr::memory_resource *m_memory;
+  char *m_buffer;
+  size_t m_bufferSize;
+  size_t m_buffered;
+  size_t m_bytesWritten;
+  bool m_finished;
+};
+
+#endif
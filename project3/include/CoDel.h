@@ -0,0 +1,42 @@
+#ifndef _CODEL_H_
+#define _CODEL_H_
+
+/**
+ * Decides which queued connections to shed based on how long they
+ * waited, following CoDel (RFC 8289).
+ *
+ * A queue that is long but drains quickly is fine; what hurts is a
+ * standing queue, where every connection waits. Once the time spent
+ * in the queue has stayed above `target` for a whole `interval`, the
+ * controller starts shedding, and sheds more often (interval / sqrt of
+ * the drop count) until the wait falls back under the target.
+ *
+ * Not thread safe; call it with the queue's lock held.
+ */
+class CoDel {
+ public:
+  CoDel(long targetMicros = 5000, long intervalMicros = 100000);
+
+  /**
+   * Call for every connection taken off the queue.
+   *
+   * @param sojournMicros how long the connection waited in the queue
+   * @param nowMicros the current time on the monotonic clock
+   * @return true if the connection should be shed
+   */
+  bool shouldDrop(long sojournMicros, long nowMicros);
+
+ private:
+  long controlLaw(long t);
+
+  long m_target;
+  long m_interval;
+  // when the wait first went above the target, plus an interval, or 0
+  long m_firstAboveTime;
+  bool m_dropping;
+  long m_dropNext;
+  unsigned int m_count;
+  unsigned int m_lastCount;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _CONNECTION_TIMER_H_
+#define _CONNECTION_TIMER_H_
+
+#include <atomic>
+
+#include "MySocket.h"
+#include "TimerWheel.h"
+
+/**
+ * The deadlines for one client connection.
+ *
+ * The worker tells the timer which phase the connection is in and the
+ * timer, running on the wheel's thread, cuts the connection off if the
+ * client doesn't keep up:
+ *
+ *  - idle: the connection has to send its first byte within
+ *    idleTimeout. This server closes connections after every response,
+ *    so this is also the only keep-alive idle time there is.
+ *  - header: the whole request header has to arrive within
+ *    headerTimeout of the connection being picked up, however slowly
+ *    it trickles in.
+ *  - body: the body has to keep arriving, with no gap longer than
+ *    bodyTimeout.
+ *  - write: the client has to keep reading the response, with no gap
+ *    longer than writeTimeout.
+ *
+ * Progress is read off the socket's byte counters when a deadline
+ * passes, so the read and write paths never touch the timer. A request
+ * that times out before the response starts gets a 408; after that
+ * the connection is just shut down. Either way the blocked worker
+ * sees an error from the socket and closes it.
+ */
+class ConnectionTimer : public Timer {
+ public:
+  static long idleTimeout;
+  static long headerTimeout;
+  static long bodyTimeout;
+  static long writeTimeout;
+
+  ConnectionTimer(TimerWheel *wheel, MySocket *client);
+
+  // the phases, in the order a connection goes through them
+  void readingHeader();
+  void readingBody();
+  void writing();
+  void done();
+
+  // whether the connection was cut off
+  bool timedOut();
+
+ protected:
+  long expired();
+
+ private:
+  enum Phase { IDLE, HEADER, BODY, WRITE, DONE };
+
+  void abort(bool notify);
+
+  TimerWheel *m_wheel;
+  MySocket *m_client;
+  std::atomic<int> m_phase;
+  // the byte count the last time the deadline was checked
+  std::atomic<unsigned long> m_progress;
+  std::atomic<bool> m_timedOut;
+};
+
+#endif
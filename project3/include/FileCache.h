@@ -0,0 +1,103 @@
+#ifndef _FILE_CACHE_H_
+#define _FILE_CACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * An open file shared through the FileCache. `fd` is only used with
+ * positional I/O (pread, sendfile with an offset) so any number of
+ * workers can use it at once.
+ */
+struct CachedFile {
+  std::string path;
+  int fd;
+  struct stat st;
+  // when st was last checked against the file system, in milliseconds
+  // on the monotonic clock
+  long validatedAt;
+  // the cache holds one reference while the file is in it, and every
+  // acquire() holds another until release()
+  int refs;
+  std::list<CachedFile *>::iterator lru;
+};
+
+/**
+ * A cache of open file descriptors keyed by path.
+ *
+ * Serving a file normally costs an open(), fstat() and close(), plus
+ * the path walk inside open(), on every request. The cache keeps
+ * recently used files open along with their fstat metadata so a hit
+ * is a hash lookup. Entries are revalidated with stat() once they are
+ * older than the TTL, and a file whose inode, size or mtime changed is
+ * reopened. Files that are dropped from the cache while a worker is
+ * still using them stay open until the last reference is released.
+ *
+ * Paths that don't exist are remembered for a short time too, so a
+ * scanner or a broken link asking for the same missing file over and
+ * over doesn't cost an open() each time. A file created in the
+ * meantime shows up once that entry expires.
+ *
+ * Contents are never cached; large files are served straight from the
+ * descriptor with sendfile().
+ */
+class FileCache {
+ public:
+  /**
+   * @param maxEntries how many files to keep open
+   * @param ttlMillis how long an entry is trusted before it's checked
+   *   against the file system again
+   * @param missingTtlMillis how long to remember that a path doesn't
+   *   exist
+   * @param maxMissing how many missing paths to remember
+   */
+  FileCache(size_t maxEntries = 1024, long ttlMillis = 1000,
+            long missingTtlMillis = 2000, size_t maxMissing = 4096);
+  ~FileCache();
+
+  /**
+   * Look up or open a regular file and take a reference to it.
+   *
+   * @param path the file to open
+   * @return the file, or NULL with errno set when it can't be opened or
+   *   isn't a regular file (EISDIR, ENOENT, EACCES, ...)
+   */
+  CachedFile *acquire(std::string_view path);
+
+  // take another reference to a file the caller already holds
+  void retain(CachedFile *file);
+
+  // drop a reference taken by acquire() or retain()
+  void release(CachedFile *file);
+
+ private:
+  static long now();
+  static bool sameFile(const struct stat &a, const struct stat &b);
+
+  CachedFile *open(std::string_view path);
+  // removes `file` from the table; the caller holds m_lock
+  void evict(CachedFile *file);
+  void unref(CachedFile *file);
+  bool isMissing(const std::string &path);
+  void addMissing(const std::string &path);
+
+  size_t m_maxEntries;
+  long m_ttlMillis;
+  pthread_mutex_t m_lock;
+  std::unordered_map<std::string, CachedFile *> m_entries;
+  // most recently used at the front
+  std::list<CachedFile *> m_lru;
+
+  long m_missingTtlMillis;
+  size_t m_maxMissing;
+  // path to when we stop believing it's missing
+  std::unordered_map<std::string, long> m_missing;
+};
+
+#endif
@@ -1,23 +1,83 @@
 #ifndef _FILESERVICE_H_
 #define _FILESERVICE_H_
 
+#include "FileCache.h"
 #include "HttpService.h"
+#include "HttpUtils.h"
 
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 class FileService : public HttpService {
  public:
-  FileService(std::string basedir);
+  /**
+   * Serves files under `basedir`. A sibling `.br` or `.gz` file is sent
+   * instead when the client accepts that encoding. With `compress`,
+   * text files that have no such sibling are gzipped on first request
+   * and the result is kept in memory, or streamed through gzip on
+   * every request when they're over MAX_COMPRESS_SIZE.
+   */
+  FileService(std::string basedir, bool compress = false);
   ~FileService();
 
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void head(HTTPRequest *request, HTTPResponse *response);
 
 private:
-  bool endswith(std::string str, std::string suffix);
-  std::string readFile(std::string path);
+  bool endswith(std::string_view str, std::string_view suffix);
+  void serve(HTTPRequest *request, HTTPResponse *response, bool sendBody);
+  CachedFile *openPrecompressed(const std::pmr::string &path, std::string_view acceptEncoding,
+                                const char **encoding);
+  bool isCompressible(std::string_view path);
+  std::shared_ptr<const std::string> compressedAsset(const std::pmr::string &path, int fd,
+                                                     const struct stat &st);
+  bool gzip(const std::string &data, std::string *out);
+  void sendCompressed(HTTPRequest *request, HTTPResponse *response,
+                      const std::string &compressed, const struct stat &st, bool sendBody);
+  // gzips a file too big to keep compressed as it's sent, with chunked
+  // encoding through a ChunkedWriter
+  void streamCompressed(HTTPRequest *request, HTTPResponse *response, CachedFile *file,
+                        bool sendBody);
+  void sendFile(HTTPRequest *request, HTTPResponse *response, CachedFile *file,
+                bool sendBody);
+  bool sendRange(HTTPResponse *response, CachedFile *file, off_t offset, size_t length);
+  bool notModified(HTTPRequest *request, std::string_view etag, time_t mtime);
+  bool readRange(int fd, off_t offset, size_t length, HTTPResponse *response);
+  bool readRanges(int fd, const struct stat &st,
+                  const std::pmr::vector<HttpUtils::ByteRange> &ranges,
+                  HTTPResponse *response);
+
+  // a gzipped copy of a file, valid while the file's inode, size and
+  // mtime match; data is empty when compressing didn't make it smaller
+  struct CompressedAsset {
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    std::shared_ptr<const std::string> data;
+  };
+
+  // only bother with files in this range
+  static const off_t MIN_COMPRESS_SIZE = 256;
+  static const off_t MAX_COMPRESS_SIZE = 4 * 1024 * 1024;
+  // bodies at least this big are sent with sendfile()
+  static const size_t SENDFILE_THRESHOLD = 16 * 1024;
+  // total size of the compressed copies we keep
+  static const size_t MAX_COMPRESSED_BYTES = 32 * 1024 * 1024;
 
   std::string m_basedir;
+  FileCache m_files;
+  bool m_compress;
+  pthread_mutex_t m_compressedLock;
+  std::unordered_map<std::string, CompressedAsset> m_compressed;
+  size_t m_compressedBytes;
 };
 
 #endif
@@ -3,25 +3,55 @@
 
 #include "http_parser.h"
 
+#include <stdint.h>
+
+#include <functional>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 
+/**
+ * A region of the raw request buffer, stored as an offset rather than
+ * a pointer so that it survives the buffer growing while we parse.
+ */
+struct HttpSpan {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct HttpHeader {
+  HttpSpan field;
+  HttpSpan value;
+  uint32_t hash;
+};
+
 class HTTP {
  public:
+    typedef std::function<void(const char *data, size_t len)> BodySink;
     typedef enum {INIT, HEADER, FIELD, VALUE, BODY, DONE} HttpState;
 
-    HTTP(http_parser_type httpType = HTTP_REQUEST);
+    /**
+     * All of the parser's buffers come from `memory`, which is
+     * normally the per-worker Arena.
+     */
+    HTTP(http_parser_type httpType = HTTP_REQUEST,
+         std::pmr::memory_resource *memory = std::pmr::get_default_resource());
     ~HTTP();
 
     int addData(const unsigned char *data, int len);
     bool isDone();
     bool isHeaderDone();
+    // whether the data added so far isn't a request we can parse
+    bool hasError() {return m_parseError;}
     std::string getProxyRequest(const char *userAgent = NULL);
     std::string getReplyHeader();
     std::string getHost();
     std::string getUrl();
     std::string getPath();
+    // the request's http_method (HTTP_GET, ...), once the header is done
+    int getMethod() {return m_method;}
     bool isConnect() {return m_method == HTTP_CONNECT;}
     bool isHead() {return m_method == HTTP_HEAD;}
     bool isGet() {return m_method == HTTP_GET;}
@@ -29,11 +59,42 @@ class HTTP {
     bool isPost() {return m_method == HTTP_POST;}
     bool isDelete() {return m_method == HTTP_DELETE;}
     std::string getBody();
-    std::string getQuery() {return m_query;}
-    std::vector< std::pair< std::string *, std::string *> > getHeaders() {
-      return m_headers;
-    }
-  
+    std::string_view getBodyView() {return m_body;}
+    std::string getQuery() {return std::string(view(m_query));}
+
+    /**
+     * Zero-copy accessors. The returned views point into the raw
+     * request buffer, which stops growing once the header has been
+     * parsed, so they stay valid for the lifetime of this object
+     * after isHeaderDone() returns true.
+     */
+    std::string_view getUrlView() {return view(m_url);}
+    std::string_view getPathView() {return view(m_path);}
+    std::string_view getQueryView() {return view(m_query);}
+
+    /**
+     * Case-insensitive header lookup that neither allocates nor
+     * throws. Returns false if the header is missing.
+     */
+    bool findHeader(std::string_view field, std::string_view *value);
+    size_t numHeaders() {return m_headers.size();}
+    std::string_view headerField(size_t idx) {return view(m_headers[idx].field);}
+    std::string_view headerValue(size_t idx) {return view(m_headers[idx].value);}
+
+    /**
+     * The declared body length once the header is done, or -1 when the
+     * body is chunked or has no Content-Length.
+     */
+    int64_t getContentLength() {return m_contentLength;}
+
+    /**
+     * Hand body bytes to `sink` as they are parsed instead of
+     * buffering them. Anything already buffered is passed on first.
+     * The sink must outlive the calls to addData, pass NULL to go back
+     * to buffering.
+     */
+    void setBodySink(const BodySink *sink);
+
  private:
     static int message_begin_cb(http_parser *parser);
     static int path_cb(http_parser *parser, const char *at, size_t length);
@@ -46,29 +107,46 @@ class HTTP {
     static int body_cb(http_parser *parser, const char *at, size_t length);
     static int message_complete_cb(http_parser *parser);
 
+    static uint32_t hashField(std::string_view field);
+
     HttpState getState();
     void setState(HttpState newState);
-    void appendUrl(const char *at, size_t len);
-    void newHeaderField(const char *at, size_t len);
-    void appendHeaderField(const char *at, size_t len);
-    void appendHeaderValue(const char *at, size_t len);
+    // false if the piece isn't in m_raw right after the rest of the span
+    bool appendSpan(HttpSpan *span, const char *at, size_t len);
+    std::string_view view(const HttpSpan &span) const {
+      return std::string_view(m_raw.data() + span.offset, span.length);
+    }
+    bool newHeaderField(const char *at, size_t len);
+    bool appendHeaderField(const char *at, size_t len);
+    bool appendHeaderValue(const char *at, size_t len);
     void addHeaderField();
     void messageComplete(unsigned char method);
 
+    // open-addressed index from field hash to (header index + 1),
+    // zero marks an empty slot
+    static const int HEADER_INDEX_SIZE = 64;
+
     http_parser_settings m_settings;
     http_parser m_parser;
     HttpState m_state;
     bool m_doneParsing;
+    bool m_parseError;
     bool m_headerDone;
 
-    std::string m_url;
-    std::string m_path;
-    std::string m_query;
-    std::string m_host;
-    std::string *m_field;
-    std::string *m_value;
-    std::vector< std::pair< std::string *, std::string *> > m_headers;
-    std::string m_body;
+    // raw bytes of the message up to and including the end of the header
+    std::pmr::string m_raw;
+
+    HttpSpan m_url;
+    HttpSpan m_path;
+    HttpSpan m_query;
+    HttpSpan m_host;
+    bool m_inField;
+    HttpHeader m_current;
+    std::pmr::vector<HttpHeader> m_headers;
+    unsigned char m_headerIndex[HEADER_INDEX_SIZE];
+    std::pmr::string m_body;
+    const BodySink *m_bodySink;
+    int64_t m_contentLength;
     std::string m_statusStr;
     unsigned char m_method;
     http_parser_type m_httpType;
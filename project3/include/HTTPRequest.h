@@ -8,26 +8,85 @@
 #include "WwwFormEncodedDict.h"
 #include "StringUtils.h"
 
+#include <functional>
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class HTTPRequest {
 public:
-  HTTPRequest(MySocket *sock, int serverPort);
+  /**
+   * Request-scoped buffers are allocated from `memory`, normally the
+   * worker's Arena, so they go away when the arena is reset.
+   */
+  HTTPRequest(MySocket *sock, int serverPort,
+              std::pmr::memory_resource *memory = std::pmr::get_default_resource());
   ~HTTPRequest();
+
+  // for services that want scratch memory with the lifetime of this request
+  std::pmr::memory_resource *memory() {return m_memory;}
   
+  /**
+   * Read the request line and headers. Any body bytes that arrive
+   * with them are buffered until the body is read. Like the other
+   * read methods, throws ClientError::badRequest() for a request that
+   * can't be parsed.
+   */
+  bool readHeader();
+
+  // read the rest of the request, buffering the whole body
   bool readRequest();
 
+  /**
+   * Read the rest of the request, handing the body to `consumer` as it
+   * arrives instead of buffering it. Works for both Content-Length and
+   * chunked bodies; for chunked bodies the consumer only sees the
+   * decoded data.
+   *
+   * @param consumer called with each piece of the body, in order
+   */
+  bool readBody(const HTTP::BodySink &consumer);
+
+  /**
+   * Run `hook` once the last of the request has been read, whoever
+   * reads it. The server uses this to stop the read deadline before a
+   * service that streams the body goes on to do its work.
+   */
+  void onRequestRead(std::function<void()> hook) {m_requestRead = hook;}
+  bool isBodyDone() {return m_http->isDone();}
+
+  // the declared body length, or -1 for chunked bodies
+  int64_t getContentLength() {return m_http->getContentLength();}
+
   std::string getHost();
   std::string getRequest();
   std::string getUrl();
   std::string getPath();
   std::vector<std::string> getPathComponents();
+
+  /**
+   * Views into the request's raw buffer, valid for the lifetime of
+   * this request. These don't allocate.
+   */
+  std::string_view getPathView();
+  std::string_view getQueryView();
+
+  /**
+   * Case-insensitive header lookup. findHeader returns false when the
+   * header is missing and getHeaderView returns an empty view; neither
+   * allocates or throws.
+   */
+  bool findHeader(std::string_view key, std::string_view *value);
+  std::string_view getHeaderView(std::string_view key);
+
+  // copies the header value out, throws if it is missing
   std::string getHeader(std::string key);
   bool hasAuthToken();
   std::string getAuthToken();
   bool isConnect();
+  int getMethod() {return m_http->getMethod();}
   bool isGet() {return m_http->isGet();}
   bool isHead() {return m_http->isHead();}
   bool isPut() {return m_http->isPut();}
@@ -36,17 +95,32 @@ public:
   std::map<std::string, std::string> getParams();
   WwwFormEncodedDict formEncodedBody();
   std::string getBody() {return m_http->getBody();}
+  std::string_view getBodyView() {return m_http->getBodyView();}
+
+  // the client connection this request arrived on
+  MySocket *getSocket() {return m_sock;}
   
   void printDebugInfo();
     
  protected:
     void onRead(const char *buffer, unsigned int len);
+    // reads the next piece of the request off the socket into m_readBuffer
+    void readMore();
+
+    // Reused for every read on this connection. It starts small since
+    // most requests are just a header, and grows toward the socket's
+    // read high-water mark when a large body is queued up.
+    static const int INITIAL_READ_BUFFER_SIZE = 4096;
 
     MySocket *m_sock;
+    std::pmr::memory_resource *m_memory;
     HTTP *m_http;
+    char *m_readBuffer;
+    int m_readBufferSize;
     int m_serverPort;
     unsigned long m_totalBytesRead;
     unsigned long m_totalBytesWritten;
+    std::function<void()> m_requestRead;
 };
 
 #endif
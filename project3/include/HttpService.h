@@ -8,11 +8,26 @@
 #include "Database.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
+#include "ChunkedWriter.h"
 
 class HttpService {
  public:
   HttpService(std::string pathPrefix);
-  std::string pathPrefix();
+  const std::string &pathPrefix();
+
+  /**
+   * Whether this service reads the request body itself.
+   *
+   * By default the server buffers the whole body before calling the
+   * handler. A service that returns true here gets called as soon as
+   * the header has been read and is responsible for reading the body
+   * with HTTPRequest::readBody(), which hands it over a piece at a
+   * time as it arrives.
+   *
+   * @param request the request, with only its header read so far
+   * @return true to stream the body
+   */
+  virtual bool streamsRequestBody(HTTPRequest *request);
   
   virtual void head(HTTPRequest *request, HTTPResponse *response);
   virtual void get(HTTPRequest *request, HTTPResponse *response);
@@ -37,7 +52,23 @@ class HttpService {
    * @throws ClientError for any cases where we can't lookup the user
    */
   User *getAuthenticatedUser(HTTPRequest *request);
-  
+
+ protected:
+  /**
+   * Start streaming the response body to the client.
+   *
+   * The status and headers already set on the response are sent right
+   * away with chunked transfer encoding, and the returned writer sends
+   * the body as it is produced, a bounded buffer at a time. Once this
+   * has been called the status can no longer change, so check for
+   * errors first.
+   *
+   * @param request the request being answered
+   * @param response the response whose headers should be sent
+   * @return a writer for the body, owned by the response
+   */
+  ChunkedWriter *streamResponse(HTTPRequest *request, HTTPResponse *response);
+
  private:
   std::string m_pathPrefix;
 };
@@ -0,0 +1,67 @@
+#ifndef _SERVICE_ROUTER_H_
+#define _SERVICE_ROUTER_H_
+
+#include <stdint.h>
+
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "HttpService.h"
+
+/**
+ * Maps request paths to services and request methods to handlers.
+ *
+ * Services are matched on their path prefix. When several prefixes
+ * match, the service that was registered first wins, the same as a
+ * linear scan of the services in registration order would pick. The
+ * prefixes are compiled once into a trie where every node already
+ * knows the winning service for the path that leads to it, so a lookup
+ * walks the path a character at a time and never allocates.
+ *
+ * The method table says which HttpService member handles each HTTP
+ * method; methods without an entry aren't implemented by the server.
+ */
+class ServiceRouter {
+ public:
+  typedef void (HttpService::*Handler)(HTTPRequest *request, HTTPResponse *response);
+
+  ServiceRouter();
+
+  // register a service; earlier services take precedence
+  void addService(HttpService *service);
+
+  // route requests with `method` (HTTP_GET, ...) to `handler`
+  void addMethod(int method, Handler handler);
+
+  /**
+   * Build the trie. Call this once all services have been added and
+   * before the first lookup.
+   */
+  void compile();
+
+  // the service for `path`, or NULL if no prefix matches
+  HttpService *findService(std::string_view path);
+
+  // the handler for `method`, or NULL if the server doesn't support it
+  Handler findHandler(int method);
+
+ private:
+  struct Node {
+    // index into m_services of the winning service for this prefix,
+    // or -1 when none of the prefixes match yet
+    int service;
+    // child nodes sorted by the next character
+    std::vector<std::pair<unsigned char, uint32_t> > children;
+  };
+
+  static const int MAX_METHODS = 64;
+
+  int child(uint32_t node, unsigned char c);
+
+  std::vector<HttpService *> m_services;
+  std::vector<Node> m_nodes;
+  Handler m_handlers[MAX_METHODS];
+};
+
+#endif
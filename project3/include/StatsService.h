@@ -0,0 +1,20 @@
+#ifndef _STATSSERVICE_H_
+#define _STATSSERVICE_H_
+
+#include "HttpService.h"
+#include "ServerStats.h"
+
+/**
+ * Reports the server's connection counters as JSON on GET /stats.
+ */
+class StatsService : public HttpService {
+ public:
+  StatsService(ServerStats *stats);
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  ServerStats *m_stats;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <deque>
+#include <vector>
+
+#include "Arena.h"
+#include "CoDel.h"
+#include "MySocket.h"
+#include "ServerStats.h"
+
+/**
+ * The bounded connection queue and the worker threads that serve it.
+ *
+ * The pool keeps at least `minThreads` workers. When the connection at
+ * the front of the queue has waited longer than the spawn threshold
+ * and no worker is free, a monitor thread starts another one, up to
+ * `maxThreads`. The monitor only wakes up while connections are
+ * waiting with every worker busy.
+ * Workers that sit idle for the idle timeout exit again, down to the
+ * minimum. Threads are joinable, and drain() lets every queued and
+ * running request finish before joining them all.
+ *
+ * When the queue is full the overload policy decides what gives:
+ * BLOCK makes submit() wait for a slot, REJECT sheds the new
+ * connection, DROP_OLDEST sheds the one that has waited longest, and
+ * CODEL sheds connections whose queue wait stays above target (and
+ * rejects new ones if the queue is still full).
+ */
+class WorkerPool {
+ public:
+  enum OverloadPolicy { BLOCK, REJECT, DROP_OLDEST, CODEL };
+
+  // serves one connection and then closes and deletes it
+  typedef void (*Handler)(MySocket *client, Arena *arena);
+  // turns a connection away without blocking, and deletes it
+  typedef void (*Shedder)(MySocket *client);
+
+  WorkerPool(Handler handler, Shedder shed, ServerStats *stats);
+  ~WorkerPool();
+
+  // the settings can only be changed before start(); a maxThreads of
+  // 0 keeps the default of four per core
+  void setThreads(int minThreads, int maxThreads);
+  void setQueueSize(size_t size);
+  void setOverloadPolicy(OverloadPolicy policy);
+  // how long a connection may wait before another worker is started
+  void setSpawnWait(long micros);
+  // how long a worker above the minimum waits for work before exiting
+  void setIdleTimeout(long millis);
+
+  // start the minimum number of workers and the monitor
+  void start();
+
+  // queue a connection for the workers, or shed one if overloaded
+  void submit(MySocket *client);
+
+  /**
+   * Stop taking connections, serve everything already queued, and
+   * wait for every worker to exit. submit() must not be called again.
+   */
+  void drain();
+
+ private:
+  struct QueuedConnection {
+    MySocket *client;
+    // when it was queued, in microseconds on the monotonic clock
+    long enqueuedAt;
+  };
+
+  static long now();
+  static void *run(void *arg);
+  void work();
+  // grows a stalled queue's pool even when no new connections arrive
+  static void *runMonitor(void *arg);
+  void monitor();
+
+  // the rest are called with m_lock held
+  void grow(long now);
+  void spawn();
+  void reap();
+
+  Handler m_handler;
+  Shedder m_shed;
+  ServerStats *m_stats;
+
+  int m_minThreads;
+  int m_maxThreads;
+  size_t m_queueSize;
+  OverloadPolicy m_policy;
+  long m_spawnWait;
+  long m_idleTimeout;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_notEmpty;
+  pthread_cond_t m_notFull;
+  // signalled when a connection is left waiting with no worker free,
+  // and when draining; it uses the monotonic clock, like now()
+  pthread_cond_t m_stalled;
+  std::deque<QueuedConnection> m_queue;
+  CoDel m_codel;
+
+  // workers that are running, and workers that retired and still need
+  // to be joined
+  std::vector<pthread_t> m_threads;
+  std::vector<pthread_t> m_retired;
+  int m_idle;
+  bool m_draining;
+
+  pthread_t m_monitor;
+  bool m_monitorRunning;
+};
+
+#endif
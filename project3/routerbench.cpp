@@ -0,0 +1,88 @@
+// Compares the service router against the linear prefix scan it
+// replaced, with 100 registered prefixes plus a catch-all "/".
+//
+//   make routerbench && ./routerbench [lookups]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "HttpService.h"
+#include "ServiceRouter.h"
+
+using namespace std;
+
+#define NUM_PREFIXES (100)
+
+static vector<HttpService *> services;
+
+// what find_service used to do
+static HttpService *linearFind(string_view path) {
+  for (unsigned int idx = 0; idx < services.size(); idx++) {
+    const string &prefix = services[idx]->pathPrefix();
+    if (path.substr(0, prefix.size()) == prefix) {
+      return services[idx];
+    }
+  }
+  return NULL;
+}
+
+template<typename Lookup>
+static double timeLookups(const vector<string> &paths, long lookups, Lookup lookup, size_t *checksum) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (long idx = 0; idx < lookups; idx++) {
+    HttpService *service = lookup(paths[idx % paths.size()]);
+    *checksum += (size_t) service;
+  }
+  chrono::steady_clock::time_point end = chrono::steady_clock::now();
+  return chrono::duration<double, nano>(end - start).count() / lookups;
+}
+
+int main(int argc, char *argv[]) {
+  long lookups = argc > 1 ? atol(argv[1]) : 2000000;
+
+  ServiceRouter router;
+  char prefix[64];
+  for (int idx = 0; idx < NUM_PREFIXES; idx++) {
+    snprintf(prefix, sizeof(prefix), "/api/v%d/service%d/", idx % 3, idx);
+    services.push_back(new HttpService(prefix));
+    router.addService(services.back());
+  }
+  services.push_back(new HttpService("/"));
+  router.addService(services.back());
+  router.compile();
+
+  // a request for every service, some deeper paths and the static
+  // files that fall through to "/"
+  vector<string> paths;
+  for (int idx = 0; idx < NUM_PREFIXES; idx++) {
+    snprintf(prefix, sizeof(prefix), "/api/v%d/service%d/items/%d", idx % 3, idx, idx * 7);
+    paths.push_back(prefix);
+  }
+  paths.push_back("/index.html");
+  paths.push_back("/bootstrap/bootstrap.min.css");
+  paths.push_back("/api/v1/unknown");
+
+  for (size_t idx = 0; idx < paths.size(); idx++) {
+    if (linearFind(paths[idx]) != router.findService(paths[idx])) {
+      fprintf(stderr, "router disagrees with the linear scan on %s\n", paths[idx].c_str());
+      return 1;
+    }
+  }
+
+  size_t checksum = 0;
+  double linear = timeLookups(paths, lookups, linearFind, &checksum);
+  double trie = timeLookups(paths, lookups, [&](string_view path) {
+    return router.findService(path);
+  }, &checksum);
+
+  printf("%d prefixes, %ld lookups\n", NUM_PREFIXES + 1, lookups);
+  printf("  linear scan: %8.1f ns/lookup\n", linear);
+  printf("  router:      %8.1f ns/lookup\n", trie);
+  printf("  (checksum %zx)\n", checksum);
+  return 0;
+}
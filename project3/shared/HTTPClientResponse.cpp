@@ -2,6 +2,7 @@
 
 #include "HTTPClientResponse.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -28,18 +29,24 @@ Document *HTTPClientResponse::jsonBody() {
 
 
 string HTTPClientResponse::readResponse() {
+  // read straight into the end of full_response until the server
+  // closes the connection, sizing each read by what's already queued
   string full_response;
+  size_t used = 0;
 
   while (true) {
-    string response;
+    size_t wanted = max(m_sock->pendingBytes(), 4096);
+    if (full_response.size() < used + wanted) {
+      full_response.resize(max(used + wanted, full_response.size() * 2));
+    }
+
     try {
-      response = m_sock->read();
+      used += m_sock->read(&full_response[used], full_response.size() - used);
     } catch (...) {
       break;
     }
-
-    full_response += response;
   }
+  full_response.resize(used);
 
   size_t delimiter = full_response.find("\r\n\r\n");
   if (delimiter == string::npos) {
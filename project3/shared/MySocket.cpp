@@ -1,17 +1,29 @@
 #include "MySocket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string>
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
-MySocket::MySocket(const char *inetAddr, int port) {
+#ifndef MSG_NOSIGNAL
+// macOS; SIGPIPE is ignored by the servers anyway
+#define MSG_NOSIGNAL 0
+#endif
+
+MySocket::MySocket(const char *inetAddr, int port) : m_bytesRead(0), m_bytesWritten(0) {
   call_connect(inetAddr, port);
 }
 
@@ -28,6 +40,7 @@ void MySocket::call_connect(const char *inetAddr, int port) {
     hints.ai_socktype = SOCK_STREAM;
     int ret = getaddrinfo(inetAddr, NULL, &hints, &res);
     if(ret != 0) {
+        ::close(sockFd);
         string str;
         str = string("Could not get host ") + string(inetAddr);
         throw SocketError(str.c_str());
@@ -41,15 +54,17 @@ void MySocket::call_connect(const char *inetAddr, int port) {
     // conenct to the server
     if( connect(sockFd, (struct sockaddr *) &server,
                 sizeof(server)) == -1 ) {
+        // the destructor won't run, so don't leave the descriptor open
+        ::close(sockFd);
         throw SocketError("Did not connect to the server");
     }
 }
 
-MySocket::MySocket(void) {
+MySocket::MySocket(void) : m_bytesRead(0), m_bytesWritten(0) {
     sockFd = -1;
 }
 
-MySocket::MySocket(int socketFileDesc) {
+MySocket::MySocket(int socketFileDesc) : m_bytesRead(0), m_bytesWritten(0) {
     sockFd = socketFileDesc;
 }
 
@@ -72,27 +87,145 @@ void MySocket::write_bytes(const void *buffer, int len) {
 
     while(len > 0) {
         bytesWritten = ::write(sockFd, buf, len);
+        if(bytesWritten < 0 && errno == EINTR) {
+          continue;
+        }
         if(bytesWritten <= 0) {
 	  throw SocketWriteError();
         }
+        m_bytesWritten += bytesWritten;
         buf += bytesWritten;
         len -= bytesWritten;
     }
 }
 
+void MySocket::writev(const struct iovec *iov, int count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    // The kernel takes at most IOV_MAX buffers a call, so they go a
+    // window at a time, copied so a short write can be resumed without
+    // touching the caller's array.
+    struct iovec pending[IOV_MAX];
+    while (count > 0) {
+        int window = min(count, IOV_MAX);
+        copy(iov, iov + window, pending);
+        iov += window;
+        count -= window;
+
+        struct iovec *next = pending;
+        while (window > 0) {
+            ssize_t bytesWritten = ::writev(sockFd, next, window);
+            if (bytesWritten < 0 && errno == EINTR) {
+              continue;
+            }
+            if (bytesWritten <= 0) {
+              throw SocketWriteError();
+            }
+            m_bytesWritten += bytesWritten;
+
+            // skip past whatever the kernel took, which may end mid-buffer
+            while (window > 0 && (size_t) bytesWritten >= next->iov_len) {
+                bytesWritten -= next->iov_len;
+                next++;
+                window--;
+            }
+            if (window > 0) {
+                next->iov_base = (char *) next->iov_base + bytesWritten;
+                next->iov_len -= bytesWritten;
+            }
+        }
+    }
+}
+
+void MySocket::sendfile(int fd, off_t offset, size_t count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+#ifdef __linux__
+    while (count > 0) {
+        ssize_t bytesWritten = ::sendfile(sockFd, fd, &offset, count);
+        if (bytesWritten < 0 && errno == EINTR) {
+          continue;
+        }
+        if (bytesWritten <= 0) {
+          // includes the file being truncated underneath us
+          throw SocketWriteError();
+        }
+        m_bytesWritten += bytesWritten;
+        count -= bytesWritten;
+    }
+#else
+    char buffer[64 * 1024];
+    while (count > 0) {
+        ssize_t bytesRead = ::pread(fd, buffer, min(count, sizeof(buffer)), offset);
+        if (bytesRead <= 0) {
+          throw SocketWriteError();
+        }
+        write_bytes(buffer, bytesRead);
+        offset += bytesRead;
+        count -= bytesRead;
+    }
+#endif
+}
+
+int MySocket::s_readHighWaterMark = 256 * 1024;
+
 string MySocket::read() {
     char buffer[4096];
+    int ret = read(buffer, sizeof(buffer));
+    return string(buffer, ret);
+}
+
+int MySocket::read(void *buffer, int len) {
     if(sockFd<0) {
       throw SocketNotConnected();
     }
-    
-    int ret = ::read(sockFd, buffer, sizeof(buffer));
-    
+
+    int ret = ::read(sockFd, buffer, len);
+
     if(ret <= 0) {
       throw SocketReadError();
     }
-  
-    return string(buffer, ret);
+
+    m_bytesRead += ret;
+    return ret;
+}
+
+int MySocket::pendingBytes() {
+    int pending = 0;
+    if(sockFd<0 || ioctl(sockFd, FIONREAD, &pending) != 0) {
+      return 0;
+    }
+    return min(pending, s_readHighWaterMark);
+}
+
+int MySocket::readHighWaterMark() {
+    return s_readHighWaterMark;
+}
+
+void MySocket::setReadHighWaterMark(int bytes) {
+    s_readHighWaterMark = bytes;
+}
+
+void MySocket::shutdown(const char *notice, size_t len) {
+    if(sockFd<0) return;
+
+    if (len > 0) {
+      // whatever fits in the send buffer; this must never block
+      ::send(sockFd, notice, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    ::shutdown(sockFd, SHUT_RDWR);
+}
+
+unsigned long MySocket::bytesRead() {
+    return m_bytesRead;
+}
+
+unsigned long MySocket::bytesWritten() {
+    return m_bytesWritten;
 }
 
 void MySocket::close(void) {
@@ -1,4 +1,6 @@
 #include "MySslSocket.h"
+#include <unistd.h>
+#include <algorithm>
 
 #include <iostream>
 #include <sstream>
@@ -69,32 +71,58 @@ void MySslSocket::write(string buffer) {
     if(bytesWritten <= 0) {
       throw SocketWriteError();
     }
+    m_bytesWritten += bytesWritten;
     buf += bytesWritten;
     len -= bytesWritten;
   }
 }
 
+void MySslSocket::writev(const struct iovec *iov, int count) {
+  // there's no gather write for TLS records, send the pieces in order
+  for (int idx = 0; idx < count; idx++) {
+    write(string((const char *) iov[idx].iov_base, iov[idx].iov_len));
+  }
+}
+
+void MySslSocket::sendfile(int fd, off_t offset, size_t count) {
+  // the kernel can't encrypt for us, so copy through a buffer
+  char buffer[16 * 1024];
+  while (count > 0) {
+    ssize_t bytesRead = ::pread(fd, buffer, min(count, sizeof(buffer)), offset);
+    if (bytesRead <= 0) {
+      throw SocketWriteError();
+    }
+    write(string(buffer, bytesRead));
+    offset += bytesRead;
+    count -= bytesRead;
+  }
+}
+
 string MySslSocket::read() {
   char buffer[4096];
+  int ret = read(buffer, sizeof(buffer));
+  return string(buffer, ret);
+}
+
+int MySslSocket::read(void *buffer, int len) {
   if(sockFd<0 || ssl == NULL) {
     throw SocketNotConnected();
   }
     
-  int ret = SSL_read(ssl, buffer, sizeof(buffer));
+  int ret = SSL_read(ssl, buffer, len);
   
   if(ret <= 0) {
     throw SocketReadError();
   }
+  m_bytesRead += ret;
 
-  string result = string(buffer, ret);
-  
   if (debug_print_io) {
     cout << "MySslSocket::read" << endl;
     cout << "-----------------" << endl;
-    cout << result << endl << endl;
+    cout << string((const char *) buffer, ret) << endl << endl;
   }
   
-  return result;
+  return ret;
 }
 
 void MySslSocket::close() {
@@ -20,7 +20,10 @@ class MySslSocket: public MySocket {
   MySslSocket(const char *inetAddr, int port, bool debug_print_io=false);
 
   std::string read();
+  int read(void *buffer, int len);
   void write(std::string data);
+  void writev(const struct iovec *iov, int count);
+  void sendfile(int fd, off_t offset, size_t count);
   void close(void);
   
  protected:
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "Arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t blockSize) {
+  m_blockSize = blockSize;
+  m_first = (char *) malloc(blockSize);
+  if (m_first == NULL) {
+    throw bad_alloc();
+  }
+  m_current = m_first;
+  m_end = m_first + blockSize;
+  m_overflow = NULL;
+  m_used = 0;
+}
+
+Arena::~Arena() {
+  reset();
+  free(m_first);
+}
+
+void Arena::reset() {
+  while (m_overflow != NULL) {
+    Block *next = m_overflow->next;
+    free(m_overflow);
+    m_overflow = next;
+  }
+  m_current = m_first;
+  m_end = m_first + m_blockSize;
+  m_used = 0;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+  uintptr_t aligned = ((uintptr_t) m_current + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  if (aligned + bytes > (uintptr_t) m_end) {
+    return allocateOverflow(bytes, alignment);
+  }
+  m_current = (char *) (aligned + bytes);
+  m_used += bytes;
+  return (void *) aligned;
+}
+
+void *Arena::allocateOverflow(size_t bytes, size_t alignment) {
+  // Small requests get a fresh block to bump through; big ones (say a
+  // large response body) get a block of their own.
+  size_t size = sizeof(Block) + alignment + bytes;
+  if (size < m_blockSize) {
+    size = m_blockSize;
+  }
+  Block *block = (Block *) malloc(size);
+  if (block == NULL) {
+    throw bad_alloc();
+  }
+  block->next = m_overflow;
+  block->size = size;
+  m_overflow = block;
+
+  m_current = (char *) (block + 1);
+  m_end = (char *) block + size;
+  return do_allocate(bytes, alignment);
+}
+
+void Arena::do_deallocate(void * /*p*/, size_t /*bytes*/, size_t /*alignment*/) {
+  // memory is reclaimed all at once by reset()
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
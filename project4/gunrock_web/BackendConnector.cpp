@@ -0,0 +1,13 @@
+#include "BackendConnector.h"
+
+using namespace std;
+
+BackendConnector::BackendConnector(string host, int port) {
+  m_host = host;
+  m_port = port;
+  m_name = host + ":" + to_string(port);
+}
+
+MySocket *BackendConnector::connect() {
+  return new MySocket(m_host.c_str(), m_port);
+}
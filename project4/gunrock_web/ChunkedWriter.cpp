@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "ChunkedWriter.h"
+#include "HttpUtils.h"
+
+using namespace std;
+
+ChunkedWriter::ChunkedWriter(MySocket *client, size_t bufferSize, pmr::memory_resource *memory) {
+  m_client = client;
+  m_memory = memory;
+  m_bufferSize = bufferSize;
+  m_buffer = (char *) memory->allocate(bufferSize, 1);
+  m_buffered = 0;
+  m_bytesWritten = 0;
+  m_finished = false;
+}
+
+ChunkedWriter::~ChunkedWriter() {
+  m_memory->deallocate(m_buffer, m_bufferSize, 1);
+}
+
+void ChunkedWriter::write(const void *data, size_t len) {
+  const char *bytes = (const char *) data;
+
+  while (len > 0) {
+    // large writes with nothing buffered go out directly, no copy
+    if (m_buffered == 0 && len >= m_bufferSize) {
+      HttpUtils::writeChunk(m_client, bytes, len);
+      m_bytesWritten += len;
+      return;
+    }
+
+    size_t toCopy = min(len, m_bufferSize - m_buffered);
+    memcpy(m_buffer + m_buffered, bytes, toCopy);
+    m_buffered += toCopy;
+    bytes += toCopy;
+    len -= toCopy;
+
+    if (m_buffered == m_bufferSize) {
+      flush();
+    }
+  }
+}
+
+void ChunkedWriter::writeFrom(function<size_t(char *buffer, size_t size)> producer) {
+  while (true) {
+    size_t produced = producer(m_buffer + m_buffered, m_bufferSize - m_buffered);
+    if (produced == 0) {
+      break;
+    }
+    m_buffered += produced;
+    if (m_buffered == m_bufferSize) {
+      flush();
+    }
+  }
+}
+
+void ChunkedWriter::flush() {
+  if (m_buffered == 0) {
+    return;
+  }
+  HttpUtils::writeChunk(m_client, m_buffer, m_buffered);
+  m_bytesWritten += m_buffered;
+  m_buffered = 0;
+}
+
+void ChunkedWriter::finish() {
+  if (m_finished) {
+    return;
+  }
+  flush();
+  HttpUtils::writeLastChunk(m_client);
+  m_finished = true;
+}
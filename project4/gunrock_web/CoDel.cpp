@@ -0,0 +1,58 @@
+#include <math.h>
+
+#include "CoDel.h"
+
+CoDel::CoDel(long targetMicros, long intervalMicros) {
+  m_target = targetMicros;
+  m_interval = intervalMicros;
+  m_firstAboveTime = 0;
+  m_dropping = false;
+  m_dropNext = 0;
+  m_count = 0;
+  m_lastCount = 0;
+}
+
+long CoDel::controlLaw(long t) {
+  return t + (long) (m_interval / sqrt((double) m_count));
+}
+
+bool CoDel::shouldDrop(long sojournMicros, long nowMicros) {
+  bool okToDrop = false;
+  if (sojournMicros < m_target) {
+    m_firstAboveTime = 0;
+  } else if (m_firstAboveTime == 0) {
+    m_firstAboveTime = nowMicros + m_interval;
+  } else if (nowMicros >= m_firstAboveTime) {
+    okToDrop = true;
+  }
+
+  if (m_dropping) {
+    if (!okToDrop) {
+      // the queue has drained
+      m_dropping = false;
+      return false;
+    }
+    if (nowMicros >= m_dropNext) {
+      m_count++;
+      m_dropNext = controlLaw(m_dropNext);
+      return true;
+    }
+    return false;
+  }
+
+  if (okToDrop) {
+    m_dropping = true;
+    // if we were dropping not long ago, pick up close to the rate that
+    // worked then rather than starting over
+    unsigned int delta = m_count - m_lastCount;
+    if (delta > 1 && nowMicros - m_dropNext < 16 * m_interval) {
+      m_count = delta;
+    } else {
+      m_count = 1;
+    }
+    m_lastCount = m_count;
+    m_dropNext = controlLaw(nowMicros);
+    return true;
+  }
+  return false;
+}
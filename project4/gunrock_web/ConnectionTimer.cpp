@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "ConnectionTimer.h"
+
+using namespace std;
+
+long ConnectionTimer::idleTimeout = 5000;
+long ConnectionTimer::headerTimeout = 10000;
+long ConnectionTimer::bodyTimeout = 10000;
+long ConnectionTimer::writeTimeout = 30000;
+
+static const char REQUEST_TIMEOUT[] =
+  "HTTP/1.1 408 Request Timeout\r\n"
+  "Connection: close\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n";
+
+ConnectionTimer::ConnectionTimer(TimerWheel *wheel, MySocket *client)
+  : m_phase(DONE), m_progress(0), m_timedOut(false) {
+  m_wheel = wheel;
+  m_client = client;
+}
+
+void ConnectionTimer::readingHeader() {
+  m_progress = m_client->bytesRead();
+  m_phase = IDLE;
+  m_wheel->schedule(this, idleTimeout);
+}
+
+void ConnectionTimer::readingBody() {
+  m_progress = m_client->bytesRead();
+  m_phase = BODY;
+  m_wheel->schedule(this, bodyTimeout);
+}
+
+void ConnectionTimer::writing() {
+  m_progress = m_client->bytesWritten();
+  m_phase = WRITE;
+  m_wheel->schedule(this, writeTimeout);
+}
+
+void ConnectionTimer::done() {
+  m_phase = DONE;
+  m_wheel->cancel(this);
+}
+
+bool ConnectionTimer::timedOut() {
+  return m_timedOut;
+}
+
+long ConnectionTimer::expired() {
+  int phase = m_phase;
+  switch (phase) {
+  case IDLE: {
+    if (m_client->bytesRead() == m_progress) {
+      abort(true);
+      return 0;
+    }
+    // the client has started, give it the rest of the header deadline
+    // unless the worker has moved on in the meantime
+    int expected = IDLE;
+    if (!m_phase.compare_exchange_strong(expected, HEADER)) {
+      return 0;
+    }
+    return headerTimeout > idleTimeout ? headerTimeout - idleTimeout : 1;
+  }
+  case HEADER:
+    abort(true);
+    return 0;
+  case BODY: {
+    unsigned long bytes = m_client->bytesRead();
+    if (bytes == m_progress) {
+      abort(true);
+      return 0;
+    }
+    m_progress = bytes;
+    return bodyTimeout;
+  }
+  case WRITE: {
+    unsigned long bytes = m_client->bytesWritten();
+    if (bytes == m_progress) {
+      // too late for a 408, part of the response may already be out
+      abort(false);
+      return 0;
+    }
+    m_progress = bytes;
+    return writeTimeout;
+  }
+  default:
+    return 0;
+  }
+}
+
+void ConnectionTimer::abort(bool notify) {
+  m_timedOut = true;
+  if (notify) {
+    m_client->shutdown(REQUEST_TIMEOUT, strlen(REQUEST_TIMEOUT));
+  } else {
+    m_client->shutdown();
+  }
+}
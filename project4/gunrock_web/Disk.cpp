@@ -17,7 +17,10 @@ using namespace std;
 Disk::Disk(string imageFile, int blockSize) {
   this->imageFile = imageFile;
   this->blockSize = blockSize;
-  this->isInTransaction = false;
+  pthread_mutex_init(&this->transactionsLock, NULL);
+  for (int idx = 0; idx < BLOCK_LATCHES; idx++) {
+    pthread_mutex_init(&this->blockLatches[idx], NULL);
+  }
   
   struct stat stat;
   int imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
@@ -30,7 +33,8 @@ Disk::Disk(string imageFile, int blockSize) {
     cerr << "Could not stat image file" << endl;
     exit(1);
   }
-  close(imageFileDescriptor);
+  this->readFd = imageFileDescriptor;
+  this->writeFd = -1;
   
   this->imageFileSize = stat.st_size;
 
@@ -44,6 +48,17 @@ Disk::Disk(string imageFile, int blockSize) {
   
 }
 
+Disk::~Disk() {
+  close(this->readFd);
+  if (this->writeFd >= 0) {
+    close(this->writeFd);
+  }
+  pthread_mutex_destroy(&this->transactionsLock);
+  for (int idx = 0; idx < BLOCK_LATCHES; idx++) {
+    pthread_mutex_destroy(&this->blockLatches[idx]);
+  }
+}
+
 int Disk::numberOfBlocks() {
   return this->imageFileSize / this->blockSize;
 }
@@ -54,27 +69,12 @@ void Disk::readBlock(int blockNumber, void *buffer) {
     exit(1);
   }
 
-  int fd = open(this->imageFile.c_str(), O_RDONLY);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
-    exit(1);
-  }
-
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("read::lseek");
-    cerr << "Could not seek to file" << endl;
-    exit(1);
-  }
-
-  ret = read(fd, buffer, this->blockSize);
+  off_t offset = (off_t) blockNumber * this->blockSize;
+  int ret = pread(this->readFd, buffer, this->blockSize, offset);
   if (ret != this->blockSize) {
     cerr << "Could not read file" << endl;
     exit(1);
   }
-
-  close(fd);
 }
 
 void Disk::writeBlock(int blockNumber, void *buffer) {  
@@ -83,60 +83,153 @@ void Disk::writeBlock(int blockNumber, void *buffer) {
     exit(1);
   }
 
-  if (isInTransaction) {
-    struct UndoRecord undoRecord;
+  Transaction *transaction = currentTransaction();
+  struct UndoRecord undoRecord;
+  if (transaction != NULL || commitListener) {
     undoRecord.blockNumber = blockNumber;
     undoRecord.blockData = new unsigned char[blockSize];
     this->readBlock(blockNumber, undoRecord.blockData);
-    undoLog.push_front(undoRecord);
+    for (int idx = 0; idx < blockSize; idx++) {
+      undoRecord.blockData[idx] ^= ((unsigned char *) buffer)[idx];
+    }
   }
-  
-  int fd = open(this->imageFile.c_str(), O_RDWR);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
-    exit(1);
+  if (transaction != NULL) {
+    transaction->undoLog.push_front(undoRecord);
   }
 
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("write::lseek");
-    cerr << "Could not seek to file" << endl;
-    exit(1);
+  // a transaction's writes are synced once, when it commits
+  writeRaw(blockNumber, buffer);
+  if (transaction == NULL) {
+    sync();
+    if (commitListener) {
+      commitListener(deque<struct UndoRecord>(1, undoRecord));
+      delete [] undoRecord.blockData;
+    }
+  }
+}
+
+void Disk::setCommitListener(function<void(const deque<struct UndoRecord> &changes)> listener) {
+  this->commitListener = listener;
+}
+
+int Disk::writeDescriptor() {
+  // opened on the first write, so read-only images still work for
+  // everything else
+  pthread_mutex_lock(&this->transactionsLock);
+  if (this->writeFd < 0) {
+    this->writeFd = open(this->imageFile.c_str(), O_RDWR | O_CLOEXEC);
+    if (this->writeFd < 0) {
+      cerr << "Could not open image file " << this->imageFile << endl;
+      exit(1);
+    }
   }
+  int fd = this->writeFd;
+  pthread_mutex_unlock(&this->transactionsLock);
+  return fd;
+}
 
-  ret = write(fd, buffer, this->blockSize);
+void Disk::writeRaw(int blockNumber, void *buffer) {
+  off_t offset = (off_t) blockNumber * this->blockSize;
+  int ret = pwrite(writeDescriptor(), buffer, this->blockSize, offset);
   if (ret != this->blockSize) {
     cerr << "Could not write file" << endl;
     exit(1);
   }
-  fsync(fd);
-  close(fd);
+}
+
+void Disk::sync() {
+  fsync(writeDescriptor());
+}
+
+Disk::Transaction *Disk::currentTransaction() {
+  pthread_mutex_lock(&transactionsLock);
+  map<pthread_t, Transaction>::iterator iter = transactions.find(pthread_self());
+  // map nodes don't move, and only this thread touches its own entry
+  Transaction *transaction = iter == transactions.end() ? NULL : &iter->second;
+  pthread_mutex_unlock(&transactionsLock);
+  return transaction;
+}
+
+bool Disk::inTransaction() {
+  return currentTransaction() != NULL;
 }
 
 void Disk::beginTransaction() {
-  if (isInTransaction) {
+  pthread_mutex_lock(&transactionsLock);
+  bool exists = transactions.count(pthread_self()) > 0;
+  if (!exists) {
+    transactions[pthread_self()];
+  }
+  pthread_mutex_unlock(&transactionsLock);
+  if (exists) {
     cerr << "You can't start a new transaction: one already exists" << endl;
     exit(1);
   }
-  isInTransaction = true;
 }
 
-void Disk::commit() {
-  isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    delete [] iter->blockData;
+void Disk::atEnd(function<void(bool committed)> action) {
+  Transaction *transaction = currentTransaction();
+  if (transaction == NULL) {
+    cerr << "There is no transaction to wait for" << endl;
+    exit(1);
   }
-  undoLog.clear();
+  transaction->endActions.push_back(action);
+}
+
+void Disk::commit() {
+  endTransaction(true);
 }
 
 void Disk::rollback() {
-  isInTransaction = false;
+  endTransaction(false);
+}
+
+void Disk::endTransaction(bool committed) {
+  // take it out first so the writes below aren't logged themselves
+  pthread_mutex_lock(&transactionsLock);
+  map<pthread_t, Transaction>::iterator found = transactions.find(pthread_self());
+  if (found == transactions.end()) {
+    pthread_mutex_unlock(&transactionsLock);
+    return;
+  }
+  Transaction transaction = std::move(found->second);
+  transactions.erase(found);
+  pthread_mutex_unlock(&transactionsLock);
+
+  // newest first, flipping back only the bits this transaction changed
+  unsigned char *block = new unsigned char[blockSize];
   deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    this->writeBlock(iter->blockNumber, iter->blockData);
+  for (iter = transaction.undoLog.begin(); iter != transaction.undoLog.end(); iter++) {
+    if (!committed) {
+      lockBlock(iter->blockNumber);
+      this->readBlock(iter->blockNumber, block);
+      for (int idx = 0; idx < blockSize; idx++) {
+        block[idx] ^= iter->blockData[idx];
+      }
+      writeRaw(iter->blockNumber, block);
+      unlockBlock(iter->blockNumber);
+    }
+  }
+  delete [] block;
+  if (!transaction.undoLog.empty()) {
+    sync();
+    if (committed && commitListener) {
+      commitListener(transaction.undoLog);
+    }
+  }
+  for (iter = transaction.undoLog.begin(); iter != transaction.undoLog.end(); iter++) {
     delete [] iter->blockData;
   }
-  undoLog.clear();
+
+  for (size_t idx = transaction.endActions.size(); idx > 0; idx--) {
+    transaction.endActions[idx - 1](committed);
+  }
+}
+
+void Disk::lockBlock(int blockNumber) {
+  pthread_mutex_lock(&blockLatches[blockNumber % BLOCK_LATCHES]);
+}
+
+void Disk::unlockBlock(int blockNumber) {
+  pthread_mutex_unlock(&blockLatches[blockNumber % BLOCK_LATCHES]);
 }
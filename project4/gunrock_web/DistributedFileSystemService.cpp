@@ -7,26 +7,688 @@
 #include <map>
 #include <string>
 #include <algorithm>
+#include <cstring>
 
 #include "DistributedFileSystemService.h"
 #include "ClientError.h"
 #include "ufs.h"
 #include "WwwFormEncodedDict.h"
+#include "StringUtils.h"
+#include "HttpUtils.h"
 
 using namespace std;
 
 DistributedFileSystemService::DistributedFileSystemService(string diskFile) : HttpService("/ds3/") {
+  this->diskFile = diskFile;
   this->fileSystem = new LocalFileSystem(new Disk(diskFile, UFS_BLOCK_SIZE));
+  this->transactions = new TransactionManager(this->fileSystem->disk);
+  this->etags = new ETagStore(diskFile + ".etag", diskFile);
+  pthread_mutex_init(&this->listingsLock, NULL);
+  this->replicator = NULL;
+  this->replica = false;
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __linux__
+  // so a steady stream of GETs can't hold replication off for good
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&this->replicaLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  this->ingest = NULL;
 }  
 
+// holds a replica's read lock for as long as it's in scope
+class ReplicaReadLock {
+ public:
+  ReplicaReadLock(pthread_rwlock_t *lock, bool replica) {
+    this->lock = replica ? lock : NULL;
+    if (this->lock != NULL) {
+      pthread_rwlock_rdlock(this->lock);
+    }
+  }
+  ~ReplicaReadLock() {
+    if (lock != NULL) {
+      pthread_rwlock_unlock(lock);
+    }
+  }
+
+ private:
+  pthread_rwlock_t *lock;
+};
+
+Replicator *DistributedFileSystemService::replicateTo(const vector<string> &replicas, bool synchronous, string key) {
+  this->replicator = new Replicator(fileSystem->disk, replicas, synchronous, key);
+  return this->replicator;
+}
+
+void DistributedFileSystemService::becomeReplica() {
+  this->replica = true;
+}
+
+bool DistributedFileSystemService::applyReplicated(const vector<BlockDelta> &deltas) {
+  Disk *disk = fileSystem->disk;
+  for (size_t idx = 0; idx < deltas.size(); idx++) {
+    if (deltas[idx].blockNumber < 0 || deltas[idx].blockNumber >= disk->numberOfBlocks() ||
+        deltas[idx].offset < 0 || deltas[idx].offset + deltas[idx].bytes.size() > UFS_BLOCK_SIZE) {
+      return false;
+    }
+  }
+
+  pthread_rwlock_wrlock(&replicaLock);
+  // there's no telling which files those blocks belong to, and the
+  // sidecar has to forget them before the image changes
+  etags->clear();
+  // one transaction so the image is synced once for the lot
+  transactions->begin();
+  unsigned char block[UFS_BLOCK_SIZE];
+  for (size_t idx = 0; idx < deltas.size(); idx++) {
+    disk->readBlock(deltas[idx].blockNumber, block);
+    for (size_t byte = 0; byte < deltas[idx].bytes.size(); byte++) {
+      block[deltas[idx].offset + byte] ^= deltas[idx].bytes[byte];
+    }
+    disk->writeBlock(deltas[idx].blockNumber, block);
+  }
+  transactions->commit();
+
+  fileSystem->forgetCachedDirectories();
+  etags->touch();
+  pthread_rwlock_unlock(&replicaLock);
+  return true;
+}
+
+void DistributedFileSystemService::writeBehind() {
+  this->ingest = new IngestLog(diskFile + ".ingest", [this](const vector<shared_ptr<const PendingPut> > &puts) {
+    return applyPending(puts);
+  });
+}
+
+vector<FailedPut> DistributedFileSystemService::applyPending(const vector<shared_ptr<const PendingPut> > &puts) {
+  vector<FailedPut> failed;
+  // all of them in one transaction, so the image is synced once
+  try {
+    transactions->run([&]() {
+      for (size_t idx = 0; idx < puts.size(); idx++) {
+        putFile(StringUtils::split(puts[idx]->path, '/'), puts[idx]->contents);
+      }
+    });
+    return failed;
+  } catch (ClientError &e) {
+  }
+
+  // one of them can't be applied, so the rest go in on their own and
+  // only that one is handed back
+  for (size_t idx = 0; idx < puts.size(); idx++) {
+    try {
+      transactions->run([&]() {
+        putFile(StringUtils::split(puts[idx]->path, '/'), puts[idx]->contents);
+      });
+    } catch (ClientError &e) {
+      failed.push_back({puts[idx], e.what()});
+    }
+  }
+  return failed;
+}
+
+void DistributedFileSystemService::checkPutPath(const vector<string> &path) {
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  for (size_t idx = 0; idx < path.size(); idx++) {
+    if (path[idx].length() >= DIR_ENT_NAME_SIZE || path[idx].find_first_of(":/*?\"<>|") != string::npos) {
+      checkResult(-EINVALIDNAME);
+    }
+    if (inodeNumber < 0) {
+      continue;
+    }
+    inodeNumber = fileSystem->lookup(inodeNumber, path[idx]);
+    if (inodeNumber == -ENOTFOUND) {
+      // the rest gets created
+      continue;
+    }
+    inode_t inode;
+    checkResult(fileSystem->stat(checkResult(inodeNumber), &inode));
+    // directories on the way, and a file at the end
+    if ((inode.type == UFS_DIRECTORY) != (idx + 1 < path.size())) {
+      checkResult(-EINVALIDTYPE);
+    }
+  }
+}
+
+void DistributedFileSystemService::change(function<void()> body) {
+  if (ingest == NULL) {
+    transactions->run(body);
+  } else {
+    ingest->bypass([&]() {
+      transactions->run(body);
+    });
+  }
+}
+
+void DistributedFileSystemService::checkWritable() {
+  if (replica) {
+    throw ClientError::methodNotAllowed();
+  }
+}
+
+void DistributedFileSystemService::waitForReplicas() {
+  if (replicator != NULL) {
+    replicator->waitForReplicas();
+  }
+}
+
+vector<string> DistributedFileSystemService::pathComponents(HTTPRequest *request) {
+  vector<string> components = request->getPathComponents();
+  // drop the leading "ds3"
+  components.erase(components.begin());
+  return components;
+}
+
+int DistributedFileSystemService::checkResult(int ret) {
+  if (ret >= 0) {
+    return ret;
+  }
+
+  switch (-ret) {
+  case ENOTENOUGHSPACE:
+    throw ClientError::insufficientStorage();
+  case EINVALIDTYPE:
+  case EINVALIDMOVE:
+    throw ClientError::conflict();
+  case ENOTFOUND:
+    throw ClientError::notFound();
+  case ERETRY:
+    throw TransactionConflict();
+  default:
+    throw ClientError::badRequest();
+  }
+}
+
+string DistributedFileSystemService::joinPath(const vector<string> &path) {
+  string joined;
+  for (size_t idx = 0; idx < path.size(); idx++) {
+    if (idx > 0) {
+      joined += "/";
+    }
+    joined += path[idx];
+  }
+  return joined;
+}
+
+vector<string> DistributedFileSystemService::destinationComponents(HTTPRequest *request) {
+  string_view destination;
+  if (!request->findHeader("Destination", &destination)) {
+    throw ClientError::badRequest();
+  }
+
+  // either a path or a full URL, which has to be for this server
+  size_t scheme = destination.find("://");
+  if (scheme != string_view::npos) {
+    size_t slash = destination.find('/', scheme + 3);
+    destination = slash == string_view::npos ? string_view("/") : destination.substr(slash);
+  }
+  size_t query = destination.find_first_of("?#");
+  if (query != string_view::npos) {
+    destination = destination.substr(0, query);
+  }
+
+  vector<string> components = StringUtils::split(string(destination), '/');
+  if (components.empty() || components[0] != "ds3") {
+    throw ClientError::badRequest();
+  }
+  components.erase(components.begin());
+  return components;
+}
+
+int DistributedFileSystemService::resolve(const vector<string> &path, size_t count) {
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  for (size_t idx = 0; idx < count; idx++) {
+    // a file part way down the path doesn't have entries either
+    inodeNumber = fileSystem->lookup(inodeNumber, path[idx]);
+    if (inodeNumber == -ENOTFOUND || inodeNumber == -EINVALIDINODE) {
+      throw ClientError::notFound();
+    }
+    checkResult(inodeNumber);
+  }
+  return inodeNumber;
+}
+
+bool DistributedFileSystemService::streamsRequestBody(HTTPRequest *request) {
+  // PUTs and batches read their body themselves so it's only held in
+  // memory once
+  return request->isPut() || request->isPost();
+}
+
 void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
-  response->setBody("");
+  vector<string> path = pathComponents(request);
+  pmr::string body(request->memory());
+  ReplicaReadLock replicaReadLock(&replicaLock, replica);
+
+  if (ingest != NULL) {
+    string key = joinPath(path);
+    shared_ptr<const PendingPut> put = ingest->find(key);
+    if (put) {
+      sendPending(request, response, put.get());
+      return;
+    }
+    // a directory listing has to show files that are still on their way
+    if (ingest->pendingUnder(key)) {
+      ingest->flush();
+    }
+  }
+
+  // each LocalFileSystem call locks what it reads for as long as it
+  // runs, so a GET never waits on another GET
+  int inodeNumber = resolve(path, path.size());
+  inode_t inode;
+  checkResult(fileSystem->stat(inodeNumber, &inode));
+
+  if (inode.type == UFS_REGULAR_FILE) {
+    sendFile(request, response, inodeNumber);
+    return;
+  }
+
+  shared_ptr<const DirectoryListing> listing;
+  checkResult(fileSystem->listDirectory(inodeNumber, &listing));
+
+  // the listing only changes when the directory does, and then it's a
+  // new listing with a new version
+  pthread_mutex_lock(&listingsLock);
+  map<int, RenderedListing>::iterator rendered = renderedListings.find(inodeNumber);
+  if (rendered != renderedListings.end() && rendered->second.version == listing->version) {
+    body.assign(rendered->second.body);
+    pthread_mutex_unlock(&listingsLock);
+    response->setBody(body);
+    return;
+  }
+  pthread_mutex_unlock(&listingsLock);
+
+  // one entry per line, sorted, with a trailing "/" on directories
+  string text;
+  for (size_t idx = 0; idx < listing->entries.size(); idx++) {
+    text.append(listing->entries[idx].name);
+    if (listing->entries[idx].type == UFS_DIRECTORY) {
+      text.append("/");
+    }
+    text.append("\n");
+  }
+
+  pthread_mutex_lock(&listingsLock);
+  // unless another thread has rendered a newer one in the meantime
+  RenderedListing &entry = renderedListings[inodeNumber];
+  if (entry.version < listing->version) {
+    entry.version = listing->version;
+    entry.body = text;
+  }
+  pthread_mutex_unlock(&listingsLock);
+
+  body.assign(text);
+  response->setBody(body);
+}
+
+void DistributedFileSystemService::sendFile(HTTPRequest *request, HTTPResponse *response, int inodeNumber) {
+  // The file can't change while it's pinned, but a pin is a stripe
+  // lock, so the range is copied out into the request's memory and the
+  // pin dropped before anything goes to the client. Files are at most
+  // MAX_FILE_SIZE, so that's never much.
+  checkResult(fileSystem->pinInode(inodeNumber));
+  pmr::string body(request->memory());
+  try {
+    inode_t inode;
+    checkResult(fileSystem->stat(inodeNumber, &inode));
+    string etag = etagFor(inodeNumber, inode.size);
+    int first, length;
+    if (!fileHeaders(request, response, inode.size, etag, &first, &length)) {
+      fileSystem->unpinInode(inodeNumber);
+      return;
+    }
+    body.resize(length);
+    body.resize(checkResult(fileSystem->readAt(inodeNumber, body.data(), first, length)));
+  } catch (...) {
+    fileSystem->unpinInode(inodeNumber);
+    throw;
+  }
+  fileSystem->unpinInode(inodeNumber);
+  response->setBody(body);
+}
+
+void DistributedFileSystemService::sendPending(HTTPRequest *request, HTTPResponse *response, const PendingPut *put) {
+  // the same ETag it gets once it's applied
+  int size = put->contents.size();
+  string etag = ETagStore::format(StringUtils::fnv1a(put->contents.data(), size), size);
+  int first, length;
+  if (fileHeaders(request, response, size, etag, &first, &length)) {
+    response->setBody(string_view(put->contents).substr(first, length));
+  }
+}
+
+bool DistributedFileSystemService::fileHeaders(HTTPRequest *request, HTTPResponse *response, int size,
+                                               const string &etag, int *first, int *length) {
+  response->setHeader("ETag", etag);
+  response->setHeader("Accept-Ranges", "bytes");
+
+  // a client polling with the ETag it already has gets an answer
+  // without any of the file's blocks being read
+  string_view value;
+  if (request->findHeader("If-None-Match", &value) && HttpUtils::matchesETag(value, etag)) {
+    response->setStatus(304);
+    return false;
+  }
+
+  // several ranges would need a multipart body, and the whole file
+  // is just as correct an answer to those
+  pmr::vector<HttpUtils::ByteRange> ranges(request->memory());
+  HttpUtils::RangeResult rangeResult = HttpUtils::RANGE_IGNORE;
+  if (request->findHeader("Range", &value)) {
+    rangeResult = HttpUtils::parseRange(value, size, &ranges);
+  }
+
+  *first = 0;
+  *length = size;
+  char contentRange[64];
+  if (rangeResult == HttpUtils::RANGE_NOT_SATISFIABLE) {
+    int headerLength = snprintf(contentRange, sizeof(contentRange), "bytes */%d", size);
+    response->setHeader("Content-Range", string_view(contentRange, headerLength));
+    response->setStatus(416);
+    *length = 0;
+  } else if (rangeResult == HttpUtils::RANGE_SATISFIABLE && ranges.size() == 1) {
+    *first = ranges[0].first;
+    *length = ranges[0].last - ranges[0].first + 1;
+    int headerLength = snprintf(contentRange, sizeof(contentRange), "bytes %d-%d/%d",
+                                *first, *first + *length - 1, size);
+    response->setHeader("Content-Range", string_view(contentRange, headerLength));
+    response->setStatus(206);
+  }
+  return true;
+}
+
+string DistributedFileSystemService::etagFor(int inodeNumber, int size) {
+  string etag;
+  if (etags->find(inodeNumber, size, &etag)) {
+    return etag;
+  }
+
+  // not seen since the sidecar was last trusted, so hash it once
+  char buffer[UFS_BLOCK_SIZE];
+  uint64_t hash = StringUtils::FNV1A_OFFSET_BASIS;
+  for (int offset = 0; offset < size; offset += UFS_BLOCK_SIZE) {
+    int ret = checkResult(fileSystem->readAt(inodeNumber, buffer, offset, min(UFS_BLOCK_SIZE, size - offset)));
+    hash = StringUtils::fnv1a(buffer, ret, hash);
+  }
+  etags->add(inodeNumber, hash, size);
+  return ETagStore::format(hash, size);
+}
+
+void DistributedFileSystemService::primeETag(const vector<string> &path) {
+  int inodeNumber;
+  try {
+    inodeNumber = resolve(path, path.size());
+  } catch (ClientError &e) {
+    return;
+  }
+
+  checkResult(fileSystem->pinInode(inodeNumber));
+  try {
+    inode_t inode;
+    checkResult(fileSystem->stat(inodeNumber, &inode));
+    if (inode.type == UFS_REGULAR_FILE) {
+      etagFor(inodeNumber, inode.size);
+    }
+  } catch (...) {
+    fileSystem->unpinInode(inodeNumber);
+    throw;
+  }
+  fileSystem->unpinInode(inodeNumber);
+}
+
+void DistributedFileSystemService::checkIfMatch(int inodeNumber, string_view ifMatch) {
+  // the file is locked by now, and putFile() runs this before it drops
+  // the file's entry, so this is the ETag from before
+  string etag;
+  if (!etags->find(inodeNumber, &etag) || !HttpUtils::matchesETag(ifMatch, etag)) {
+    throw ClientError::preconditionFailed();
+  }
+}
+
+void DistributedFileSystemService::readBody(HTTPRequest *request, size_t limit, pmr::string *body) {
+  // refuse bodies that can't fit before reading them when the client
+  // tells us the size up front, and otherwise stop keeping the body
+  // once it gets too big
+  int64_t contentLength = request->getContentLength();
+  if (contentLength > (int64_t) limit) {
+    throw ClientError::payloadTooLarge();
+  }
+
+  body->reserve(contentLength > 0 ? contentLength : UFS_BLOCK_SIZE);
+  bool tooLarge = false;
+  request->readBody([&](const char *data, size_t len) {
+    if (tooLarge || body->size() + len > limit) {
+      tooLarge = true;
+      return;
+    }
+    body->append(data, len);
+  });
+  if (tooLarge) {
+    throw ClientError::payloadTooLarge();
+  }
+}
+
+int DistributedFileSystemService::putFile(const vector<string> &path, string_view contents,
+                                         function<void(int inodeNumber)> check) {
+  // directories along the way are created implicitly, and create
+  // returns the existing inode when there is already one of that type
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  for (size_t idx = 0; idx + 1 < path.size(); idx++) {
+    inodeNumber = checkResult(fileSystem->create(inodeNumber, UFS_DIRECTORY, path[idx]));
+  }
+  inodeNumber = checkResult(fileSystem->create(inodeNumber, UFS_REGULAR_FILE, path.back()));
+  // while the sidecar still has the ETag from before
+  if (check) {
+    check(inodeNumber);
+  }
+  // Dropped from the sidecar before the image changes. Should the
+  // server die between the commit and the set() below, the sidecar
+  // then has no ETag for the file rather than the old one, whatever
+  // other commits did to its mtime meanwhile.
+  etags->remove(inodeNumber);
+  checkResult(fileSystem->write(inodeNumber, contents.data(), contents.size()));
+
+  // the file stays locked until this runs, so nobody sees the new
+  // contents with the old ETag
+  uint64_t hash = StringUtils::fnv1a(contents.data(), contents.size());
+  int size = contents.size();
+  fileSystem->disk->atEnd([this, inodeNumber, hash, size](bool committed) {
+    if (committed) {
+      etags->set(inodeNumber, hash, size);
+    }
+    etags->touch();
+  });
+  return inodeNumber;
+}
+
+int DistributedFileSystemService::deleteEntry(const vector<string> &path) {
+  int parentInodeNumber = resolve(path, path.size() - 1);
+  // unlink treats a missing name as done, but it's still a 404 here
+  int inodeNumber = resolve(path, path.size());
+  checkResult(fileSystem->unlink(parentInodeNumber, path.back()));
+
+  fileSystem->disk->atEnd([this, inodeNumber](bool committed) {
+    if (committed) {
+      etags->remove(inodeNumber);
+    }
+    etags->touch();
+  });
+  return inodeNumber;
 }
 
 void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
+  checkWritable();
+  vector<string> path = pathComponents(request);
+  if (path.empty()) {
+    throw ClientError::badRequest();
+  }
+
+  pmr::string contents(request->memory());
+  readBody(request, MAX_FILE_SIZE, &contents);
+
+  // If-Match makes the PUT conditional on the file not having changed
+  // since the client read it
+  string_view ifMatch;
+  bool conditional = request->findHeader("If-Match", &ifMatch);
+  if (conditional) {
+    primeETag(path);
+  } else if (ingest != NULL) {
+    if (!ingest->append(joinPath(path), contents, [&](const string &) { checkPutPath(path); })) {
+      checkResult(-EINVALIDTYPE);
+    }
+    response->setBody("");
+    return;
+  }
+
+  change([&]() {
+    if (conditional) {
+      putFile(path, contents, [&](int inodeNumber) { checkIfMatch(inodeNumber, ifMatch); });
+    } else {
+      putFile(path, contents);
+    }
+  });
+  waitForReplicas();
+
+  response->setBody("");
+}
+
+void DistributedFileSystemService::post(HTTPRequest *request, HTTPResponse *response) {
+  checkWritable();
+  // batches go to the root, there's nothing to post to anywhere else
+  if (!pathComponents(request).empty()) {
+    throw ClientError::methodNotAllowed();
+  }
+
+  pmr::string body(request->memory());
+  readBody(request, MAX_BATCH_SIZE, &body);
+
+  // parse everything first so a malformed batch changes nothing
+  vector<BatchOperation> operations;
+  string_view rest(body);
+  while (!rest.empty()) {
+    size_t end = rest.find('\n');
+    if (end == string_view::npos) {
+      throw ClientError::badRequest();
+    }
+    vector<string> words = StringUtils::split(string(rest.substr(0, end)), ' ');
+    rest.remove_prefix(end + 1);
+    if (words.empty()) {
+      // blank lines between operations are fine
+      continue;
+    }
+
+    BatchOperation operation;
+    if (words[0] == "PUT" && words.size() == 3) {
+      operation.isDelete = false;
+      size_t length;
+      try {
+        length = stoul(words[2]);
+      } catch (...) {
+        throw ClientError::badRequest();
+      }
+      if (length > MAX_FILE_SIZE || length > rest.size()) {
+        throw ClientError::badRequest();
+      }
+      operation.contents = rest.substr(0, length);
+      rest.remove_prefix(length);
+    } else if (words[0] == "DELETE" && words.size() == 2) {
+      operation.isDelete = true;
+    } else {
+      throw ClientError::badRequest();
+    }
+    operation.path = StringUtils::split(words[1], '/');
+    if (operation.path.empty()) {
+      throw ClientError::badRequest();
+    }
+    operations.push_back(operation);
+  }
+
+  // one transaction and one sync for the lot; if any of them fails
+  // none of them happen
+  change([&]() {
+    for (size_t idx = 0; idx < operations.size(); idx++) {
+      if (operations[idx].isDelete) {
+        deleteEntry(operations[idx].path);
+      } else {
+        putFile(operations[idx].path, operations[idx].contents);
+      }
+    }
+  });
+  waitForReplicas();
+
+  response->setBody(to_string(operations.size()) + " operations\n");
+}
+
+void DistributedFileSystemService::move(HTTPRequest *request, HTTPResponse *response) {
+  checkWritable();
+  vector<string> path = pathComponents(request);
+  vector<string> destination = destinationComponents(request);
+  if (path.empty() || destination.empty()) {
+    // the root can't be moved, or replaced
+    throw ClientError::badRequest();
+  }
+  // WebDAV's Overwrite: F refuses to replace an existing destination
+  string_view value;
+  bool overwrite = !(request->findHeader("Overwrite", &value) && value == "F");
+
+  change([&]() {
+    int srcParentInodeNumber = resolve(path, path.size() - 1);
+    int inodeNumber = resolve(path, path.size());
+    // like PUT, directories along the way are created implicitly
+    int dstParentInodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    for (size_t idx = 0; idx + 1 < destination.size(); idx++) {
+      dstParentInodeNumber = checkResult(fileSystem->create(dstParentInodeNumber, UFS_DIRECTORY, destination[idx]));
+    }
+
+    int replaced = fileSystem->lookup(dstParentInodeNumber, destination.back());
+    if (replaced == inodeNumber) {
+      return;
+    }
+    if (replaced >= 0 && !overwrite) {
+      throw ClientError::preconditionFailed();
+    }
+    checkResult(fileSystem->rename(srcParentInodeNumber, path.back(),
+                                   dstParentInodeNumber, destination.back()));
+
+    // the moved file keeps its inode and so its ETag, but whatever it
+    // replaced is gone
+    if (replaced >= 0) {
+      fileSystem->disk->atEnd([this, replaced](bool committed) {
+        if (committed) {
+          etags->remove(replaced);
+        }
+        etags->touch();
+      });
+    }
+  });
+  waitForReplicas();
+
   response->setBody("");
 }
 
 void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *response) {
+  checkWritable();
+  vector<string> path = pathComponents(request);
+  if (path.empty()) {
+    // the root can't be deleted
+    throw ClientError::badRequest();
+  }
+
+  string_view ifMatch;
+  bool conditional = request->findHeader("If-Match", &ifMatch);
+  if (conditional) {
+    primeETag(path);
+  }
+
+  change([&]() {
+    int inodeNumber = deleteEntry(path);
+    if (conditional) {
+      checkIfMatch(inodeNumber, ifMatch);
+    }
+  });
+  waitForReplicas();
+
   response->setBody("");
 }
@@ -0,0 +1,177 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "ETagStore.h"
+
+using namespace std;
+
+// whether the file at `a` was last written after the one at `b`; with
+// equal times there's no telling, so that's a no
+static bool newerThan(const struct stat &a, const struct stat &b) {
+  if (a.st_mtim.tv_sec != b.st_mtim.tv_sec) {
+    return a.st_mtim.tv_sec > b.st_mtim.tv_sec;
+  }
+  return a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+}
+
+ETagStore::ETagStore(string sidecarFile, string imageFile) {
+  m_sidecarFile = sidecarFile;
+  m_imageFile = imageFile;
+  m_fd = -1;
+  pthread_mutex_init(&m_lock, NULL);
+  load();
+}
+
+ETagStore::~ETagStore() {
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+string ETagStore::format(uint64_t hash, int size) {
+  char etag[64];
+  int length = snprintf(etag, sizeof(etag), "\"%x-%016llx\"", size, (unsigned long long) hash);
+  return string(etag, length);
+}
+
+bool ETagStore::find(int inodeNumber, int size, string *etag) {
+  pthread_mutex_lock(&m_lock);
+  map<int, Entry>::iterator found = m_entries.find(inodeNumber);
+  bool ret = found != m_entries.end() && found->second.size == size;
+  if (ret) {
+    *etag = format(found->second.hash, size);
+  }
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+bool ETagStore::find(int inodeNumber, string *etag) {
+  pthread_mutex_lock(&m_lock);
+  map<int, Entry>::iterator found = m_entries.find(inodeNumber);
+  bool ret = found != m_entries.end();
+  if (ret) {
+    *etag = format(found->second.hash, found->second.size);
+  }
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+void ETagStore::add(int inodeNumber, uint64_t hash, int size) {
+  pthread_mutex_lock(&m_lock);
+  map<int, Entry>::iterator found = m_entries.find(inodeNumber);
+  if (found == m_entries.end() || found->second.size != size) {
+    Entry &entry = m_entries[inodeNumber];
+    entry.hash = hash;
+    entry.size = size;
+    append(inodeNumber, &entry);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ETagStore::set(int inodeNumber, uint64_t hash, int size) {
+  pthread_mutex_lock(&m_lock);
+  Entry &entry = m_entries[inodeNumber];
+  entry.hash = hash;
+  entry.size = size;
+  append(inodeNumber, &entry);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ETagStore::remove(int inodeNumber) {
+  pthread_mutex_lock(&m_lock);
+  if (m_entries.erase(inodeNumber) > 0) {
+    append(inodeNumber, NULL);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ETagStore::clear() {
+  pthread_mutex_lock(&m_lock);
+  m_entries.clear();
+  // the log is opened for appending, so it starts again from nothing
+  if (m_fd >= 0 && ftruncate(m_fd, 0) != 0) {
+    cerr << "could not truncate " << m_sidecarFile << endl;
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ETagStore::touch() {
+  if (m_fd >= 0) {
+    futimens(m_fd, NULL);
+  }
+}
+
+void ETagStore::load() {
+  struct stat sidecarStat, imageStat;
+  if (stat(m_sidecarFile.c_str(), &sidecarStat) == 0 &&
+      stat(m_imageFile.c_str(), &imageStat) == 0 &&
+      newerThan(sidecarStat, imageStat)) {
+    // one line per change, "<inode> <hash> <size>", or "<inode> -"
+    // when the file went away
+    ifstream in(m_sidecarFile);
+    string line;
+    while (getline(in, line)) {
+      istringstream fields(line);
+      int inodeNumber;
+      string hash;
+      if (!(fields >> inodeNumber >> hash)) {
+        continue;
+      }
+      if (hash == "-") {
+        m_entries.erase(inodeNumber);
+        continue;
+      }
+      Entry entry;
+      entry.hash = strtoull(hash.c_str(), NULL, 16);
+      if (fields >> entry.size) {
+        m_entries[inodeNumber] = entry;
+      }
+    }
+  }
+
+  // write out just the live entries so the log starts short again
+  string compacted = m_sidecarFile + ".tmp";
+  m_fd = open(compacted.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    cerr << "could not open " << compacted << ", ETags won't be kept across restarts" << endl;
+    return;
+  }
+  for (map<int, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); it++) {
+    append(it->first, &it->second);
+  }
+  if (rename(compacted.c_str(), m_sidecarFile.c_str()) != 0) {
+    cerr << "could not replace " << m_sidecarFile << endl;
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+void ETagStore::append(int inodeNumber, const Entry *entry) {
+  if (m_fd < 0) {
+    return;
+  }
+  char line[64];
+  int length;
+  if (entry == NULL) {
+    length = snprintf(line, sizeof(line), "%d -\n", inodeNumber);
+  } else {
+    length = snprintf(line, sizeof(line), "%d %016llx %d\n", inodeNumber,
+                      (unsigned long long) entry->hash, entry->size);
+  }
+  // a sidecar that's missing a change can't be trusted again
+  if (write(m_fd, line, length) != length) {
+    cerr << "could not write to " << m_sidecarFile << ", ETags won't be kept across restarts" << endl;
+    close(m_fd);
+    m_fd = -1;
+    unlink(m_sidecarFile.c_str());
+  }
+}
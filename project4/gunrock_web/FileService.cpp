@@ -2,9 +2,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <string>
 
 #include "FileService.h"
@@ -31,40 +33,72 @@ bool FileService::endswith(string str, string suffix) {
 }
 
 void FileService::get(HTTPRequest *request, HTTPResponse *response) {
+  this->serve(request, response, true);
+}
+
+void FileService::head(HTTPRequest *request, HTTPResponse *response) {
+  // HEAD is the same as get but with no body
+  this->serve(request, response, false);
+}
+
+void FileService::serve(HTTPRequest *request, HTTPResponse *response, bool sendBody) {
   string path = this->m_basedir + request->getPath();
-  string fileContents = this->readFile(path);
-  if (fileContents.size() == 0) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
     throw ClientError::notFound();
+  }
+
+  if (this->endswith(path, ".css")) {
+    response->setContentType("text/css");
+  } else if (this->endswith(path, ".js")) {
+    response->setContentType("text/javascript");
+  }
+
+  if (!sendBody) {
+    response->setContentLength(st.st_size);
+  } else if (st.st_size < STREAM_THRESHOLD) {
+    response->setBody(this->readFile(fd));
   } else {
-    if (this->endswith(path, ".css")) {
-      response->setContentType("text/css");
-    } else if (this->endswith(path, ".js")) {
-      response->setContentType("text/javascript");
+    // big files go out a buffer at a time rather than being read whole
+    try {
+      this->streamFile(request, response, fd, st.st_size);
+    } catch (...) {
+      close(fd);
+      throw;
     }
-    response->setBody(fileContents);
   }
+  close(fd);
 }
 
-string FileService::readFile(string path) {
-  int fd = open(path.c_str(), O_RDONLY);
-  if (fd < 0) {
-    return "";
-  }
-
+string FileService::readFile(int fd) {
   string result;
   int ret;
   char buffer[4096];
   while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
     result.append(buffer, ret);
   }
-
-  close(fd);
-  
   return result;
 }
 
-void FileService::head(HTTPRequest *request, HTTPResponse *response) {
-  // HEAD is the same as get but with no body
-  this->get(request, response);
-  response->setBody("");
+void FileService::streamFile(HTTPRequest *request, HTTPResponse *response, int fd, off_t size) {
+  ChunkedWriter *writer = this->streamResponse(request, response);
+  off_t remaining = size;
+  writer->writeFrom([&](char *buffer, size_t length) -> size_t {
+    if (remaining == 0) {
+      return 0;
+    }
+    ssize_t ret = read(fd, buffer, min(length, (size_t) remaining));
+    if (ret <= 0) {
+      // the file shrank underneath us, and what the client has so far
+      // mustn't pass for all of it
+      throw runtime_error("could not read " + to_string(remaining) + " more bytes of the file");
+    }
+    remaining -= ret;
+    return ret;
+  });
 }
@@ -5,6 +5,9 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
 
 using namespace std;
 
@@ -14,7 +17,13 @@ using namespace std;
 int HTTP::message_begin_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    assert(http->getState() == HTTP::INIT);
+    if(http->getState() != HTTP::INIT) {
+        // Each HTTP object holds one message, so the parser stops
+        // before a second one, like a request pipelined behind the
+        // first, and whoever called addData decides what to do with
+        // the bytes it didn't take.
+        return -1;
+    }
     http->setState(HTTP::HEADER);
     return 0;
 }
@@ -22,65 +31,88 @@ int HTTP::message_begin_cb(http_parser *parser)
 int HTTP::path_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_path.append(at, length);
-    return 0;
+    return http->appendSpan(&http->m_path, at, length) ? 0 : -1;
 }
 int HTTP::query_string_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_query.append(at, length);
-    return 0;
+    return http->appendSpan(&http->m_query, at, length) ? 0 : -1;
 }
 
 int HTTP::url_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->appendUrl(at, length);
-
-    return 0;
+    return http->appendSpan(&http->m_url, at, length) ? 0 : -1;
 }
 
-int HTTP::fragment_cb(http_parser */*parser*/, const char */*at*/, size_t /*length*/)
+int HTTP::fragment_cb(http_parser *parser, const char */*at*/, size_t /*length*/)
 {
-    cout << "fragment" << endl;
-    assert(false);
-    return 0;
+    // clients don't send fragments, so it's a malformed request
+    HTTP *http = (HTTP *) parser->data;
+    http->m_parseError = true;
+    return -1;
 }
 
 int HTTP::header_field_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
+    if(http->m_headerDone) {
+        // trailers after a chunked body live outside m_raw, and nothing
+        // looks at them
+        return 0;
+    }
 
     if(http->getState() == HTTP::FIELD) {
-        http->appendHeaderField(at, length);
+        return http->appendHeaderField(at, length) ? 0 : -1;
     } else if((http->getState() == HTTP::VALUE) ||
               (http->getState() == HTTP::HEADER)) {
-        http->newHeaderField(at, length);
         http->setState(HTTP::FIELD);
-    } else {
-        assert(false);
+        return http->newHeaderField(at, length) ? 0 : -1;
     }
 
-    return 0;
+    http->m_parseError = true;
+    return -1;
 }
 
 int HTTP::header_value_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
+    if(http->m_headerDone) {
+        return 0;
+    }
     if(http->getState() == HTTP::FIELD) {
         http->setState(HTTP::VALUE);
     }
-    assert(http->getState() == HTTP::VALUE);
-    http->appendHeaderValue(at, length);
-    return 0;
+    if(http->getState() != HTTP::VALUE) {
+        http->m_parseError = true;
+        return -1;
+    }
+    return http->appendHeaderValue(at, length) ? 0 : -1;
 }
 
 int HTTP::headers_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
+    if(http->getState() == HTTP::FIELD) {
+        // a header line without a colon
+        http->m_parseError = true;
+        return -1;
+    }
     http->addHeaderField();
     http->m_headerDone = true;
 
+    if(http->m_httpType == HTTP_REQUEST) {
+        // services look at the method before the body has been read
+        http->m_method = parser->method;
+        string_view encoding;
+        if(http->findHeader("Transfer-Encoding", &encoding) &&
+           encoding.find("chunked") != string_view::npos) {
+            http->m_contentLength = -1;
+        } else {
+            http->m_contentLength = parser->content_length;
+        }
+    }
+
     if(http->m_httpType == HTTP_RESPONSE) {
         char buf[64];
         snprintf(buf, 63, "HTTP/%u.%u %u ", parser->http_major, parser->http_minor, parser->status_code);
@@ -106,7 +138,8 @@ int HTTP::headers_complete_cb(http_parser *parser)
         } else if(parser->status_code == 503) {
             http->m_statusStr += "Service Unavailable";
         } else {
-            assert(false);
+            // the reason phrase is only for people to read
+            http->m_statusStr += "Unknown";
         }
         
         http->m_extraParsedBytes = 1;
@@ -119,7 +152,11 @@ int HTTP::headers_complete_cb(http_parser *parser)
 int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_body.append(at, length);
+    if(http->m_bodySink != NULL) {
+        (*http->m_bodySink)(at, length);
+    } else {
+        http->m_body.append(at, length);
+    }
 
     return 0;
 }
@@ -127,8 +164,6 @@ int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 int HTTP::message_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    assert((http->getState() == HTTP::VALUE) || 
-           (http->getState() == HTTP::BODY));
     http->setState(HTTP::DONE);
     http->messageComplete(parser->method);
     return 0;
@@ -141,11 +176,13 @@ int HTTP::message_complete_cb(http_parser *parser)
 /*************************** Public Functions *******************************/
 
 
-HTTP::HTTP(http_parser_type httpType)
+HTTP::HTTP(http_parser_type httpType, std::pmr::memory_resource *memory)
+    : m_raw(memory), m_headers(memory), m_body(memory)
 {
     m_state = INIT;
     http_parser_init(&m_parser, httpType);
     m_doneParsing = false;
+    m_parseError = false;
     m_httpType = httpType;
     m_headerDone = false;
 
@@ -162,25 +199,18 @@ HTTP::HTTP(http_parser_type httpType)
 
     m_parser.data = this;
 
-    m_field = NULL;
-    m_value = NULL;
+    m_url = m_path = m_query = m_host = HttpSpan{0, 0};
+    m_inField = false;
+    memset(m_headerIndex, 0, sizeof(m_headerIndex));
+    m_raw.reserve(4096);
+    m_headers.reserve(16);
     m_extraParsedBytes = 0;
+    m_bodySink = NULL;
+    m_contentLength = -1;
 }
 
 HTTP::~HTTP()
 {
-    if(m_field != NULL) {
-        delete m_field;
-    }
-
-    if(m_value != NULL) {
-        delete m_value;
-    }
-
-    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        delete m_headers[idx].first;
-        delete m_headers[idx].second;
-    }
 }
 
 int HTTP::addData(const unsigned char *data, int len)
@@ -188,30 +218,62 @@ int HTTP::addData(const unsigned char *data, int len)
     if(m_doneParsing) {
         assert(false);
     }
+
+    // Until the header is complete every byte goes into the raw buffer
+    // so the parser callbacks hand us pointers we can keep as offsets.
+    // Body bytes after that are handed straight to the parser.
+    size_t rawStart = m_raw.size();
+    bool inHeader = !m_headerDone;
+    if(inHeader) {
+        m_raw.append((const char *) data, len);
+        data = (const unsigned char *) m_raw.data() + rawStart;
+    }
+
     int ret = http_parser_execute(&m_parser, &m_settings, (const char *) data, len);
     ret += m_extraParsedBytes;
     m_extraParsedBytes = 0;
+
+    // A request parser only stops short when the request is malformed,
+    // or for CONNECT and Upgrade, which finish the message first.
+    if(m_httpType == HTTP_REQUEST && ret < len && !m_doneParsing && !m_parser.upgrade) {
+        m_parseError = true;
+    }
+
+    // anything the parser didn't consume will be handed to us again
+    if(inHeader && ret < len) {
+        m_raw.resize(rawStart + ret);
+    }
     return ret;
 }
 
+void HTTP::setBodySink(const BodySink *sink)
+{
+    m_bodySink = sink;
+    if(m_bodySink != NULL && m_body.size() > 0) {
+        // body bytes that arrived along with the header
+        (*m_bodySink)(m_body.data(), m_body.size());
+        m_body.clear();
+    }
+}
+
 string HTTP::getBody()
 {
-    return m_body;
+    return string(m_body);
 }
 
 string HTTP::getUrl()
 {
-    return m_url;
+    return string(view(m_url));
 }
 
 string HTTP::getPath()
 {
-    return m_path;
+    return string(view(m_path));
 }
 
 string HTTP::getHost()
 {
-    string host = (m_method == HTTP_CONNECT) ? m_url : m_host;
+    string host(view((m_method == HTTP_CONNECT) ? m_url : m_host));
     if(host.find(':') == string::npos) {
         host += ":80";
     }
@@ -239,15 +301,15 @@ string HTTP::getReplyHeader()
 
     bool foundConn = false;
     for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+        string_view field = headerField(idx);
+        string_view value = headerValue(idx);
 
         if(field == "Connection") {
             value = "close";
             foundConn = true;
         }
 
-        reply += field + string(": ") + value + string("\r\n");
+        reply.append(field).append(": ").append(value).append("\r\n");
     }
 
     if(!foundConn) {
@@ -263,24 +325,27 @@ string HTTP::getProxyRequest(const char *userAgent)
 {
     string reply;
     string urlPathQuery;
+    string url = getUrl();
+    string path = getPath();
+    string query = getQuery();
 
     assert(m_httpType == HTTP_REQUEST);
 
     if((m_method == HTTP_GET) || (m_method == HTTP_POST) || (m_method == HTTP_HEAD)) {
-        if(m_path.size() == 0) {
+        if(path.size() == 0) {
             urlPathQuery = "/";
         } else {
-            urlPathQuery = m_path;
+            urlPathQuery = path;
         }
-        if(m_query.size() > 0) {
-            urlPathQuery += "?" + m_query;
+        if(query.size() > 0) {
+            urlPathQuery += "?" + query;
         }
-        if(m_url.find(urlPathQuery) == string::npos) {
+        if(url.find(urlPathQuery) == string::npos) {
             // this is a hack to get around buggy HTML from taobao
-            assert(m_query.size() > 0);
-            urlPathQuery = m_path + "??" + m_query;
-            if(m_url.find(urlPathQuery) == string::npos) {
-                cout << "url path mismatch " << m_url << endl << urlPathQuery << endl;
+            assert(query.size() > 0);
+            urlPathQuery = path + "??" + query;
+            if(url.find(urlPathQuery) == string::npos) {
+                cout << "url path mismatch " << url << endl << urlPathQuery << endl;
             }
         }
     }
@@ -288,7 +353,7 @@ string HTTP::getProxyRequest(const char *userAgent)
     if(m_method == HTTP_GET) {
         reply = "GET " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_CONNECT) {
-        reply = "CONNECT " + m_url + " HTTP/1.1\r\n";
+        reply = "CONNECT " + url + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_POST) {
         reply = "POST " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_HEAD) {
@@ -298,21 +363,21 @@ string HTTP::getProxyRequest(const char *userAgent)
     }
 
     for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+        string_view field = headerField(idx);
+        string_view value = headerValue(idx);
 
         if((userAgent != NULL) && (field == "User-Agent")) {
-            value = string(userAgent);
+            value = userAgent;
         }
 
         if(field == "Proxy-Connection") {
-            field = string("Connection");
-            value = string("close");
-            //value = string("keep-alive");
+            field = "Connection";
+            value = "close";
+            //value = "keep-alive";
         }
 
         if(field != "Keep-Alive") {
-            reply += field + string(": ") + value + string("\r\n");
+            reply.append(field).append(": ").append(value).append("\r\n");
         }
     }
 
@@ -345,50 +410,123 @@ void HTTP::setState(HttpState newState)
     m_state = newState;
 }
 
-void HTTP::appendUrl(const char *at, size_t len)
+bool HTTP::appendSpan(HttpSpan *span, const char *at, size_t len)
 {
-    m_url.append(at, len);
+    // The parser may hand us a token in several pieces. Since the whole
+    // header lives in m_raw they're normally contiguous, but a client
+    // can break that, with an obs-fold continuation line for instance,
+    // and then the request is rejected.
+    if(at < m_raw.data() || at + len > m_raw.data() + m_raw.size()) {
+        m_parseError = true;
+        return false;
+    }
+    uint32_t offset = at - m_raw.data();
+    if(span->length == 0) {
+        span->offset = offset;
+    } else if(offset != span->offset + span->length) {
+        m_parseError = true;
+        return false;
+    }
+    span->length += len;
+    return true;
+}
+
+uint32_t HTTP::hashField(string_view field)
+{
+    // FNV-1a over the lower-cased field name
+    uint32_t hash = 2166136261u;
+    for(size_t idx = 0; idx < field.size(); idx++) {
+        hash ^= (unsigned char) tolower((unsigned char) field[idx]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool HTTP::findHeader(string_view field, string_view *value)
+{
+    uint32_t hash = hashField(field);
+    int slot = hash % HEADER_INDEX_SIZE;
+    for(int probe = 0; probe < HEADER_INDEX_SIZE; probe++) {
+        int entry = m_headerIndex[slot];
+        if(entry == 0) {
+            break;
+        }
+        const HttpHeader &header = m_headers[entry - 1];
+        if(header.hash == hash && header.field.length == field.size() &&
+           strncasecmp(m_raw.data() + header.field.offset, field.data(), field.size()) == 0) {
+            if(value != NULL) {
+                *value = view(header.value);
+            }
+            return true;
+        }
+        slot = (slot + 1) % HEADER_INDEX_SIZE;
+    }
+
+    // the index only holds the first few headers, check the rest directly
+    for(size_t idx = HEADER_INDEX_SIZE / 2; idx < m_headers.size(); idx++) {
+        const HttpHeader &header = m_headers[idx];
+        if(header.hash == hash && header.field.length == field.size() &&
+           strncasecmp(m_raw.data() + header.field.offset, field.data(), field.size()) == 0) {
+            if(value != NULL) {
+                *value = view(header.value);
+            }
+            return true;
+        }
+    }
+    return false;
 }
 
 void HTTP::addHeaderField()
 {
-    if(m_field != NULL) {
-        assert(m_value != NULL);
-        if(*m_field == "Host") {
-            m_host = *m_value;
+    if(m_inField) {
+        string_view field = view(m_current.field);
+        m_current.hash = hashField(field);
+        if(field.size() == 4 && strncasecmp(field.data(), "Host", 4) == 0) {
+            m_host = m_current.value;
         }
-        if(*m_field == "Eoh") {
+        if(field == "Eoh") {
             cout << "got the Eoh header" << endl;
         }
-        m_headers.insert(m_headers.end(), pair<string *, string *>(m_field, m_value));
-        m_field = NULL;
-        m_value = NULL;
-    } else {
-        assert(m_value == NULL);
+        m_headers.push_back(m_current);
+
+        // Keep the index at most half full so probes stay short. When
+        // there is already an entry for this field we keep the first one
+        // to match the old linear scan.
+        if(m_headers.size() <= HEADER_INDEX_SIZE / 2 && !findHeader(field, NULL)) {
+            int slot = m_current.hash % HEADER_INDEX_SIZE;
+            while(m_headerIndex[slot] != 0) {
+                slot = (slot + 1) % HEADER_INDEX_SIZE;
+            }
+            m_headerIndex[slot] = m_headers.size();
+        }
+        m_inField = false;
     }
 }
 
-void HTTP::newHeaderField(const char *at, size_t len)
+bool HTTP::newHeaderField(const char *at, size_t len)
 {
     addHeaderField();
-    m_field = new string(at, len);
-    m_value = new string();
+    m_current.field = m_current.value = HttpSpan{0, 0};
+    m_current.hash = 0;
+    m_inField = true;
+    return appendSpan(&m_current.field, at, len);
 }
-void HTTP::appendHeaderField(const char *at, size_t len)
+bool HTTP::appendHeaderField(const char *at, size_t len)
 {
-    assert(m_field != NULL);
-    m_field->append(at, len);
+    assert(m_inField);
+    return appendSpan(&m_current.field, at, len);
 }
 
-void HTTP::appendHeaderValue(const char *at, size_t len)
+bool HTTP::appendHeaderValue(const char *at, size_t len)
 {
-    m_value->append(at, len);
+    return appendSpan(&m_current.value, at, len);
 }
 
 void HTTP::messageComplete(unsigned char method)
 {
     if(m_httpType == HTTP_REQUEST) {
-      assert((method == HTTP_GET) || (method == HTTP_CONNECT) || (method == HTTP_POST) || (method == HTTP_HEAD) || (method == HTTP_PUT) || (method == HTTP_DELETE) || (method == HTTP_MOVE));
+        // methods the server doesn't implement are turned away with a
+        // 501 by the router
         m_method = method;
     }
     m_doneParsing = true;
@@ -1,13 +1,115 @@
-#include <sstream>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
 
 #include "HTTPResponse.h"
+#include "HttpUtils.h"
 
 using namespace std;
 
-HTTPResponse::HTTPResponse() {
+#define MAX_STATUS (600)
+
+struct StatusEntry {
+  int status;
+  const char *reason;
+};
+
+static const StatusEntry statusEntries[] = {
+  {100, "Continue"}, {101, "Switching Protocols"}, {102, "Processing"},
+  {103, "Early Hints"},
+  {200, "OK"}, {201, "Created"}, {202, "Accepted"},
+  {203, "Non-Authoritative Information"}, {204, "No Content"},
+  {205, "Reset Content"}, {206, "Partial Content"}, {207, "Multi-Status"},
+  {208, "Already Reported"}, {226, "IM Used"},
+  {300, "Multiple Choices"}, {301, "Moved Permanently"}, {302, "Found"},
+  {303, "See Other"}, {304, "Not Modified"}, {305, "Use Proxy"},
+  {307, "Temporary Redirect"}, {308, "Permanent Redirect"},
+  {400, "Bad Request"}, {401, "Unauthorized"}, {402, "Payment Required"},
+  {403, "Forbidden"}, {404, "Not Found"}, {405, "Method Not Allowed"},
+  {406, "Not Acceptable"}, {407, "Proxy Authentication Required"},
+  {408, "Request Timeout"}, {409, "Conflict"}, {410, "Gone"},
+  {411, "Length Required"}, {412, "Precondition Failed"},
+  {413, "Content Too Large"}, {414, "URI Too Long"},
+  {415, "Unsupported Media Type"}, {416, "Range Not Satisfiable"},
+  {417, "Expectation Failed"}, {418, "I'm a teapot"},
+  {421, "Misdirected Request"}, {422, "Unprocessable Content"},
+  {423, "Locked"}, {424, "Failed Dependency"}, {425, "Too Early"},
+  {426, "Upgrade Required"}, {428, "Precondition Required"},
+  {429, "Too Many Requests"}, {431, "Request Header Fields Too Large"},
+  {451, "Unavailable For Legal Reasons"},
+  {500, "Internal Server Error"}, {501, "Not Implemented"},
+  {502, "Bad Gateway"}, {503, "Service Unavailable"},
+  {504, "Gateway Timeout"}, {505, "HTTP Version Not Supported"},
+  {506, "Variant Also Negotiates"}, {507, "Insufficient Storage"},
+  {508, "Loop Detected"}, {510, "Not Extended"},
+  {511, "Network Authentication Required"},
+};
+
+/**
+ * Direct-indexed table of complete status lines. Codes we don't know
+ * about get a generic line with an "Unknown" reason so that setStatus
+ * never has to format anything at response time.
+ */
+class StatusTable {
+ public:
+  StatusTable() {
+    for (int code = 0; code < MAX_STATUS; code++) {
+      reasons[code] = "Unknown";
+    }
+    for (size_t idx = 0; idx < sizeof(statusEntries) / sizeof(statusEntries[0]); idx++) {
+      reasons[statusEntries[idx].status] = statusEntries[idx].reason;
+    }
+    for (int code = 0; code < MAX_STATUS; code++) {
+      lines[code] = "HTTP/1.1 " + to_string(code) + " " + reasons[code] + "\r\n";
+    }
+  }
+
+  string_view line(int status) {
+    if (status < 0 || status >= MAX_STATUS) {
+      status = 500;
+    }
+    return lines[status];
+  }
+
+  string_view reason(int status) {
+    if (status < 0 || status >= MAX_STATUS) {
+      return "Unknown";
+    }
+    return reasons[status];
+  }
+
+ private:
+  const char *reasons[MAX_STATUS];
+  string lines[MAX_STATUS];
+};
+
+static StatusTable statusTable;
+
+string_view HTTPResponse::statusLine(int status) {
+  return statusTable.line(status);
+}
+
+string_view HTTPResponse::reasonPhrase(int status) {
+  return statusTable.reason(status);
+}
+
+HTTPResponse::HTTPResponse(pmr::memory_resource *memory)
+  : headers(memory), body(memory), contentType(memory), headerBuffer(memory) {
   this->streaming = false;
+  this->sent = false;
+  this->aborted = false;
+  this->writer = NULL;
+  this->contentLength = -1;
+  this->bodyFd = -1;
+  this->bodyFileOffset = 0;
+  this->bodyFileLength = 0;
   this->contentType = "text/html; charset=ISO-8859-1";
-  this->headers["Server"] = "Gunrock Web";
+  this->headers.reserve(8);
+  setHeader("Server", "Gunrock Web");
   this->status = 200;
 }
 
@@ -15,54 +117,181 @@ void HTTPResponse::withStreaming() {
   this->streaming = true;
 }
 
-void HTTPResponse::setHeader(string name, string value) {
-  this->headers[name] = value;
+void HTTPResponse::setHeader(string_view name, string_view value) {
+  if (name.size() == 12 && strncasecmp(name.data(), "Content-Type", 12) == 0) {
+    setContentType(value);
+    return;
+  }
+
+  for (size_t idx = 0; idx < headers.size(); idx++) {
+    pmr::string &existing = headers[idx].first;
+    if (existing.size() == name.size() &&
+        strncasecmp(existing.data(), name.data(), name.size()) == 0) {
+      headers[idx].second.assign(value);
+      return;
+    }
+  }
+  headers.emplace_back(name, value);
+}
+
+void HTTPResponse::setBody(string_view data) {
+  releaseBodyFile();
+  body.assign(data);
+}
+
+void HTTPResponse::setBodyFile(int fd, off_t offset, size_t length, function<void()> done) {
+  releaseBodyFile();
+  body.clear();
+  bodyFd = fd;
+  bodyFileOffset = offset;
+  bodyFileLength = length;
+  bodyFileDone = move(done);
 }
 
-void HTTPResponse::setBody(string data) {
-  body = data;
+void HTTPResponse::releaseBodyFile() {
+  if (bodyFileDone) {
+    bodyFileDone();
+    bodyFileDone = nullptr;
+  }
+  bodyFd = -1;
+}
+
+void HTTPResponse::appendBody(const char *data, size_t len) {
+  body.append(data, len);
+}
+
+void HTTPResponse::reserveBody(size_t len) {
+  body.reserve(len);
 }
 
 int HTTPResponse::getStatus() {
   return status;
 }
 
-void HTTPResponse::setContentType(string contentType) {
-  this->contentType = contentType;
+void HTTPResponse::setContentType(string_view contentType) {
+  this->contentType.assign(contentType);
+}
+
+void HTTPResponse::setContentLength(size_t length) {
+  this->contentLength = length;
 }
 
 void HTTPResponse::setStatus(int status) {
   this->status = status;
 }
 
+void HTTPResponse::setRelayed(int status) {
+  this->status = status;
+  sent = true;
+}
+
 string HTTPResponse::statusToString() {
-  if (status == 200) {
-    return "OK";
-  } else {
-    return "Unknown";
-  }
+  return string(reasonPhrase(status));
 }
 
-string HTTPResponse::response() {
-  stringstream out;
-  setHeader("Content-Type", contentType);
+void HTTPResponse::serializeHeader() {
+  headerBuffer.clear();
+  headerBuffer.append(statusLine(status));
+  for (size_t idx = 0; idx < headers.size(); idx++) {
+    headerBuffer.append(headers[idx].first);
+    headerBuffer.append(": ");
+    headerBuffer.append(headers[idx].second);
+    headerBuffer.append("\r\n");
+  }
+
+  headerBuffer.append("Date: ");
+  headerBuffer.append(HttpUtils::currentDate());
+  headerBuffer.append("\r\nContent-Type: ");
+  headerBuffer.append(contentType);
+
   if (streaming) {
-    setHeader("Transfer-Encoding", "chunked");
+    headerBuffer.append("\r\nTransfer-Encoding: chunked\r\n\r\n");
+  } else if (status == 204 || status == 304) {
+    // these never have a body, so there's no length to give
+    headerBuffer.append("\r\n\r\n");
   } else {
-    stringstream len;
-    len << body.size();
-    setHeader("Content-Length", len.str());
+    char length[32];
+    size_t size = body.size();
+    if (contentLength >= 0) {
+      size = contentLength;
+    } else if (bodyFd >= 0) {
+      size = bodyFileLength;
+    }
+    to_chars_result result = to_chars(length, length + sizeof(length), size);
+    headerBuffer.append("\r\nContent-Length: ");
+    headerBuffer.append(length, result.ptr - length);
+    headerBuffer.append("\r\n\r\n");
   }
+}
+
+void HTTPResponse::write(MySocket *client) {
+  serializeHeader();
+  sent = true;
+
+  struct iovec iov[2];
+  int count = 1;
+  iov[0].iov_base = (void *) headerBuffer.data();
+  iov[0].iov_len = headerBuffer.size();
+  if (body.size() > 0 && !streaming) {
+    iov[1].iov_base = (void *) body.data();
+    iov[1].iov_len = body.size();
+    count++;
+  }
+  client->writev(iov, count);
+
+  if (bodyFd >= 0 && !streaming) {
+    client->sendfile(bodyFd, bodyFileOffset, bodyFileLength);
+  }
+}
 
-  out << "HTTP/1.1 " << status << " " << statusToString() << "\r\n";
-  map<string, string>::iterator iter;
-  for(iter = headers.begin(); iter != headers.end(); iter++) {
-    out << iter->first << ": " << iter->second << "\r\n";
+ChunkedWriter *HTTPResponse::beginStreaming(MySocket *client, size_t bufferSize) {
+  if (writer != NULL) {
+    return writer;
   }
-  out << "\r\n";
+
+  withStreaming();
+  write(client);
+
+  // the writer's buffer comes from the same arena as the rest of the response
+  pmr::memory_resource *memory = headers.get_allocator().resource();
+  writer = new (memory->allocate(sizeof(ChunkedWriter), alignof(ChunkedWriter)))
+    ChunkedWriter(client, bufferSize, memory);
+  return writer;
+}
+
+void HTTPResponse::finishStreaming() {
+  if (writer != NULL && !aborted) {
+    writer->finish();
+  }
+}
+
+void HTTPResponse::abortStreaming() {
+  aborted = true;
+}
+
+HTTPResponse::~HTTPResponse() {
+  releaseBodyFile();
+  if (writer != NULL) {
+    writer->~ChunkedWriter();
+    headers.get_allocator().resource()->deallocate(writer, sizeof(ChunkedWriter), alignof(ChunkedWriter));
+  }
+}
+
+string HTTPResponse::response() {
+  serializeHeader();
+
+  string out;
+  out.reserve(headerBuffer.size() + body.size());
+  out.append(headerBuffer);
   if (body.size() > 0 && !streaming) {
-    out << body;
+    out.append(body);
+  }
+  if (bodyFd >= 0 && !streaming) {
+    size_t start = out.size();
+    out.resize(start + bodyFileLength);
+    ssize_t ret = pread(bodyFd, &out[start], bodyFileLength, bodyFileOffset);
+    out.resize(start + max(ret, (ssize_t) 0));
   }
 
-  return out.str();
+  return out;
 }
@@ -0,0 +1,40 @@
+#include <algorithm>
+
+#include "HashRing.h"
+#include "StringUtils.h"
+
+using namespace std;
+
+HashRing::HashRing(const vector<string> &nodes, int replicas) {
+  for (size_t node = 0; node < nodes.size(); node++) {
+    for (int replica = 0; replica < replicas; replica++) {
+      m_points.push_back(make_pair(hash(nodes[node] + "#" + to_string(replica)), (int) node));
+    }
+  }
+  sort(m_points.begin(), m_points.end());
+}
+
+int HashRing::find(string_view key) {
+  if (m_points.empty()) {
+    return -1;
+  }
+  vector<pair<uint64_t, int> >::iterator point =
+    lower_bound(m_points.begin(), m_points.end(), make_pair(hash(key), -1));
+  if (point == m_points.end()) {
+    // past the last point, so around to the first
+    point = m_points.begin();
+  }
+  return point->second;
+}
+
+uint64_t HashRing::hash(string_view key) {
+  uint64_t value = StringUtils::fnv1a(key.data(), key.size());
+  // FNV-1a leaves similar strings ("a#1", "a#2") close together, so
+  // finish with a mixer to spread the points around the ring
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
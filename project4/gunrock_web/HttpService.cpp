@@ -12,10 +12,19 @@ HttpService::HttpService(string pathPrefix) {
   this->m_pathPrefix = pathPrefix;
 }
 
-string HttpService::pathPrefix() {
+ChunkedWriter *HttpService::streamResponse(HTTPRequest *request, HTTPResponse *response,
+                                           size_t bufferSize) {
+  return response->beginStreaming(request->getSocket(), bufferSize);
+}
+
+const string &HttpService::pathPrefix() {
   return m_pathPrefix;
 }
 
+bool HttpService::streamsRequestBody(HTTPRequest *request) {
+  return false;
+}
+
 void HttpService::head(HTTPRequest *request, HTTPResponse *response) {
   cout << "HEAD " << request->getPath() << endl;
   throw ClientError::methodNotAllowed();
@@ -1,4 +1,10 @@
 #include <assert.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <charconv>
 
 #include "HttpUtils.h"
 
@@ -29,19 +35,177 @@ map<string, string> HttpUtils::params(string query) {
 void HttpUtils::writeChunk(MySocket *client,
 				      const void *buf, int numBytes) {
 
-  char chunkHeader[256];
-  snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", numBytes);
-  client->write(chunkHeader);
+  // size line, data and trailer go out in one system call; the last
+  // chunk also needs the blank line that ends the message
+  char chunkHeader[32];
+  int headerLength = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", numBytes);
+
+  struct iovec iov[3];
+  int count = 0;
+  iov[count].iov_base = chunkHeader;
+  iov[count++].iov_len = headerLength;
   if (buf != NULL && numBytes > 0) {
-    client->write(string((const char *) buf, numBytes));
+    iov[count].iov_base = (void *) buf;
+    iov[count++].iov_len = numBytes;
   }
-  client->write("\r\n");
+  iov[count].iov_base = (void *) "\r\n";
+  iov[count++].iov_len = 2;
+  client->writev(iov, count);
 }
 
 void HttpUtils::writeLastChunk(MySocket *client) {
   writeChunk(client, NULL, 0);
 }
 
+size_t HttpUtils::formatDate(time_t when, char *buffer) {
+  struct tm tm;
+  gmtime_r(&when, &tm);
+  return strftime(buffer, 30, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+string_view HttpUtils::currentDate() {
+  static thread_local time_t cachedSecond = 0;
+  static thread_local char cachedDate[32];
+  static thread_local size_t cachedLength = 0;
+
+  time_t now = time(NULL);
+  if (now != cachedSecond) {
+    cachedLength = formatDate(now, cachedDate);
+    cachedSecond = now;
+  }
+  return string_view(cachedDate, cachedLength);
+}
+
+
+static string_view trim(string_view str) {
+  size_t start = str.find_first_not_of(" \t");
+  if (start == string_view::npos) {
+    return string_view();
+  }
+  size_t end = str.find_last_not_of(" \t");
+  return str.substr(start, end - start + 1);
+}
+
+// parses all of `str` as a non-negative number
+static bool parseOffset(string_view str, off_t *value) {
+  if (str.empty()) {
+    return false;
+  }
+  long long parsed;
+  from_chars_result result = from_chars(str.data(), str.data() + str.size(), parsed);
+  if (result.ec != errc() || result.ptr != str.data() + str.size() || parsed < 0) {
+    return false;
+  }
+  *value = parsed;
+  return true;
+}
+
+HttpUtils::RangeResult HttpUtils::parseRange(string_view header, off_t size,
+                                             pmr::vector<ByteRange> *ranges) {
+  ranges->clear();
+
+  header = trim(header);
+  if (header.size() < 6 || strncasecmp(header.data(), "bytes=", 6) != 0) {
+    return RANGE_IGNORE;
+  }
+  header.remove_prefix(6);
+
+  size_t specs = 0;
+  while (!header.empty()) {
+    size_t comma = header.find(',');
+    string_view spec = trim(header.substr(0, comma));
+    header = (comma == string_view::npos) ? string_view() : header.substr(comma + 1);
+    if (spec.empty()) {
+      continue;
+    }
+    if (++specs > MAX_RANGES) {
+      return RANGE_IGNORE;
+    }
+
+    size_t dash = spec.find('-');
+    if (dash == string_view::npos) {
+      return RANGE_IGNORE;
+    }
+
+    ByteRange range;
+    if (dash == 0) {
+      // "-N" is the last N bytes
+      off_t suffix;
+      if (!parseOffset(spec.substr(1), &suffix)) {
+        return RANGE_IGNORE;
+      }
+      if (suffix == 0 || size == 0) {
+        continue;
+      }
+      range.first = suffix >= size ? 0 : size - suffix;
+      range.last = size - 1;
+    } else {
+      if (!parseOffset(spec.substr(0, dash), &range.first)) {
+        return RANGE_IGNORE;
+      }
+      string_view last = spec.substr(dash + 1);
+      if (last.empty()) {
+        range.last = size - 1;
+      } else if (!parseOffset(last, &range.last) || range.last < range.first) {
+        return RANGE_IGNORE;
+      }
+      if (range.first >= size) {
+        continue;
+      }
+      if (range.last >= size) {
+        range.last = size - 1;
+      }
+    }
+    ranges->push_back(range);
+  }
+
+  if (specs == 0) {
+    return RANGE_IGNORE;
+  }
+
+  // Overlapping and adjacent ranges are merged, so however they're
+  // asked for the parts never add up to more than the resource, and
+  // "bytes=0-,0-,..." is just the one range.
+  sort(ranges->begin(), ranges->end(), [](const ByteRange &a, const ByteRange &b) {
+    return a.first < b.first;
+  });
+  size_t merged = 0;
+  for (size_t idx = 1; idx < ranges->size(); idx++) {
+    ByteRange &last = (*ranges)[merged];
+    if ((*ranges)[idx].first <= last.last + 1) {
+      last.last = max(last.last, (*ranges)[idx].last);
+    } else {
+      (*ranges)[++merged] = (*ranges)[idx];
+    }
+  }
+  if (!ranges->empty()) {
+    ranges->resize(merged + 1);
+  }
+  return ranges->empty() ? RANGE_NOT_SATISFIABLE : RANGE_SATISFIABLE;
+}
+
+bool HttpUtils::matchesETag(string_view header, string_view etag) {
+  if (etag.substr(0, 2) == "W/") {
+    etag.remove_prefix(2);
+  }
+
+  while (!header.empty()) {
+    size_t comma = header.find(',');
+    string_view candidate = trim(header.substr(0, comma));
+    header = (comma == string_view::npos) ? string_view() : header.substr(comma + 1);
+
+    if (candidate == "*") {
+      return true;
+    }
+    if (candidate.substr(0, 2) == "W/") {
+      candidate.remove_prefix(2);
+    }
+    if (candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
 
 // split lifted from stackoverflow
 // http://stackoverflow.com/questions/236129/split-a-string-in-c
@@ -0,0 +1,342 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "IngestLog.h"
+#include "StringUtils.h"
+#include "dthread.h"
+
+using namespace std;
+
+IngestLog::IngestLog(string logFile, Applier applier) {
+  m_logFile = logFile;
+  m_applier = applier;
+  m_stopping = false;
+  m_appended = 0;
+  m_applied = 0;
+  m_queuedBytes = 0;
+  m_written = 0;
+  m_synced = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+  pthread_mutex_init(&m_syncLock, NULL);
+  pthread_mutex_init(&m_pendingLock, NULL);
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __linux__
+  // a steady stream of PUTs mustn't keep a DELETE waiting for good
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&m_bypassLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  replay();
+  m_fd = open(m_logFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    cerr << "could not open " << m_logFile << endl;
+    exit(1);
+  }
+  // the image has everything that was in it now
+  truncate();
+  dthread_create(&m_thread, NULL, applyLoop, this);
+}
+
+IngestLog::~IngestLog() {
+  // the applier finishes what's queued before it stops
+  dthread_mutex_lock(&m_lock);
+  m_stopping = true;
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+  dthread_join(m_thread, NULL);
+
+  close(m_fd);
+  pthread_rwlock_destroy(&m_bypassLock);
+  pthread_mutex_destroy(&m_pendingLock);
+  pthread_mutex_destroy(&m_syncLock);
+  pthread_cond_destroy(&m_changed);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void IngestLog::replay() {
+  ifstream in(m_logFile, ios::binary);
+  if (!in) {
+    return;
+  }
+  stringstream buffer;
+  buffer << in.rdbuf();
+  string log = buffer.str();
+
+  // each record is "PUT <path length> <contents length> <hash>\n", then
+  // the path and the contents; a record that was only partly written
+  // when the server stopped was never answered, and ends the replay
+  vector<shared_ptr<const PendingPut> > puts;
+  size_t offset = 0;
+  while (offset < log.size()) {
+    size_t end = log.find('\n', offset);
+    if (end == string::npos) {
+      break;
+    }
+    size_t pathLength, contentsLength;
+    unsigned long long hash;
+    if (sscanf(log.c_str() + offset, "PUT %zu %zu %llx\n", &pathLength, &contentsLength, &hash) != 3 ||
+        log.size() - end - 1 < pathLength + contentsLength) {
+      break;
+    }
+    shared_ptr<PendingPut> put = make_shared<PendingPut>();
+    put->sequence = puts.size() + 1;
+    put->path = log.substr(end + 1, pathLength);
+    put->contents = log.substr(end + 1 + pathLength, contentsLength);
+    uint64_t check = StringUtils::fnv1a(put->path.data(), put->path.size());
+    check = StringUtils::fnv1a(put->contents.data(), put->contents.size(), check);
+    if (check != hash) {
+      break;
+    }
+    puts.push_back(put);
+    offset = end + 1 + pathLength + contentsLength;
+  }
+
+  for (size_t first = 0; first < puts.size(); first += MAX_BATCH) {
+    vector<shared_ptr<const PendingPut> > batch(puts.begin() + first,
+                                                puts.begin() + min(first + MAX_BATCH, puts.size()));
+    recordFailed(m_applier(batch));
+  }
+  if (!puts.empty()) {
+    cerr << "replayed " << puts.size() << " PUTs from " << m_logFile << endl;
+  }
+}
+
+bool IngestLog::conflicts(const string &path) {
+  dthread_mutex_lock(&m_pendingLock);
+  // a parent waiting to be a file, or the path itself waiting to be a
+  // directory
+  bool ret = hasPendingUnder(path);
+  for (size_t slash = path.find('/'); slash != string::npos && !ret; slash = path.find('/', slash + 1)) {
+    ret = m_pending.count(path.substr(0, slash)) > 0;
+  }
+  dthread_mutex_unlock(&m_pendingLock);
+  return ret;
+}
+
+bool IngestLog::hasPendingUnder(const string &directory) {
+  string prefix = directory.empty() ? directory : directory + "/";
+  map<string, shared_ptr<const PendingPut> >::iterator next = m_pending.lower_bound(prefix);
+  return next != m_pending.end() && next->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+string IngestLog::recordHeader(const string &path, string_view contents) {
+  uint64_t hash = StringUtils::fnv1a(path.data(), path.size());
+  hash = StringUtils::fnv1a(contents.data(), contents.size(), hash);
+  char header[128];
+  snprintf(header, sizeof(header), "PUT %zu %zu %016llx",
+           path.size(), contents.size(), (unsigned long long) hash);
+  return header;
+}
+
+bool IngestLog::append(const string &path, string_view contents, Validator validate) {
+  string header = recordHeader(path, contents) + "\n";
+  struct iovec iov[3] = {
+    {(void *) header.data(), header.size()},
+    {(void *) path.data(), path.size()},
+    {(void *) contents.data(), contents.size()}
+  };
+  size_t total = header.size() + path.size() + contents.size();
+
+  shared_ptr<PendingPut> put = make_shared<PendingPut>();
+  put->path = path;
+  put->contents.assign(contents);
+
+  // The image is checked without m_lock, since that reads directories
+  // from disk. The bypass lock keeps other changes out meanwhile. The
+  // applier takes a PUT out of m_pending only once the image has it,
+  // so one that conflicts() no longer sees was applied either before
+  // the check, which then found it in the image, or after it, which
+  // m_applied moving shows, and then the check runs again.
+  pthread_rwlock_rdlock(&m_bypassLock);
+  dthread_mutex_lock(&m_lock);
+  bool validated = false;
+  uint64_t validatedAt = 0;
+  while (true) {
+    // a PUT bigger than the whole allowance still goes in on its own
+    while (!m_queue.empty() &&
+           (m_queue.size() >= MAX_QUEUED || m_queuedBytes + contents.size() > MAX_QUEUED_BYTES)) {
+      dthread_cond_wait(&m_changed, &m_lock);
+    }
+    if (conflicts(path)) {
+      dthread_mutex_unlock(&m_lock);
+      pthread_rwlock_unlock(&m_bypassLock);
+      return false;
+    }
+    if (validated && validatedAt == m_applied) {
+      break;
+    }
+    validatedAt = m_applied;
+    dthread_mutex_unlock(&m_lock);
+    try {
+      validate(path);
+    } catch (...) {
+      pthread_rwlock_unlock(&m_bypassLock);
+      throw;
+    }
+    validated = true;
+    dthread_mutex_lock(&m_lock);
+  }
+
+  // the log has to be in the same order as the queue
+  if (writev(m_fd, iov, 3) != (ssize_t) total) {
+    cerr << "could not write to " << m_logFile << endl;
+    exit(1);
+  }
+  put->sequence = ++m_appended;
+  m_queue.push_back(put);
+  m_queuedBytes += put->contents.size();
+  dthread_mutex_lock(&m_pendingLock);
+  m_pending[path] = put;
+  dthread_mutex_unlock(&m_pendingLock);
+  m_written += total;
+  uint64_t end = m_written;
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+
+  // whoever syncs covers everything written so far, so appends that
+  // queue up here behind one sync mostly find theirs already done
+  dthread_mutex_lock(&m_syncLock);
+  if (m_synced < end) {
+    dthread_mutex_lock(&m_lock);
+    uint64_t target = m_written;
+    dthread_mutex_unlock(&m_lock);
+    if (fdatasync(m_fd) != 0) {
+      cerr << "could not sync " << m_logFile << endl;
+      exit(1);
+    }
+    m_synced = target;
+  }
+  dthread_mutex_unlock(&m_syncLock);
+  pthread_rwlock_unlock(&m_bypassLock);
+  return true;
+}
+
+shared_ptr<const PendingPut> IngestLog::find(const string &path) {
+  dthread_mutex_lock(&m_pendingLock);
+  map<string, shared_ptr<const PendingPut> >::iterator found = m_pending.find(path);
+  shared_ptr<const PendingPut> put = found == m_pending.end() ? NULL : found->second;
+  dthread_mutex_unlock(&m_pendingLock);
+  return put;
+}
+
+bool IngestLog::pendingUnder(const string &directory) {
+  dthread_mutex_lock(&m_pendingLock);
+  bool ret = hasPendingUnder(directory);
+  dthread_mutex_unlock(&m_pendingLock);
+  return ret;
+}
+
+void IngestLog::flush() {
+  dthread_mutex_lock(&m_lock);
+  uint64_t target = m_appended;
+  while (m_applied < target) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+void IngestLog::bypass(function<void()> change) {
+  pthread_rwlock_wrlock(&m_bypassLock);
+  try {
+    flush();
+    change();
+  } catch (...) {
+    pthread_rwlock_unlock(&m_bypassLock);
+    throw;
+  }
+  pthread_rwlock_unlock(&m_bypassLock);
+}
+
+void *IngestLog::applyLoop(void *log) {
+  ((IngestLog *) log)->applyPending();
+  return NULL;
+}
+
+void IngestLog::applyPending() {
+  dthread_mutex_lock(&m_lock);
+  while (true) {
+    while (m_queue.empty() && !m_stopping) {
+      dthread_cond_wait(&m_changed, &m_lock);
+    }
+    if (m_queue.empty()) {
+      break;
+    }
+
+    // PUTs that arrive while these are applied make up the next batch
+    vector<shared_ptr<const PendingPut> > batch(m_queue.begin(),
+                                                m_queue.begin() + min(MAX_BATCH, m_queue.size()));
+    dthread_mutex_unlock(&m_lock);
+    // kept before the log can be emptied of them
+    recordFailed(m_applier(batch));
+    dthread_mutex_lock(&m_lock);
+
+    dthread_mutex_lock(&m_pendingLock);
+    for (size_t idx = 0; idx < batch.size(); idx++) {
+      m_queue.pop_front();
+      m_queuedBytes -= batch[idx]->contents.size();
+      map<string, shared_ptr<const PendingPut> >::iterator found = m_pending.find(batch[idx]->path);
+      // unless a newer PUT to the same path is still waiting
+      if (found != m_pending.end() && found->second == batch[idx]) {
+        m_pending.erase(found);
+      }
+    }
+    dthread_mutex_unlock(&m_pendingLock);
+    m_applied = batch.back()->sequence;
+    if (m_queue.empty()) {
+      truncate();
+    }
+    dthread_cond_broadcast(&m_changed);
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+void IngestLog::truncate() {
+  // synced, or a crash could bring back PUTs that a later DELETE or
+  // MOVE has since undone
+  if (ftruncate(m_fd, 0) != 0 || fdatasync(m_fd) != 0) {
+    cerr << "could not empty " << m_logFile << endl;
+    exit(1);
+  }
+}
+
+void IngestLog::recordFailed(const vector<FailedPut> &failed) {
+  if (failed.empty()) {
+    return;
+  }
+  string failedFile = m_logFile + ".failed";
+  int fd = open(failedFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    cerr << "could not open " << failedFile << endl;
+    exit(1);
+  }
+  for (size_t idx = 0; idx < failed.size(); idx++) {
+    const PendingPut *put = failed[idx].put.get();
+    cerr << "could not apply the PUT of " << put->path << ": " << failed[idx].reason
+         << ", kept in " << failedFile << endl;
+    string header = recordHeader(put->path, put->contents) + " " + failed[idx].reason + "\n";
+    struct iovec iov[3] = {
+      {(void *) header.data(), header.size()},
+      {(void *) put->path.data(), put->path.size()},
+      {(void *) put->contents.data(), put->contents.size()}
+    };
+    if (writev(fd, iov, 3) != (ssize_t) (header.size() + put->path.size() + put->contents.size())) {
+      cerr << "could not write to " << failedFile << endl;
+      exit(1);
+    }
+  }
+  if (fdatasync(fd) != 0) {
+    cerr << "could not sync " << failedFile << endl;
+    exit(1);
+  }
+  close(fd);
+}
@@ -1,18 +1,340 @@
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <assert.h>
 #include <cstring>
+#include <unistd.h>
 
 #include "LocalFileSystem.h"
 #include "ufs.h"
 
 using namespace std;
 
+// Holds the inode locks taken through it until it goes out of scope
+class LocalFileSystem::InodeLocks
+{
+public:
+  InodeLocks(LocalFileSystem *fileSystem) : fileSystem(fileSystem) {}
+
+  ~InodeLocks()
+  {
+    for (int i = inodes.size() - 1; i >= 0; --i)
+    {
+      fileSystem->unlockInode(inodes[i]);
+    }
+  }
+
+  int shared(int inodeNumber)
+  {
+    return lock(inodeNumber, false);
+  }
+
+  int exclusive(int inodeNumber)
+  {
+    return lock(inodeNumber, true);
+  }
+
+private:
+  int lock(int inodeNumber, bool exclusive)
+  {
+    int ret = fileSystem->lockInode(inodeNumber, exclusive);
+    if (ret == 0)
+    {
+      inodes.push_back(inodeNumber);
+    }
+    return ret;
+  }
+
+  LocalFileSystem *fileSystem;
+  vector<int> inodes;
+};
+
 LocalFileSystem::LocalFileSystem(Disk *disk)
 {
   this->disk = disk;
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __linux__
+  // glibc lets readers keep jumping the queue by default, which would
+  // starve writers under a steady stream of reads
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  for (int i = 0; i < INODE_STRIPES; i++)
+  {
+    pthread_rwlock_init(&inodeStripes[i], &attr);
+  }
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&threadsLock, NULL);
+  pthread_mutex_init(&directoriesLock, NULL);
+  listingVersions = 0;
+}
+
+LocalFileSystem::~LocalFileSystem()
+{
+  for (int i = 0; i < INODE_STRIPES; i++)
+  {
+    pthread_rwlock_destroy(&inodeStripes[i]);
+  }
+  pthread_mutex_destroy(&threadsLock);
+  pthread_mutex_destroy(&directoriesLock);
+}
+
+LocalFileSystem::ThreadLocks *LocalFileSystem::threadLocks()
+{
+  pthread_mutex_lock(&threadsLock);
+  ThreadLocks *held = &threads[pthread_self()];
+  pthread_mutex_unlock(&threadsLock);
+  return held;
+}
+
+void LocalFileSystem::waitForEnd(ThreadLocks *held)
+{
+  if (!held->waitingForEnd)
+  {
+    held->waitingForEnd = true;
+    disk->atEnd([this](bool committed)
+                { endTransaction(committed); });
+  }
+}
+
+int LocalFileSystem::lockInode(int inodeNumber, bool exclusive)
+{
+  if (inodeNumber < 0)
+  {
+    return -EINVALIDINODE;
+  }
+
+  ThreadLocks *held = threadLocks();
+  if (held->owned.count(inodeNumber) > 0)
+  {
+    // nobody else can reach it yet
+    return 0;
+  }
+
+  int stripe = inodeNumber % INODE_STRIPES;
+  map<int, HeldStripe>::iterator found = held->stripes.find(stripe);
+  if (found != held->stripes.end())
+  {
+    if (exclusive && !found->second.exclusive)
+    {
+      // upgrading could deadlock against another thread doing the same
+      return -ERETRY;
+    }
+    found->second.depth++;
+    return 0;
+  }
+
+  pthread_rwlock_t *lock = &inodeStripes[stripe];
+  if (held->stripes.empty())
+  {
+    if (exclusive)
+    {
+      pthread_rwlock_wrlock(lock);
+    }
+    else
+    {
+      pthread_rwlock_rdlock(lock);
+    }
+  }
+  else
+  {
+    // Already holding a stripe, so waiting here could close a cycle
+    // with a thread that holds this one and wants ours
+    long waited = 0;
+    while ((exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) != 0)
+    {
+      if (waited >= LOCK_WAIT_MICROS)
+      {
+        return -ERETRY;
+      }
+      usleep(1000);
+      waited += 1000;
+    }
+  }
+
+  HeldStripe stripeHeld = {exclusive, 1};
+  held->stripes[stripe] = stripeHeld;
+  if (exclusive && disk->inTransaction())
+  {
+    waitForEnd(held);
+  }
+  return 0;
+}
+
+void LocalFileSystem::unlockInode(int inodeNumber)
+{
+  ThreadLocks *held = threadLocks();
+  if (held->owned.count(inodeNumber) > 0)
+  {
+    return;
+  }
+
+  int stripe = inodeNumber % INODE_STRIPES;
+  map<int, HeldStripe>::iterator found = held->stripes.find(stripe);
+  if (found == held->stripes.end() || --found->second.depth > 0)
+  {
+    return;
+  }
+  if (found->second.exclusive && disk->inTransaction())
+  {
+    // changes stay locked until the transaction ends
+    return;
+  }
+
+  pthread_rwlock_unlock(&inodeStripes[stripe]);
+  held->stripes.erase(found);
+  if (held->stripes.empty() && !held->waitingForEnd)
+  {
+    pthread_mutex_lock(&threadsLock);
+    threads.erase(pthread_self());
+    pthread_mutex_unlock(&threadsLock);
+  }
+}
+
+void LocalFileSystem::endTransaction(bool committed)
+{
+  ThreadLocks *held = threadLocks();
+
+  // Disk has already closed the transaction, so these go straight out
+  if (committed)
+  {
+    for (size_t i = 0; i < held->pendingFrees.size(); i++)
+    {
+      clearBit(held->pendingFrees[i].first, held->pendingFrees[i].second);
+    }
+  }
+  else
+  {
+    // the transaction may have listed what it changed before backing out
+    set<int>::iterator dir;
+    for (dir = held->changedDirectories.begin(); dir != held->changedDirectories.end(); dir++)
+    {
+      directoryChanged(*dir);
+    }
+  }
+
+  map<int, HeldStripe>::iterator iter;
+  for (iter = held->stripes.begin(); iter != held->stripes.end(); iter++)
+  {
+    pthread_rwlock_unlock(&inodeStripes[iter->first]);
+  }
+
+  pthread_mutex_lock(&threadsLock);
+  threads.erase(pthread_self());
+  pthread_mutex_unlock(&threadsLock);
+}
+
+void LocalFileSystem::own(int inodeNumber)
+{
+  if (disk->inTransaction())
+  {
+    ThreadLocks *held = threadLocks();
+    held->owned.insert(inodeNumber);
+    waitForEnd(held);
+  }
+}
+
+void LocalFileSystem::directoryChanged(int inodeNumber)
+{
+  pthread_mutex_lock(&directoriesLock);
+  CachedDirectory &cached = directories[inodeNumber];
+  cached.changes++;
+  cached.listing.reset();
+  pthread_mutex_unlock(&directoriesLock);
+
+  if (disk->inTransaction())
+  {
+    ThreadLocks *held = threadLocks();
+    held->changedDirectories.insert(inodeNumber);
+    waitForEnd(held);
+  }
+}
+
+void LocalFileSystem::forgetCachedDirectories()
+{
+  pthread_mutex_lock(&directoriesLock);
+  map<int, CachedDirectory>::iterator iter;
+  for (iter = directories.begin(); iter != directories.end(); iter++)
+  {
+    iter->second.changes++;
+    iter->second.listing.reset();
+  }
+  pthread_mutex_unlock(&directoriesLock);
+}
+
+bool LocalFileSystem::isAllocated(super_t *super, int inodeNumber)
+{
+  int bitsPerBlock = UFS_BLOCK_SIZE * 8;
+  unsigned char block[UFS_BLOCK_SIZE];
+  disk->readBlock(super->inode_bitmap_addr + inodeNumber / bitsPerBlock, block);
+  int bit = inodeNumber % bitsPerBlock;
+  return block[bit / 8] & (1 << (bit % 8));
+}
+
+void LocalFileSystem::writeInode(super_t *super, int inodeNumber, inode_t *inode)
+{
+  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
+  int blockNumber = super->inode_region_addr + inodeNumber / inodesPerBlock;
+  unsigned char block[UFS_BLOCK_SIZE];
+
+  // other threads write their own inodes in the same block
+  disk->lockBlock(blockNumber);
+  disk->readBlock(blockNumber, block);
+  memcpy(block + (inodeNumber % inodesPerBlock) * sizeof(inode_t), inode, sizeof(inode_t));
+  disk->writeBlock(blockNumber, block);
+  disk->unlockBlock(blockNumber);
+}
+
+int LocalFileSystem::allocateBit(int bitmapAddr, int bitmapLen, int bits)
+{
+  int bitsPerBlock = UFS_BLOCK_SIZE * 8;
+  unsigned char block[UFS_BLOCK_SIZE];
+  for (int blockIndex = 0; blockIndex < bitmapLen; blockIndex++)
+  {
+    disk->lockBlock(bitmapAddr + blockIndex);
+    disk->readBlock(bitmapAddr + blockIndex, block);
+    for (int i = 0; i < bitsPerBlock && blockIndex * bitsPerBlock + i < bits; i++)
+    {
+      if (!(block[i / 8] & (1 << (i % 8))))
+      {
+        block[i / 8] |= (1 << (i % 8));
+        disk->writeBlock(bitmapAddr + blockIndex, block);
+        disk->unlockBlock(bitmapAddr + blockIndex);
+        return blockIndex * bitsPerBlock + i;
+      }
+    }
+    disk->unlockBlock(bitmapAddr + blockIndex);
+  }
+  return -1;
+}
+
+void LocalFileSystem::freeBit(int bitmapAddr, int bit)
+{
+  int bitsPerBlock = UFS_BLOCK_SIZE * 8;
+  int bitmapBlock = bitmapAddr + bit / bitsPerBlock;
+  if (disk->inTransaction())
+  {
+    // if it were free now another transaction could take it, and then
+    // rolling this one back would hand it out twice
+    ThreadLocks *held = threadLocks();
+    held->pendingFrees.push_back(make_pair(bitmapBlock, bit % bitsPerBlock));
+    waitForEnd(held);
+    return;
+  }
+  clearBit(bitmapBlock, bit % bitsPerBlock);
+}
+
+void LocalFileSystem::clearBit(int bitmapBlock, int bit)
+{
+  unsigned char block[UFS_BLOCK_SIZE];
+  disk->lockBlock(bitmapBlock);
+  disk->readBlock(bitmapBlock, block);
+  block[bit / 8] &= ~(1 << (bit % 8));
+  disk->writeBlock(bitmapBlock, block);
+  disk->unlockBlock(bitmapBlock);
 }
 
 void LocalFileSystem::readSuperBlock(super_t *super)
@@ -73,23 +395,71 @@ void LocalFileSystem::writeInodeRegion(super_t *super, inode_t *inodes)
   }
 }
 
+bool LocalFileSystem::isBelow(super_t *super, int inodeNumber, int directory)
+{
+  // a damaged image could have a loop of ".." entries, and no path is
+  // longer than there are inodes
+  for (int depth = 0; depth < super->num_inodes && inodeNumber != UFS_ROOT_DIRECTORY_INODE_NUMBER; depth++)
+  {
+    inodeNumber = lookup(inodeNumber, "..");
+    if (inodeNumber < 0)
+    {
+      return false;
+    }
+    if (inodeNumber == directory)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 int LocalFileSystem::lookup(int parentInodeNumber, string entryName)
 {
+  InodeLocks locks(this);
+  int ret = locks.shared(parentInodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
+
   // Read the superblock to get filesystem metadata
   super_t superBlock;
   inode_t parant_node;
   readSuperBlock(&superBlock);
 
+  // Fetch the inode for the parent directory
+  if (stat(parentInodeNumber, &parant_node) != 0)
+  {
+    return -EINVALIDINODE; // Invalid parent inode
+  }
+
   // Ensure the parent inode is a directory
   if (parant_node.type != UFS_DIRECTORY)
   {
     return -EINVALIDINODE; // Not a directory
   }
 
-  // Fetch the inode for the parent directory
-  if (stat(parentInodeNumber, &parant_node) != 0)
+  // A cached listing has everything but `.` and `..`
+  shared_ptr<const DirectoryListing> listing;
+  pthread_mutex_lock(&directoriesLock);
+  map<int, CachedDirectory>::iterator cached = directories.find(parentInodeNumber);
+  if (cached != directories.end())
   {
-    return -EINVALIDINODE; // Invalid parent inode
+    listing = cached->second.listing;
+  }
+  pthread_mutex_unlock(&directoriesLock);
+  if (listing && entryName != "." && entryName != "..")
+  {
+    vector<DirectoryEntry>::const_iterator found = lower_bound(
+        listing->entries.begin(), listing->entries.end(), entryName,
+        [](const DirectoryEntry &entry, const string &name)
+        { return entry.name < name; });
+    if (found != listing->entries.end() && found->name == entryName)
+    {
+      return found->inodeNumber;
+    }
+    return -ENOTFOUND;
   }
 
   // Read all directory entries from the parent inode
@@ -126,6 +496,13 @@ int LocalFileSystem::stat(int inodeID, inode_t *inodeData)
     return -EINVALIDINODE; // Invalid inode ID
   }
 
+  InodeLocks locks(this);
+  int ret = locks.shared(inodeID);
+  if (ret < 0)
+  {
+    return ret;
+  }
+
   // Step 3: Compute block and offset for the inode
   int inodeEntriesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
   int containingBlock = superBlock.inode_region_addr + (inodeID / inodeEntriesPerBlock);
@@ -149,29 +526,42 @@ int LocalFileSystem::stat(int inodeID, inode_t *inodeData)
 
 int LocalFileSystem::read(int inodeNumber, void *buffer, int size)
 {
-  // Step 1: Validate the requested size
-  if (size < 0)
+  return readAt(inodeNumber, buffer, 0, size);
+}
+
+int LocalFileSystem::readAt(int inodeNumber, void *buffer, int offset, int size)
+{
+  // Step 1: Validate the requested size and offset
+  if (size < 0 || offset < 0)
   {
     return -EINVALIDSIZE; // Invalid size
   }
 
-  // Step 2: Read the superblock to get file system layout information
-  super_t super;
-  readSuperBlock(&super);
+  InodeLocks locks(this);
+  int ret = locks.shared(inodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
 
-  // Step 3: Read the inode
+  // Step 2: Read the inode
   inode_t inode;
   if (stat(inodeNumber, &inode) != 0)
   {
     return -EINVALIDINODE; // Invalid inode
   }
 
-  // Step 4: Validate the requested size does not exceed the file size
-  int bytesToRead = min(size, inode.size);
+  // Step 3: Clamp the request to the end of the file
+  if (offset >= inode.size)
+  {
+    return 0;
+  }
+  int bytesToRead = min(size, inode.size - offset);
 
-  // Step 5: Read data blocks
+  // Step 4: Read data blocks, starting part way into the first one
   int bytesRead = 0;
-  int blockIndex = 0;
+  int blockIndex = offset / UFS_BLOCK_SIZE;
+  int blockOffset = offset % UFS_BLOCK_SIZE;
   vector<char> blockBuffer(UFS_BLOCK_SIZE);
 
   while (bytesRead < bytesToRead && blockIndex < DIRECT_PTRS)
@@ -186,67 +576,177 @@ int LocalFileSystem::read(int inodeNumber, void *buffer, int size)
     disk->readBlock(inode.direct[blockIndex], blockBuffer.data());
 
     // Calculate how many bytes to copy from this block
-    int bytesInBlock = min(UFS_BLOCK_SIZE, bytesToRead - bytesRead);
-    memcpy(static_cast<char *>(buffer) + bytesRead, blockBuffer.data(), bytesInBlock);
+    int bytesInBlock = min(UFS_BLOCK_SIZE - blockOffset, bytesToRead - bytesRead);
+    memcpy(static_cast<char *>(buffer) + bytesRead, blockBuffer.data() + blockOffset, bytesInBlock);
 
     bytesRead += bytesInBlock;
     blockIndex++;
+    blockOffset = 0;
   }
 
   return bytesRead; // Return the number of bytes read
 }
 
-int LocalFileSystem::create(int parentInodeNumber, int type, std::string name)
+int LocalFileSystem::listDirectory(int inodeNumber, shared_ptr<const DirectoryListing> *listing)
 {
-  super_t super;
-  readSuperBlock(&super);
+  uint64_t changes;
+  vector<char> directoryBuffer;
+  {
+    InodeLocks locks(this);
+    int ret = locks.shared(inodeNumber);
+    if (ret < 0)
+    {
+      return ret;
+    }
 
-  // Validate parent inode
-  inode_t parentInode;
-  if (stat(parentInodeNumber, &parentInode) != 0 || parentInode.type != UFS_DIRECTORY)
+    inode_t inode;
+    if (stat(inodeNumber, &inode) != 0 || inode.type != UFS_DIRECTORY)
+    {
+      return -EINVALIDINODE;
+    }
+
+    pthread_mutex_lock(&directoriesLock);
+    CachedDirectory &cached = directories[inodeNumber];
+    changes = cached.changes;
+    *listing = cached.listing;
+    pthread_mutex_unlock(&directoriesLock);
+    if (*listing)
+    {
+      return 0;
+    }
+
+    directoryBuffer.resize(inode.size);
+    if (read(inodeNumber, directoryBuffer.data(), inode.size) != inode.size)
+    {
+      return -EINVALIDINODE;
+    }
+  }
+
+  // The children are looked at with the directory unlocked, so a
+  // change to it in the meantime means this listing isn't kept
+  shared_ptr<DirectoryListing> fresh = make_shared<DirectoryListing>();
+  dir_ent_t *dirEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
+  for (int i = 0; i < (int)(directoryBuffer.size() / sizeof(dir_ent_t)); ++i)
   {
-    return -EINVALIDINODE;
+    string name(dirEntries[i].name, strnlen(dirEntries[i].name, DIR_ENT_NAME_SIZE));
+    if (dirEntries[i].inum < 0 || name == "." || name == "..")
+    {
+      continue;
+    }
+    inode_t child;
+    int ret = stat(dirEntries[i].inum, &child);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    DirectoryEntry entry = {name, dirEntries[i].inum, child.type};
+    fresh->entries.push_back(entry);
+  }
+  sort(fresh->entries.begin(), fresh->entries.end(),
+       [](const DirectoryEntry &a, const DirectoryEntry &b)
+       { return a.name < b.name; });
+
+  pthread_mutex_lock(&directoriesLock);
+  fresh->version = ++listingVersions;
+  CachedDirectory &cached = directories[inodeNumber];
+  if (cached.changes == changes)
+  {
+    cached.listing = fresh;
   }
+  pthread_mutex_unlock(&directoriesLock);
 
-  // Validate name
-  if (name.length() >= DIR_ENT_NAME_SIZE || name.find_first_of(":/*?\"<>|") != std::string::npos)
+  *listing = fresh;
+  return 0;
+}
+
+int LocalFileSystem::pinInode(int inodeNumber)
+{
+  super_t super;
+  readSuperBlock(&super);
+  if (inodeNumber < 0 || inodeNumber >= super.num_inodes)
   {
-    return -EINVALIDNAME;
+    return -EINVALIDINODE;
   }
+  return lockInode(inodeNumber, false);
+}
+
+void LocalFileSystem::unpinInode(int inodeNumber)
+{
+  unlockInode(inodeNumber);
+}
 
-  // Check if name already exists
+int LocalFileSystem::create(int parentInodeNumber, int type, std::string name)
+{
+  super_t super;
+  readSuperBlock(&super);
+
+  // Most creates along a path find the entry already there, so look
+  // for it under a shared lock before locking the parent exclusively
   int existingInode = lookup(parentInodeNumber, name);
-  if (existingInode >= 0)
+  if (existingInode == -ENOTFOUND)
   {
-    inode_t existingInodeData;
-    stat(existingInode, &existingInodeData);
-    if (existingInodeData.type == type)
+    InodeLocks locks(this);
+    int ret = locks.exclusive(parentInodeNumber);
+    if (ret < 0)
     {
-      return existingInode;
+      return ret;
     }
-    return -EINVALIDTYPE;
-  }
 
-  // Allocate new inode
-  unsigned char inodeBitmap[super.inode_bitmap_len * UFS_BLOCK_SIZE];
-  readInodeBitmap(&super, inodeBitmap);
+    // Validate parent inode
+    inode_t parentInode;
+    if (stat(parentInodeNumber, &parentInode) != 0 || parentInode.type != UFS_DIRECTORY ||
+        !isAllocated(&super, parentInodeNumber))
+    {
+      return -EINVALIDINODE;
+    }
 
-  int newInodeNumber = -1;
-  for (int i = 0; i < super.num_inodes; ++i)
-  {
-    if (!(inodeBitmap[i / 8] & (1 << (i % 8))))
+    // Validate name
+    if (name.length() >= DIR_ENT_NAME_SIZE || name.find_first_of(":/*?\"<>|") != std::string::npos)
     {
-      newInodeNumber = i;
-      inodeBitmap[i / 8] |= (1 << (i % 8));
-      break;
+      return -EINVALIDNAME;
+    }
+
+    // Someone may have added it while we waited for the lock
+    existingInode = lookup(parentInodeNumber, name);
+    if (existingInode == -ENOTFOUND)
+    {
+      return addEntry(&super, parentInodeNumber, &parentInode, type, name);
     }
   }
-  if (newInodeNumber == -1)
+  if (existingInode < 0)
+  {
+    return existingInode;
+  }
+
+  // It exists, which is fine as long as it's the same type
+  inode_t existingInodeData;
+  int ret = stat(existingInode, &existingInodeData);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  if (existingInodeData.type == type)
+  {
+    return existingInode;
+  }
+  return -EINVALIDTYPE;
+}
+
+int LocalFileSystem::addEntry(super_t *super, int parentInodeNumber, inode_t *parentInode, int type, string name)
+{
+  // New entries go in the parent's first data block, make sure it has room
+  if (parentInode->size + (int)sizeof(dir_ent_t) > UFS_BLOCK_SIZE)
   {
     return -ENOTENOUGHSPACE;
   }
 
-  writeInodeBitmap(&super, inodeBitmap);
+  // Allocate new inode
+  int newInodeNumber = allocateBit(super->inode_bitmap_addr, super->inode_bitmap_len, super->num_inodes);
+  if (newInodeNumber == -1)
+  {
+    return -ENOTENOUGHSPACE;
+  }
+  own(newInodeNumber);
 
   // Initialize new inode
   inode_t newInode = {};
@@ -263,57 +763,44 @@ int LocalFileSystem::create(int parentInodeNumber, int type, std::string name)
   if (type == UFS_DIRECTORY)
   {
     // Allocate data block and initialize `.` and `..`
-    unsigned char dataBitmap[super.data_bitmap_len * UFS_BLOCK_SIZE];
-    readDataBitmap(&super, dataBitmap);
-
-    int freeBlock = -1;
-    for (int i = 0; i < super.num_data; ++i)
-    {
-      if (!(dataBitmap[i / 8] & (1 << (i % 8))))
-      {
-        freeBlock = i;
-        dataBitmap[i / 8] |= (1 << (i % 8));
-        break;
-      }
-    }
+    int freeBlock = allocateBit(super->data_bitmap_addr, super->data_bitmap_len, super->num_data);
     if (freeBlock == -1)
     {
+      freeBit(super->inode_bitmap_addr, newInodeNumber);
       return -ENOTENOUGHSPACE;
     }
 
-    writeDataBitmap(&super, dataBitmap);
-
     dir_ent_t entries[2] = {
         {".", newInodeNumber},
         {"..", parentInodeNumber}};
 
     char newDirBlock[UFS_BLOCK_SIZE] = {0};
     memcpy(newDirBlock, entries, sizeof(entries));
-    disk->writeBlock(super.data_region_addr + freeBlock, newDirBlock);
+    disk->writeBlock(super->data_region_addr + freeBlock, newDirBlock);
 
-    newInode.direct[0] = super.data_region_addr + freeBlock;
+    newInode.direct[0] = super->data_region_addr + freeBlock;
   }
 
-  inode_t inodes[super.inode_region_len * UFS_BLOCK_SIZE / sizeof(inode_t)];
-  readInodeRegion(&super, inodes);
-  inodes[newInodeNumber] = newInode;
-  writeInodeRegion(&super, inodes);
+  writeInode(super, newInodeNumber, &newInode);
+  appendEntry(super, parentInodeNumber, parentInode, newInodeNumber, name);
 
-  // Add entry to parent directory
+  return newInodeNumber;
+}
+
+void LocalFileSystem::appendEntry(super_t *super, int parentInodeNumber, inode_t *parentInode, int inodeNumber, string name)
+{
   dir_ent_t newEntry = {};
   strncpy(newEntry.name, name.c_str(), DIR_ENT_NAME_SIZE - 1);
-  newEntry.inum = newInodeNumber;
+  newEntry.inum = inodeNumber;
 
   char parentDirBlock[UFS_BLOCK_SIZE];
-  disk->readBlock(parentInode.direct[0], parentDirBlock);
-  memcpy(parentDirBlock + parentInode.size, &newEntry, sizeof(newEntry));
-  disk->writeBlock(parentInode.direct[0], parentDirBlock);
-
-  parentInode.size += sizeof(dir_ent_t);
-  inodes[parentInodeNumber] = parentInode;
-  writeInodeRegion(&super, inodes);
+  disk->readBlock(parentInode->direct[0], parentDirBlock);
+  memcpy(parentDirBlock + parentInode->size, &newEntry, sizeof(newEntry));
+  disk->writeBlock(parentInode->direct[0], parentDirBlock);
+  directoryChanged(parentInodeNumber);
 
-  return newInodeNumber;
+  parentInode->size += sizeof(dir_ent_t);
+  writeInode(super, parentInodeNumber, parentInode);
 }
 
 int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
@@ -332,22 +819,24 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
     return -EINVALIDINODE;
   }
 
-  // Load the inode bitmap and validate that the inode is allocated
-  unsigned char inode_bitmap[super.inode_bitmap_len * UFS_BLOCK_SIZE];
-  readInodeBitmap(&super, inode_bitmap);
+  InodeLocks locks(this);
+  int ret = locks.exclusive(inodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
 
-  int offset = inodeNumber % 8;
-  int bitmap_byte = inodeNumber / 8;
-  if (!(inode_bitmap[bitmap_byte] & (0b1 << offset)))
+  // Validate that the inode is allocated and is a file
+  if (!isAllocated(&super, inodeNumber))
   {
     return -ENOTALLOCATED;
   }
 
-  // Load inodes and validate the inode type
-  inode_t inodes[super.inode_region_len * UFS_BLOCK_SIZE / sizeof(inode_t)];
-  readInodeRegion(&super, inodes);
-  inode_t &inode = inodes[inodeNumber];
-
+  inode_t inode;
+  if (stat(inodeNumber, &inode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
   if (inode.type != UFS_REGULAR_FILE)
   {
     return -EWRITETODIR; // Cannot write to directories
@@ -363,27 +852,17 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
     return -EINVALIDSIZE; // File size exceeds maximum allowed
   }
 
-  // Load the data bitmap
-  unsigned char data_bitmap[super.data_bitmap_len * UFS_BLOCK_SIZE];
-  readDataBitmap(&super, data_bitmap);
-
   // Allocate additional blocks if needed
   for (int i = current_blocks; i < required_blocks; ++i)
   {
-    int free_block = -1;
-    for (int j = 0; j < super.num_data; ++j)
+    int free_block = allocateBit(super.data_bitmap_addr, super.data_bitmap_len, super.num_data);
+    if (free_block == -1)
     {
-      int byte_idx = j / 8;
-      int bit_idx = j % 8;
-      if (!(data_bitmap[byte_idx] & (0b1 << bit_idx)))
+      // give back what we took so far
+      for (int j = current_blocks; j < i; ++j)
       {
-        free_block = j;
-        data_bitmap[byte_idx] |= (0b1 << bit_idx); // Mark block as allocated
-        break;
+        freeBit(super.data_bitmap_addr, inode.direct[j] - super.data_region_addr);
       }
-    }
-    if (free_block == -1)
-    {
       return -ENOTENOUGHSPACE; // Not enough space to allocate blocks
     }
     inode.direct[i] = super.data_region_addr + free_block;
@@ -392,16 +871,10 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
   // Deallocate unused blocks if reducing the file size
   for (int i = required_blocks; i < current_blocks; ++i)
   {
-    int relative_block = inode.direct[i] - super.data_region_addr;
-    int byte_idx = relative_block / 8;
-    int bit_idx = relative_block % 8;
-    data_bitmap[byte_idx] &= ~(0b1 << bit_idx); // Mark block as free
+    freeBit(super.data_bitmap_addr, inode.direct[i] - super.data_region_addr);
     inode.direct[i] = 0;
   }
 
-  // Write the updated data bitmap back to disk
-  writeDataBitmap(&super, data_bitmap);
-
   // Write data to allocated blocks
   const char *data_ptr = static_cast<const char *>(buffer);
   int bytes_written = 0;
@@ -418,7 +891,7 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
 
   // Update the inode's size
   inode.size = size;
-  writeInodeRegion(&super, inodes);
+  writeInode(&super, inodeNumber, &inode);
 
   // Return the number of bytes written
   return bytes_written;
@@ -426,5 +899,314 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
 
 int LocalFileSystem::unlink(int parentInodeNumber, string name)
 {
+  super_t super;
+  readSuperBlock(&super);
+
+  // Parent first, then the child, then the bitmaps
+  InodeLocks locks(this);
+  int ret = locks.exclusive(parentInodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  // Validate parent inode
+  inode_t parentInode;
+  if (stat(parentInodeNumber, &parentInode) != 0 || parentInode.type != UFS_DIRECTORY ||
+      !isAllocated(&super, parentInodeNumber))
+  {
+    return -EINVALIDINODE;
+  }
+
+  // Validate name
+  if (name == "." || name == "..")
+  {
+    return -EUNLINKNOTALLOWED;
+  }
+  if (name.empty() || name.length() >= DIR_ENT_NAME_SIZE)
+  {
+    return -EINVALIDNAME;
+  }
+
+  // Find the entry; a name that isn't there is already unlinked
+  vector<char> directoryBuffer(parentInode.size);
+  if (read(parentInodeNumber, directoryBuffer.data(), parentInode.size) != parentInode.size)
+  {
+    return -EINVALIDINODE;
+  }
+  int entriesCount = parentInode.size / sizeof(dir_ent_t);
+  dir_ent_t *dirEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
+  int entryIndex = -1;
+  for (int i = 0; i < entriesCount; ++i)
+  {
+    if (dirEntries[i].inum != -1 && name == dirEntries[i].name)
+    {
+      entryIndex = i;
+      break;
+    }
+  }
+  if (entryIndex < 0)
+  {
+    return 0;
+  }
+
+  int inodeNumber = dirEntries[entryIndex].inum;
+  ret = locks.exclusive(inodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  inode_t inode;
+  if (stat(inodeNumber, &inode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+
+  // Directories have to be empty apart from `.` and `..`
+  if (inode.type == UFS_DIRECTORY)
+  {
+    vector<char> childBuffer(inode.size);
+    if (read(inodeNumber, childBuffer.data(), inode.size) != inode.size)
+    {
+      return -EINVALIDINODE;
+    }
+    dir_ent_t *childEntries = reinterpret_cast<dir_ent_t *>(childBuffer.data());
+    for (int i = 0; i < inode.size / (int)sizeof(dir_ent_t); ++i)
+    {
+      if (childEntries[i].inum != -1 && strcmp(childEntries[i].name, ".") != 0 &&
+          strcmp(childEntries[i].name, "..") != 0)
+      {
+        return -EDIRNOTEMPTY;
+      }
+    }
+  }
+
+  // Free its data blocks and the inode itself
+  int blocks = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+  if (inode.type == UFS_DIRECTORY && blocks == 0)
+  {
+    blocks = 1;
+  }
+  for (int i = 0; i < blocks && i < DIRECT_PTRS; ++i)
+  {
+    freeBit(super.data_bitmap_addr, inode.direct[i] - super.data_region_addr);
+  }
+  freeBit(super.inode_bitmap_addr, inodeNumber);
+  if (inode.type == UFS_DIRECTORY)
+  {
+    // the inode number may come back as something else
+    directoryChanged(inodeNumber);
+  }
+
+  removeEntry(&super, parentInodeNumber, &parentInode, directoryBuffer, entryIndex);
+  return 0;
+}
+
+void LocalFileSystem::removeEntry(super_t *super, int parentInodeNumber, inode_t *parentInode,
+                                  vector<char> &directoryBuffer, int index)
+{
+  // Move the parent's last entry into the gap, then write back every
+  // block the directory used
+  dir_ent_t *dirEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
+  int entriesCount = parentInode->size / sizeof(dir_ent_t);
+  dirEntries[index] = dirEntries[entriesCount - 1];
+  directoryChanged(parentInodeNumber);
+  int newSize = parentInode->size - sizeof(dir_ent_t);
+  int parentBlocks = (parentInode->size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+  for (int i = 0; i < parentBlocks; ++i)
+  {
+    char block[UFS_BLOCK_SIZE] = {0};
+    int start = i * UFS_BLOCK_SIZE;
+    if (start < newSize)
+    {
+      memcpy(block, directoryBuffer.data() + start, min(UFS_BLOCK_SIZE, newSize - start));
+    }
+    disk->writeBlock(parentInode->direct[i], block);
+  }
+
+  // A block the directory no longer reaches into goes back to the pool
+  int newParentBlocks = (newSize + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+  if (newParentBlocks < parentBlocks && newParentBlocks > 0)
+  {
+    for (int i = newParentBlocks; i < parentBlocks; ++i)
+    {
+      freeBit(super->data_bitmap_addr, parentInode->direct[i] - super->data_region_addr);
+      parentInode->direct[i] = 0;
+    }
+  }
+
+  parentInode->size = newSize;
+  writeInode(super, parentInodeNumber, parentInode);
+}
+
+int LocalFileSystem::rename(int srcParentInodeNumber, string srcName, int dstParentInodeNumber, string dstName)
+{
+  super_t super;
+  readSuperBlock(&super);
+
+  // Validate names
+  if (srcName == "." || srcName == ".." || dstName == "." || dstName == "..")
+  {
+    return -EUNLINKNOTALLOWED;
+  }
+  if (srcName.empty() || srcName.length() >= DIR_ENT_NAME_SIZE || dstName.empty() ||
+      dstName.length() >= DIR_ENT_NAME_SIZE || dstName.find_first_of(":/*?\"<>|") != std::string::npos)
+  {
+    return -EINVALIDNAME;
+  }
+
+  // Both parents, then the entry itself. A parent inside the other
+  // comes second, as any child does; unrelated ones go by inode number.
+  // Another rename can move things about between this check and the
+  // locks, and then the short wait for the second one is what keeps it
+  // from deadlocking.
+  int firstParent = min(srcParentInodeNumber, dstParentInodeNumber);
+  int secondParent = max(srcParentInodeNumber, dstParentInodeNumber);
+  if (isBelow(&super, firstParent, secondParent))
+  {
+    swap(firstParent, secondParent);
+  }
+  InodeLocks locks(this);
+  int ret = locks.exclusive(firstParent);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  ret = locks.exclusive(secondParent);
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  // Validate parent inodes
+  inode_t srcParentInode, dstParentInode;
+  if (stat(srcParentInodeNumber, &srcParentInode) != 0 || srcParentInode.type != UFS_DIRECTORY ||
+      !isAllocated(&super, srcParentInodeNumber) ||
+      stat(dstParentInodeNumber, &dstParentInode) != 0 || dstParentInode.type != UFS_DIRECTORY ||
+      !isAllocated(&super, dstParentInodeNumber))
+  {
+    return -EINVALIDINODE;
+  }
+
+  int inodeNumber = lookup(srcParentInodeNumber, srcName);
+  if (inodeNumber < 0)
+  {
+    return inodeNumber;
+  }
+  ret = locks.exclusive(inodeNumber);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  inode_t inode;
+  if (stat(inodeNumber, &inode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+
+  int existingInode = lookup(dstParentInodeNumber, dstName);
+  if (existingInode == inodeNumber)
+  {
+    // Moving onto itself
+    return 0;
+  }
+  if (existingInode >= 0)
+  {
+    inode_t existingInodeData;
+    ret = stat(existingInode, &existingInodeData);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    if (existingInodeData.type != inode.type)
+    {
+      return -EINVALIDTYPE;
+    }
+  }
+  else if (existingInode != -ENOTFOUND)
+  {
+    return existingInode;
+  }
+
+  // Only a move to another directory adds an entry there
+  if (existingInode < 0 && srcParentInodeNumber != dstParentInodeNumber &&
+      dstParentInode.size + (int)sizeof(dir_ent_t) > UFS_BLOCK_SIZE)
+  {
+    return -ENOTENOUGHSPACE;
+  }
+
+  // A directory can't go anywhere below itself. Walking up from the
+  // destination is safe against other renames because the moved
+  // directory is locked first: one that changes the path we walk has
+  // to wait for us, or we for it
+  if (inode.type == UFS_DIRECTORY && srcParentInodeNumber != dstParentInodeNumber)
+  {
+    int ancestor = dstParentInodeNumber;
+    while (ancestor != UFS_ROOT_DIRECTORY_INODE_NUMBER)
+    {
+      if (ancestor == inodeNumber)
+      {
+        return -EINVALIDMOVE;
+      }
+      ancestor = lookup(ancestor, "..");
+      if (ancestor < 0)
+      {
+        return ancestor;
+      }
+    }
+  }
+
+  // Everything that can fail has been checked, so start changing things
+  if (existingInode >= 0)
+  {
+    ret = unlink(dstParentInodeNumber, dstName);
+    if (ret < 0)
+    {
+      return ret;
+    }
+  }
+
+  if (stat(srcParentInodeNumber, &srcParentInode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+  vector<char> directoryBuffer(srcParentInode.size);
+  if (read(srcParentInodeNumber, directoryBuffer.data(), srcParentInode.size) != srcParentInode.size)
+  {
+    return -EINVALIDINODE;
+  }
+  dir_ent_t *dirEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
+  int entriesCount = srcParentInode.size / sizeof(dir_ent_t);
+  for (int i = 0; i < entriesCount; ++i)
+  {
+    if (dirEntries[i].inum != -1 && srcName == dirEntries[i].name)
+    {
+      removeEntry(&super, srcParentInodeNumber, &srcParentInode, directoryBuffer, i);
+      break;
+    }
+  }
+
+  if (stat(dstParentInodeNumber, &dstParentInode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+  appendEntry(&super, dstParentInodeNumber, &dstParentInode, inodeNumber, dstName);
+
+  // A directory's `..` follows it to its new parent
+  if (inode.type == UFS_DIRECTORY && srcParentInodeNumber != dstParentInodeNumber)
+  {
+    char block[UFS_BLOCK_SIZE];
+    disk->readBlock(inode.direct[0], block);
+    dir_ent_t *entries = reinterpret_cast<dir_ent_t *>(block);
+    for (int i = 0; i < inode.size / (int)sizeof(dir_ent_t) && i < UFS_BLOCK_SIZE / (int)sizeof(dir_ent_t); ++i)
+    {
+      if (strcmp(entries[i].name, "..") == 0)
+      {
+        entries[i].inum = dstParentInodeNumber;
+      }
+    }
+    disk->writeBlock(inode.direct[0], block);
+  }
+
   return 0;
 }
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <sstream>
+#include <vector>
+
+#include "ReplicationService.h"
+#include "ClientError.h"
+
+using namespace std;
+
+// looks at every byte whatever the first difference, so the time an
+// answer takes doesn't tell how much of a guess was right
+static bool sameKey(string_view a, string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  unsigned char difference = 0;
+  for (size_t idx = 0; idx < a.size(); idx++) {
+    difference |= a[idx] ^ b[idx];
+  }
+  return difference == 0;
+}
+
+static long millisNow() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+ReplicationService::ReplicationService(Replicator *replicator) : HttpService("/replication/") {
+  this->replicator = replicator;
+  this->ds3 = NULL;
+  this->applied = 0;
+  this->primaryHead = 0;
+  this->lastApplied = 0;
+  pthread_mutex_init(&this->positionLock, NULL);
+}
+
+ReplicationService::ReplicationService(DistributedFileSystemService *ds3, string key) : HttpService("/replication/") {
+  this->replicator = NULL;
+  this->ds3 = ds3;
+  this->key = key;
+  this->applied = 0;
+  this->primaryHead = 0;
+  this->lastApplied = 0;
+  pthread_mutex_init(&this->positionLock, NULL);
+}
+
+ReplicationService::~ReplicationService() {
+  pthread_mutex_destroy(&positionLock);
+}
+
+string ReplicationService::position() {
+  return (epoch.empty() ? string("none") : epoch) + " " + to_string(applied) + "\n";
+}
+
+void ReplicationService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (replicator != NULL) {
+    response->setBody(replicator->status());
+    return;
+  }
+
+  pthread_mutex_lock(&positionLock);
+  stringstream out;
+  out << "replica " << position();
+  if (!epoch.empty()) {
+    out << "behind " << primaryHead - applied << " applied " << millisNow() - lastApplied << "ms ago\n";
+  }
+  pthread_mutex_unlock(&positionLock);
+  response->setBody(out.str());
+}
+
+void ReplicationService::post(HTTPRequest *request, HTTPResponse *response) {
+  if (ds3 == NULL) {
+    throw ClientError::methodNotAllowed();
+  }
+  // only the primary may change the image
+  string_view authorization = request->getHeaderView("Authorization");
+  if (authorization.substr(0, 7) != "Bearer " || !sameKey(authorization.substr(7), key)) {
+    throw ClientError::forbidden();
+  }
+
+  string_view value;
+  if (!request->findHeader("Replication-Epoch", &value)) {
+    throw ClientError::badRequest();
+  }
+  string batchEpoch(value);
+  uint64_t first = strtoull(string(request->getHeaderView("Replication-Sequence")).c_str(), NULL, 10);
+  uint64_t head = strtoull(string(request->getHeaderView("Replication-Head")).c_str(), NULL, 10);
+  if (first == 0) {
+    throw ClientError::badRequest();
+  }
+
+  vector<BlockDelta> deltas;
+  int entries = Replicator::decode(request->getBodyView(), &deltas);
+  if (entries < 0) {
+    throw ClientError::badRequest();
+  }
+
+  // batches are applied one at a time, in order
+  pthread_mutex_lock(&positionLock);
+  // before anything has been applied the image has to be where the
+  // primary started
+  bool follows = epoch.empty() ? first == 1 : (batchEpoch == epoch && first == applied + 1);
+  if (!follows) {
+    response->setStatus(409);
+    response->setBody(position());
+    pthread_mutex_unlock(&positionLock);
+    return;
+  }
+  if (!ds3->applyReplicated(deltas)) {
+    pthread_mutex_unlock(&positionLock);
+    throw ClientError::badRequest();
+  }
+  epoch = batchEpoch;
+  applied = first + entries - 1;
+  primaryHead = max(head, applied);
+  lastApplied = millisNow();
+  response->setBody(position());
+  pthread_mutex_unlock(&positionLock);
+}
@@ -0,0 +1,372 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "Replicator.h"
+#include "HttpClient.h"
+#include "HTTPClientResponse.h"
+#include "dthread.h"
+
+using namespace std;
+
+long Replicator::syncTimeoutMillis = 1000;
+
+thread_local uint64_t Replicator::s_lastCommitted = 0;
+
+static void appendWord(string *out, uint32_t value) {
+  value = htonl(value);
+  out->append((const char *) &value, sizeof(value));
+}
+
+static bool takeWord(string_view *in, uint32_t *value) {
+  if (in->size() < sizeof(*value)) {
+    return false;
+  }
+  memcpy(value, in->data(), sizeof(*value));
+  *value = ntohl(*value);
+  in->remove_prefix(sizeof(*value));
+  return true;
+}
+
+Replicator::Replicator(Disk *disk, const vector<string> &replicas, bool synchronous, string key) {
+  m_disk = disk;
+  m_epoch = to_string(time(NULL)) + "-" + to_string(getpid());
+  m_synchronous = synchronous;
+  m_key = key;
+  m_stopping = false;
+  m_logBytes = 0;
+  m_head = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+
+  for (size_t idx = 0; idx < replicas.size(); idx++) {
+    size_t colon = replicas[idx].rfind(':');
+    int port = colon == string::npos ? 0 : atoi(replicas[idx].c_str() + colon + 1);
+    if (colon == 0 || port <= 0) {
+      cerr << "replica " << replicas[idx] << " isn't host:port" << endl;
+      exit(1);
+    }
+    Replica *replica = new Replica();
+    replica->replicator = this;
+    replica->backend = new BackendConnector(replicas[idx].substr(0, colon), port);
+    replica->state = IN_SYNC;
+    replica->acked = 0;
+    m_replicas.push_back(replica);
+  }
+
+  m_disk->setCommitListener([this](const deque<struct UndoRecord> &changes) {
+    committed(changes);
+  });
+  for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+    dthread_create(&m_replicas[idx]->thread, NULL, ship, m_replicas[idx]);
+  }
+}
+
+Replicator::~Replicator() {
+  m_disk->setCommitListener(nullptr);
+  dthread_mutex_lock(&m_lock);
+  m_stopping = true;
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+
+  for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+    dthread_join(m_replicas[idx]->thread, NULL);
+    delete m_replicas[idx]->backend;
+    delete m_replicas[idx];
+  }
+  pthread_cond_destroy(&m_changed);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void Replicator::committed(const deque<struct UndoRecord> &changes) {
+  // what the commit did to each block, all its writes to it folded together
+  int blockSize = m_disk->getBlockSize();
+  map<int, string> blocks;
+  deque<struct UndoRecord>::const_iterator change;
+  for (change = changes.begin(); change != changes.end(); change++) {
+    string &block = blocks[change->blockNumber];
+    block.resize(blockSize);
+    for (int idx = 0; idx < blockSize; idx++) {
+      block[idx] ^= change->blockData[idx];
+    }
+  }
+
+  // only the span of each block that changed: "<block> <offset>
+  // <length>" as 32-bit words, then the bytes
+  string encoded;
+  for (map<int, string>::iterator block = blocks.begin(); block != blocks.end(); block++) {
+    size_t first = block->second.find_first_not_of('\0');
+    if (first == string::npos) {
+      continue;
+    }
+    size_t last = block->second.find_last_not_of('\0');
+    appendWord(&encoded, block->first);
+    appendWord(&encoded, first);
+    appendWord(&encoded, last - first + 1);
+    encoded.append(block->second, first, last - first + 1);
+  }
+  if (encoded.empty()) {
+    return;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  Entry entry;
+  entry.sequence = ++m_head;
+  entry.committedAt = now();
+  entry.changes = std::move(encoded);
+  m_logBytes += entry.changes.size();
+  m_log.push_back(std::move(entry));
+  s_lastCommitted = m_head;
+
+  // rather than grow without end, give up on whoever is furthest behind
+  while (m_logBytes > MAX_LOG_BYTES) {
+    Replica *slowest = NULL;
+    for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+      if (m_replicas[idx]->state != DIVERGED &&
+          (slowest == NULL || m_replicas[idx]->acked < slowest->acked)) {
+        slowest = m_replicas[idx];
+      }
+    }
+    if (slowest == NULL) {
+      break;
+    }
+    slowest->state = DIVERGED;
+    slowest->error = "fell too far behind";
+    trim();
+  }
+  trim();
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+}
+
+void Replicator::trim() {
+  // with no replica left to send to, the log only has to keep counting
+  uint64_t applied = m_head;
+  for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+    if (m_replicas[idx]->state != DIVERGED && m_replicas[idx]->acked < applied) {
+      applied = m_replicas[idx]->acked;
+    }
+  }
+  while (!m_log.empty() && m_log.front().sequence <= applied) {
+    m_logBytes -= m_log.front().changes.size();
+    m_log.pop_front();
+  }
+}
+
+void Replicator::waitForReplicas() {
+  uint64_t target = s_lastCommitted;
+  s_lastCommitted = 0;
+  if (!m_synchronous || target == 0) {
+    return;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  long deadline = realtime() + syncTimeoutMillis;
+  while (true) {
+    bool waiting = false;
+    for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+      if (m_replicas[idx]->state == IN_SYNC && m_replicas[idx]->acked < target) {
+        waiting = true;
+      }
+    }
+    if (!waiting) {
+      break;
+    }
+    if (!waitUntil(deadline)) {
+      // too slow to wait for, until they've caught up
+      for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+        if (m_replicas[idx]->state == IN_SYNC && m_replicas[idx]->acked < target) {
+          m_replicas[idx]->state = LAGGING;
+        }
+      }
+      break;
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+void *Replicator::ship(void *replica) {
+  ((Replica *) replica)->replicator->shipTo((Replica *) replica);
+  return NULL;
+}
+
+void Replicator::shipTo(Replica *replica) {
+  dthread_mutex_lock(&m_lock);
+  while (!m_stopping) {
+    if (replica->state == DIVERGED || replica->acked == m_head) {
+      dthread_cond_wait(&m_changed, &m_lock);
+      continue;
+    }
+
+    // every entry after the last one it has, up to MAX_BATCH_BYTES;
+    // each is its length as a 32-bit word and then its changes
+    uint64_t first = replica->acked + 1;
+    if (m_log.empty() || m_log.front().sequence > first) {
+      replica->state = DIVERGED;
+      replica->error = "the entries it needs are gone";
+      continue;
+    }
+    string batch;
+    for (size_t idx = first - m_log.front().sequence; idx < m_log.size(); idx++) {
+      if (!batch.empty() && batch.size() + m_log[idx].changes.size() > MAX_BATCH_BYTES) {
+        break;
+      }
+      appendWord(&batch, m_log[idx].changes.size());
+      batch.append(m_log[idx].changes);
+    }
+    uint64_t head = m_head;
+    dthread_mutex_unlock(&m_lock);
+
+    int status = 0;
+    string body;
+    string error;
+    try {
+      HttpClient client(replica->backend->connect(), replica->backend->name());
+      client.set_header("Authorization", "Bearer " + m_key);
+      client.set_header("Content-Type", "application/octet-stream");
+      client.set_header("Replication-Epoch", m_epoch);
+      client.set_header("Replication-Sequence", to_string(first));
+      client.set_header("Replication-Head", to_string(head));
+      HTTPClientResponse *response = client.post("/replication/", batch);
+      status = response->status();
+      body = response->body();
+      delete response;
+    } catch (runtime_error &e) {
+      error = e.what();
+    }
+
+    dthread_mutex_lock(&m_lock);
+    if (status == 0) {
+      replica->state = UNREACHABLE;
+      replica->error = error;
+    } else {
+      acknowledged(replica, status, body, first);
+    }
+    if (replica->state == UNREACHABLE) {
+      long deadline = realtime() + RETRY_MILLIS;
+      while (!m_stopping && waitUntil(deadline)) {
+      }
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+void Replicator::acknowledged(Replica *replica, int status, string body, uint64_t first) {
+  // both answers carry what the replica has applied, "<epoch> <sequence>"
+  istringstream fields(body);
+  string epoch;
+  uint64_t applied = 0;
+  bool positioned = (bool) (fields >> epoch >> applied);
+
+  if (status == 200 && positioned && epoch == m_epoch && applied >= first && applied <= m_head) {
+    replica->acked = applied;
+    replica->error.clear();
+    if (replica->acked == m_head) {
+      replica->state = IN_SYNC;
+    } else if (replica->state == UNREACHABLE) {
+      replica->state = LAGGING;
+    }
+    trim();
+    dthread_cond_broadcast(&m_changed);
+  } else if (status == 409 && positioned && epoch == m_epoch &&
+             !m_log.empty() && applied + 1 >= m_log.front().sequence && applied <= m_head) {
+    // it's somewhere else in this run's log, so carry on from there
+    replica->acked = applied;
+    replica->state = LAGGING;
+  } else if (status == 409) {
+    replica->state = DIVERGED;
+    replica->error = "its image didn't come from this run; copy the image again";
+    trim();
+  } else {
+    replica->state = UNREACHABLE;
+    replica->error = "status " + to_string(status);
+  }
+}
+
+string Replicator::status() {
+  dthread_mutex_lock(&m_lock);
+  stringstream out;
+  out << "primary " << m_epoch << " head " << m_head << " " << (m_synchronous ? "sync" : "async") << "\n";
+  for (size_t idx = 0; idx < m_replicas.size(); idx++) {
+    Replica *replica = m_replicas[idx];
+    out << replica->backend->name() << " " << stateName(replica->state) << " acked " << replica->acked;
+    if (replica->state != DIVERGED) {
+      // how long the oldest entry it doesn't have has been waiting
+      long lag = 0;
+      if (replica->acked < m_head && !m_log.empty()) {
+        lag = now() - m_log[replica->acked + 1 - m_log.front().sequence].committedAt;
+      }
+      out << " behind " << m_head - replica->acked << " lag " << lag << "ms";
+    }
+    if (!replica->error.empty()) {
+      out << " (" << replica->error << ")";
+    }
+    out << "\n";
+  }
+  dthread_mutex_unlock(&m_lock);
+  return out.str();
+}
+
+int Replicator::decode(string_view batch, vector<BlockDelta> *deltas) {
+  int entries = 0;
+  while (!batch.empty()) {
+    uint32_t length;
+    if (!takeWord(&batch, &length) || length > batch.size()) {
+      return -1;
+    }
+    string_view entry = batch.substr(0, length);
+    batch.remove_prefix(length);
+    while (!entry.empty()) {
+      uint32_t blockNumber, offset, size;
+      if (!takeWord(&entry, &blockNumber) || !takeWord(&entry, &offset) ||
+          !takeWord(&entry, &size) || size > entry.size()) {
+        return -1;
+      }
+      BlockDelta delta = {(int) blockNumber, (int) offset, entry.substr(0, size)};
+      deltas->push_back(delta);
+      entry.remove_prefix(size);
+    }
+    entries++;
+  }
+  return entries;
+}
+
+const char *Replicator::stateName(State state) {
+  switch (state) {
+  case IN_SYNC:
+    return "in-sync";
+  case LAGGING:
+    return "lagging";
+  case UNREACHABLE:
+    return "unreachable";
+  default:
+    return "diverged";
+  }
+}
+
+bool Replicator::waitUntil(long deadline) {
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000;
+  ts.tv_nsec = (deadline % 1000) * 1000000;
+  return dthread_cond_timedwait(&m_changed, &m_lock, &ts) != ETIMEDOUT;
+}
+
+long Replicator::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long Replicator::realtime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
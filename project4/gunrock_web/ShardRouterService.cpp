@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "ShardRouterService.h"
+#include "ClientError.h"
+#include "HttpClient.h"
+#include "HTTPClientResponse.h"
+#include "HttpUtils.h"
+#include "StringUtils.h"
+
+using namespace std;
+
+// how much of a backend's response is passed on per write
+static const int RELAY_BUFFER_SIZE = 64 * 1024;
+
+// headers that only describe the connection they arrived on; the
+// router sets its own for the hop to the backend
+static const char *HOP_BY_HOP_HEADERS[] = {
+  "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Upgrade",
+  "Content-Length", "Transfer-Encoding", NULL
+};
+
+static bool isHopByHop(string_view field) {
+  for (int idx = 0; HOP_BY_HOP_HEADERS[idx] != NULL; idx++) {
+    if (field.size() == strlen(HOP_BY_HOP_HEADERS[idx]) &&
+        strncasecmp(field.data(), HOP_BY_HOP_HEADERS[idx], field.size()) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ShardRouterService::ShardRouterService(const vector<string> &backends) : HttpService("/ds3/") {
+  for (size_t idx = 0; idx < backends.size(); idx++) {
+    size_t colon = backends[idx].rfind(':');
+    int port = colon == string::npos ? 0 : atoi(backends[idx].c_str() + colon + 1);
+    if (colon == 0 || port <= 0) {
+      cerr << "backend " << backends[idx] << " isn't host:port" << endl;
+      exit(1);
+    }
+    this->backends.push_back(new BackendConnector(backends[idx].substr(0, colon), port));
+  }
+  this->ring = new HashRing(backends);
+}
+
+ShardRouterService::~ShardRouterService() {
+  for (size_t idx = 0; idx < backends.size(); idx++) {
+    delete backends[idx];
+  }
+  delete ring;
+}
+
+bool ShardRouterService::streamsRequestBody(HTTPRequest *request) {
+  // file contents go to the backend as they arrive rather than being
+  // buffered here first
+  return request->isPut() || request->isPost();
+}
+
+string ShardRouterService::bucketOf(string_view path) {
+  size_t scheme = path.find("://");
+  if (scheme != string_view::npos) {
+    size_t slash = path.find('/', scheme + 3);
+    path = slash == string_view::npos ? string_view("/") : path.substr(slash);
+  }
+  size_t query = path.find_first_of("?#");
+  if (query != string_view::npos) {
+    path = path.substr(0, query);
+  }
+
+  // split the same way the backends do, so empty components are skipped
+  vector<string> components = StringUtils::split(string(path), '/');
+  if (components.empty() || components[0] != "ds3") {
+    throw ClientError::badRequest();
+  }
+  return components.size() > 1 ? components[1] : "";
+}
+
+BackendConnector *ShardRouterService::route(HTTPRequest *request) {
+  string bucket = bucketOf(request->getPathView());
+  if (bucket.empty()) {
+    throw ClientError::methodNotAllowed();
+  }
+  return backends[ring->find(bucket)];
+}
+
+void ShardRouterService::head(HTTPRequest *request, HTTPResponse *response) {
+  forward(request, response, route(request));
+}
+
+void ShardRouterService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (bucketOf(request->getPathView()).empty()) {
+    listBuckets(request, response);
+    return;
+  }
+  forward(request, response, route(request));
+}
+
+void ShardRouterService::put(HTTPRequest *request, HTTPResponse *response) {
+  forward(request, response, route(request));
+}
+
+void ShardRouterService::post(HTTPRequest *request, HTTPResponse *response) {
+  // a batch at the root could touch buckets on several backends, and
+  // there's no transaction that spans them
+  forward(request, response, route(request));
+}
+
+void ShardRouterService::del(HTTPRequest *request, HTTPResponse *response) {
+  forward(request, response, route(request));
+}
+
+void ShardRouterService::move(HTTPRequest *request, HTTPResponse *response) {
+  BackendConnector *backend = route(request);
+  string_view destination;
+  if (!request->findHeader("Destination", &destination)) {
+    throw ClientError::badRequest();
+  }
+  string bucket = bucketOf(destination);
+  if (!bucket.empty() && backends[ring->find(bucket)] != backend) {
+    throw ClientError::badGateway();
+  }
+  forward(request, response, backend);
+}
+
+void ShardRouterService::listBuckets(HTTPRequest *request, HTTPResponse *response) {
+  // every backend has its own root, so the entries are merged and any
+  // name that turns up on more than one is listed once
+  set<string> entries;
+  for (size_t idx = 0; idx < backends.size(); idx++) {
+    HTTPClientResponse *listing = NULL;
+    try {
+      HttpClient client(backends[idx]->connect(), backends[idx]->name());
+      listing = client.get("/ds3/");
+    } catch (runtime_error &e) {
+      throw ClientError::badGateway();
+    }
+    if (!listing->success()) {
+      delete listing;
+      throw ClientError::badGateway();
+    }
+    vector<string> lines = StringUtils::split(listing->body(), '\n');
+    entries.insert(lines.begin(), lines.end());
+    delete listing;
+  }
+
+  string body;
+  for (set<string>::iterator it = entries.begin(); it != entries.end(); it++) {
+    body += *it + "\n";
+  }
+  response->setBody(body);
+}
+
+void ShardRouterService::forward(HTTPRequest *request, HTTPResponse *response, BackendConnector *backend) {
+  MySocket *connection;
+  try {
+    connection = backend->connect();
+  } catch (SocketError &e) {
+    throw ClientError::badGateway();
+  }
+
+  try {
+    // the request line and headers as they came, apart from the ones
+    // about the client's connection
+    string header;
+    header += http_method_str((enum http_method) request->getMethod());
+    header += " " + request->getUrl() + " HTTP/1.1\r\n";
+    for (size_t idx = 0; idx < request->numHeaders(); idx++) {
+      string_view field = request->headerField(idx);
+      if (!isHopByHop(field)) {
+        header.append(field);
+        header += ": ";
+        header.append(request->headerValue(idx));
+        header += "\r\n";
+      }
+    }
+    header += "Connection: close\r\n";
+
+    // A backend can answer before it has read the whole body, when it
+    // turns the request down, so a failed write still goes on to read
+    // whatever it said.
+    try {
+      if (!streamsRequestBody(request)) {
+        string_view body = request->getBodyView();
+        if (!body.empty()) {
+          header += "Content-Length: " + to_string(body.size()) + "\r\n";
+        }
+        header += "\r\n";
+        connection->write(header);
+        if (!body.empty()) {
+          struct iovec iov = {(void *) body.data(), body.size()};
+          connection->writev(&iov, 1);
+        }
+      } else {
+        bool chunked = request->getContentLength() < 0;
+        if (chunked) {
+          header += "Transfer-Encoding: chunked\r\n\r\n";
+        } else {
+          header += "Content-Length: " + to_string(request->getContentLength()) + "\r\n\r\n";
+        }
+        connection->write(header);
+        // The sink runs inside the parser's C callbacks, which an
+        // exception mustn't unwind through, so a failed write only
+        // stops the copying and the rest of the body is read and
+        // dropped.
+        bool failed = false;
+        request->readBody([&](const char *data, size_t len) {
+          if (failed || len == 0) {
+            return;
+          }
+          try {
+            if (chunked) {
+              HttpUtils::writeChunk(connection, data, len);
+            } else {
+              struct iovec iov = {(void *) data, len};
+              connection->writev(&iov, 1);
+            }
+          } catch (runtime_error &e) {
+            failed = true;
+          }
+        });
+        if (chunked && !failed) {
+          HttpUtils::writeLastChunk(connection);
+        }
+      }
+    } catch (SocketWriteError &e) {
+      // nothing more to send; the response says why
+    }
+
+    // The backend closes the connection after its response, so copy
+    // bytes until it does. Nothing goes to the client until the status
+    // line is in, so a backend that fails first still gets a 502.
+    char *buffer = (char *) request->memory()->allocate(RELAY_BUFFER_SIZE);
+    int buffered = 0;
+    bool relayed = false;
+    while (true) {
+      int len;
+      try {
+        len = connection->read(buffer + buffered, RELAY_BUFFER_SIZE - buffered);
+      } catch (runtime_error &e) {
+        break;
+      }
+      buffered += len;
+      if (!relayed) {
+        size_t lineEnd = string_view(buffer, buffered).find("\r\n");
+        if (lineEnd == string_view::npos && buffered < RELAY_BUFFER_SIZE) {
+          continue;
+        }
+        // "HTTP/1.1 200 OK", only for the log
+        int status = buffered > 9 ? atoi(buffer + 9) : 0;
+        response->setRelayed(status > 0 ? status : 502);
+        relayed = true;
+      }
+      struct iovec iov = {buffer, (size_t) buffered};
+      request->getSocket()->writev(&iov, 1);
+      buffered = 0;
+    }
+    request->memory()->deallocate(buffer, RELAY_BUFFER_SIZE);
+    if (!relayed) {
+      throw ClientError::badGateway();
+    }
+  } catch (...) {
+    connection->close();
+    delete connection;
+    throw;
+  }
+  connection->close();
+  delete connection;
+}
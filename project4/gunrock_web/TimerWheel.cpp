@@ -0,0 +1,191 @@
+#include <time.h>
+
+#include "TimerWheel.h"
+
+using namespace std;
+
+Timer::Timer() {
+  m_wheel = NULL;
+  m_prev = NULL;
+  m_next = NULL;
+  m_expires = 0;
+  m_level = -1;
+  m_slot = -1;
+}
+
+Timer::~Timer() {
+  if (m_wheel != NULL) {
+    m_wheel->cancel(this);
+  }
+}
+
+bool Timer::isPending() {
+  return m_level >= 0;
+}
+
+TimerWheel::TimerWheel(long tickMillis) {
+  m_tickMillis = tickMillis > 0 ? tickMillis : 1;
+  m_current = now() / m_tickMillis;
+  for (int level = 0; level < LEVELS; level++) {
+    for (int slot = 0; slot < SLOTS; slot++) {
+      m_slots[level][slot] = NULL;
+    }
+  }
+  pthread_mutex_init(&m_lock, NULL);
+  m_running = false;
+}
+
+TimerWheel::~TimerWheel() {
+  pthread_mutex_lock(&m_lock);
+  bool running = m_running;
+  m_running = false;
+  pthread_mutex_unlock(&m_lock);
+  if (running) {
+    pthread_join(m_thread, NULL);
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+long TimerWheel::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::start() {
+  pthread_mutex_lock(&m_lock);
+  if (!m_running) {
+    m_running = true;
+    pthread_create(&m_thread, NULL, run, this);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void *TimerWheel::run(void *arg) {
+  TimerWheel *wheel = (TimerWheel *) arg;
+  struct timespec tick;
+  tick.tv_sec = wheel->m_tickMillis / 1000;
+  tick.tv_nsec = (wheel->m_tickMillis % 1000) * 1000000;
+
+  while (true) {
+    nanosleep(&tick, NULL);
+    pthread_mutex_lock(&wheel->m_lock);
+    if (!wheel->m_running) {
+      pthread_mutex_unlock(&wheel->m_lock);
+      break;
+    }
+    wheel->advance(now() / wheel->m_tickMillis);
+    pthread_mutex_unlock(&wheel->m_lock);
+  }
+  return NULL;
+}
+
+void TimerWheel::schedule(Timer *timer, long millis) {
+  long ticks = (millis + m_tickMillis - 1) / m_tickMillis;
+  pthread_mutex_lock(&m_lock);
+  if (timer->isPending()) {
+    unlink(timer);
+  }
+  timer->m_wheel = this;
+  // the tick in progress has already been processed
+  timer->m_expires = m_current + (ticks > 0 ? ticks : 1);
+  link(timer);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void TimerWheel::cancel(Timer *timer) {
+  pthread_mutex_lock(&m_lock);
+  if (timer->isPending()) {
+    unlink(timer);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void TimerWheel::link(Timer *timer) {
+  uint64_t delta = timer->m_expires > m_current ? timer->m_expires - m_current : 0;
+
+  // the lowest level whose span covers the deadline
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (uint64_t) 1 << (SLOT_BITS * (level + 1))) {
+    level++;
+  }
+  if (delta >= (uint64_t) 1 << (SLOT_BITS * LEVELS)) {
+    // further out than the wheel reaches, park it at the far end
+    timer->m_expires = m_current + ((uint64_t) 1 << (SLOT_BITS * LEVELS)) - 1;
+  } else if (delta == 0) {
+    timer->m_expires = m_current;
+  }
+
+  int slot = (timer->m_expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+  timer->m_level = level;
+  timer->m_slot = slot;
+  timer->m_prev = NULL;
+  timer->m_next = m_slots[level][slot];
+  if (timer->m_next != NULL) {
+    timer->m_next->m_prev = timer;
+  }
+  m_slots[level][slot] = timer;
+}
+
+void TimerWheel::unlink(Timer *timer) {
+  if (timer->m_prev != NULL) {
+    timer->m_prev->m_next = timer->m_next;
+  } else {
+    m_slots[timer->m_level][timer->m_slot] = timer->m_next;
+  }
+  if (timer->m_next != NULL) {
+    timer->m_next->m_prev = timer->m_prev;
+  }
+  timer->m_prev = NULL;
+  timer->m_next = NULL;
+  timer->m_level = -1;
+  timer->m_slot = -1;
+}
+
+void TimerWheel::cascade(int level) {
+  int slot = (m_current >> (SLOT_BITS * level)) & (SLOTS - 1);
+  Timer *timer = m_slots[level][slot];
+  m_slots[level][slot] = NULL;
+  while (timer != NULL) {
+    Timer *next = timer->m_next;
+    // everything here is now due within this level's granularity, so
+    // it lands on a lower level
+    link(timer);
+    timer = next;
+  }
+}
+
+void TimerWheel::advance(uint64_t tick) {
+  while (m_current < tick) {
+    m_current++;
+
+    // when a level wraps, bring the next slot of the level above down
+    if ((m_current & (SLOTS - 1)) == 0) {
+      for (int level = 1; level < LEVELS; level++) {
+        cascade(level);
+        if (((m_current >> (SLOT_BITS * level)) & (SLOTS - 1)) != 0) {
+          break;
+        }
+      }
+    }
+
+    int slot = m_current & (SLOTS - 1);
+    Timer *timer = m_slots[0][slot];
+    m_slots[0][slot] = NULL;
+    while (timer != NULL) {
+      Timer *next = timer->m_next;
+      timer->m_prev = NULL;
+      timer->m_next = NULL;
+      timer->m_level = -1;
+      timer->m_slot = -1;
+
+      long again = timer->expired();
+      if (again > 0) {
+        long ticks = (again + m_tickMillis - 1) / m_tickMillis;
+        timer->m_expires = m_current + ticks;
+        link(timer);
+      }
+      timer = next;
+    }
+  }
+}
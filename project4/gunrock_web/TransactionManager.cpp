@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "TransactionManager.h"
+
+using namespace std;
+
+TransactionManager::TransactionManager(Disk *disk) {
+  m_disk = disk;
+}
+
+void TransactionManager::run(function<void()> body) {
+  for (long backoff = 1000; ; backoff = min(backoff * 2, MAX_BACKOFF)) {
+    m_disk->beginTransaction();
+    try {
+      body();
+    } catch (TransactionConflict &e) {
+      m_disk->rollback();
+      // a random wait so the two sides don't collide again in lockstep
+      usleep(backoff / 2 + random() % (backoff / 2));
+      continue;
+    } catch (...) {
+      m_disk->rollback();
+      throw;
+    }
+    m_disk->commit();
+    return;
+  }
+}
+
+void TransactionManager::begin() {
+  m_disk->beginTransaction();
+}
+
+void TransactionManager::commit() {
+  m_disk->commit();
+}
+
+void TransactionManager::rollback() {
+  m_disk->rollback();
+}
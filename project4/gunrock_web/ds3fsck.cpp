@@ -0,0 +1,212 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+
+#include "LocalFileSystem.h"
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Checks a disk image for the kinds of damage a lost update or a bad
+// rollback would leave behind:
+//  - entries that point at free or out of range inodes, and inodes
+//    reachable by more than one path
+//  - directories whose `.` and `..` are wrong
+//  - blocks outside the data region, blocks used twice, and blocks a
+//    file uses that the data bitmap says are free
+//  - allocated inodes and blocks that nothing refers to
+// Prints one line per problem and exits with 1 if it found any.
+
+int problems = 0;
+
+void report(const string &problem)
+{
+  cout << problem << endl;
+  problems++;
+}
+
+bool isSet(const vector<unsigned char> &bitmap, int bit)
+{
+  return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    cerr << argv[0] << ": diskImageFile" << endl;
+    return 1;
+  }
+
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
+
+  super_t super;
+  fileSystem->readSuperBlock(&super);
+  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
+  if (super.num_inodes <= 0 || super.num_data <= 0 ||
+      super.inode_bitmap_len * UFS_BLOCK_SIZE * 8 < super.num_inodes ||
+      super.data_bitmap_len * UFS_BLOCK_SIZE * 8 < super.num_data ||
+      super.inode_region_len * inodesPerBlock < super.num_inodes ||
+      super.data_region_addr + super.num_data > disk->numberOfBlocks())
+  {
+    cout << "superblock doesn't fit the image" << endl;
+    return 1;
+  }
+
+  vector<unsigned char> inodeBitmap(super.inode_bitmap_len * UFS_BLOCK_SIZE);
+  fileSystem->readInodeBitmap(&super, inodeBitmap.data());
+  vector<unsigned char> dataBitmap(super.data_bitmap_len * UFS_BLOCK_SIZE);
+  fileSystem->readDataBitmap(&super, dataBitmap.data());
+
+  // the parent each inode was reached from, -1 for not yet
+  vector<int> reachedFrom(super.num_inodes, -1);
+  // the inode using each data block, -1 for none
+  vector<int> usedBy(super.num_data, -1);
+
+  // walk the tree from the root
+  vector<int> pending;
+  reachedFrom[UFS_ROOT_DIRECTORY_INODE_NUMBER] = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  pending.push_back(UFS_ROOT_DIRECTORY_INODE_NUMBER);
+
+  while (!pending.empty())
+  {
+    int inodeNumber = pending.back();
+    pending.pop_back();
+    string where = "inode " + to_string(inodeNumber);
+
+    inode_t inode;
+    if (!isSet(inodeBitmap, inodeNumber))
+    {
+      report(where + " is in use but free in the inode bitmap");
+    }
+    if (fileSystem->stat(inodeNumber, &inode) != 0)
+    {
+      report(where + " has an invalid type");
+      continue;
+    }
+    if (inode.size < 0 || inode.size > MAX_FILE_SIZE)
+    {
+      report(where + " has an invalid size " + to_string(inode.size));
+      continue;
+    }
+
+    // its blocks
+    int blocks = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    if (inode.type == UFS_DIRECTORY && blocks == 0)
+    {
+      blocks = 1;
+    }
+    for (int i = 0; i < blocks; i++)
+    {
+      int block = (int)inode.direct[i] - super.data_region_addr;
+      if (block < 0 || block >= super.num_data)
+      {
+        report(where + " points at block " + to_string(inode.direct[i]) + " outside the data region");
+        continue;
+      }
+      if (usedBy[block] >= 0)
+      {
+        report(where + " shares block " + to_string(inode.direct[i]) + " with inode " + to_string(usedBy[block]));
+      }
+      usedBy[block] = inodeNumber;
+      if (!isSet(dataBitmap, block))
+      {
+        report(where + " uses block " + to_string(inode.direct[i]) + " which is free in the data bitmap");
+      }
+    }
+
+    if (inode.type != UFS_DIRECTORY)
+    {
+      continue;
+    }
+
+    // and its entries
+    if (inode.size % sizeof(dir_ent_t) != 0)
+    {
+      report(where + " is a directory with a partial entry");
+    }
+    vector<char> buffer(inode.size);
+    int size = fileSystem->read(inodeNumber, buffer.data(), inode.size);
+    if (size != inode.size)
+    {
+      report(where + " couldn't be read");
+      continue;
+    }
+    dir_ent_t *entries = reinterpret_cast<dir_ent_t *>(buffer.data());
+    bool sawDot = false;
+    bool sawDotDot = false;
+    for (int i = 0; i < size / (int)sizeof(dir_ent_t); i++)
+    {
+      if (entries[i].inum == -1)
+      {
+        continue;
+      }
+      string name(entries[i].name, strnlen(entries[i].name, DIR_ENT_NAME_SIZE));
+      if (name == ".")
+      {
+        sawDot = true;
+        if (entries[i].inum != inodeNumber)
+        {
+          report(where + " has `.` pointing at " + to_string(entries[i].inum));
+        }
+        continue;
+      }
+      if (name == "..")
+      {
+        sawDotDot = true;
+        if (entries[i].inum != reachedFrom[inodeNumber])
+        {
+          report(where + " has `..` pointing at " + to_string(entries[i].inum) +
+                 " instead of " + to_string(reachedFrom[inodeNumber]));
+        }
+        continue;
+      }
+
+      int child = entries[i].inum;
+      if (child < 0 || child >= super.num_inodes)
+      {
+        report(where + " entry " + name + " points at invalid inode " + to_string(child));
+        continue;
+      }
+      if (reachedFrom[child] >= 0 || child == UFS_ROOT_DIRECTORY_INODE_NUMBER)
+      {
+        report(where + " entry " + name + " reaches inode " + to_string(child) + " a second time");
+        continue;
+      }
+      reachedFrom[child] = inodeNumber;
+      pending.push_back(child);
+    }
+    if (!sawDot || !sawDotDot)
+    {
+      report(where + " is missing `.` or `..`");
+    }
+  }
+
+  // everything allocated should have been reached
+  for (int i = 0; i < super.num_inodes; i++)
+  {
+    if (isSet(inodeBitmap, i) && reachedFrom[i] < 0)
+    {
+      report("inode " + to_string(i) + " is allocated but unreachable");
+    }
+  }
+  for (int i = 0; i < super.num_data; i++)
+  {
+    if (isSet(dataBitmap, i) && usedBy[i] < 0)
+    {
+      report("block " + to_string(super.data_region_addr + i) + " is allocated but unused");
+    }
+  }
+
+  if (problems > 0)
+  {
+    cout << problems << " problems" << endl;
+    return 1;
+  }
+  cout << "clean" << endl;
+  return 0;
+}
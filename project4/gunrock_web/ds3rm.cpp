@@ -2,6 +2,7 @@
 #include <string>
 #include <algorithm>
 #include <cstring>
+#include <memory>
 
 #include "LocalFileSystem.h"
 #include "Disk.h"
@@ -24,5 +25,18 @@ int main(int argc, char *argv[]) {
   string entryName = string(argv[3]);
   */
 
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
+  int parentInode = stoi(argv[2]);
+  string entryName = string(argv[3]);
+
+  disk->beginTransaction();
+  if (fileSystem->unlink(parentInode, entryName) < 0) {
+    disk->rollback();
+    cerr << "Error removing entry" << endl;
+    return 1;
+  }
+  disk->commit();
+
   return 0;
 }
@@ -0,0 +1,287 @@
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "LocalFileSystem.h"
+#include "TransactionManager.h"
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Runs transactions against one image from several threads at once:
+// each thread writes, overwrites, renames and removes files under its own
+// directory and in one directory they all share, rolls some of its
+// transactions back on purpose, and checks that what it reads back is
+// what it last committed. Run ds3fsck on the image afterwards.
+
+LocalFileSystem *fileSystem;
+TransactionManager *transactions;
+int rounds;
+
+// thrown to roll a transaction back on purpose
+class Abandon {};
+
+struct Worker
+{
+  pthread_t thread;
+  int id;
+  // what each of its files should hold
+  map<vector<string>, string> files;
+  int transactions;
+  int abandoned;
+  int mismatches;
+};
+
+int check(int ret)
+{
+  if (ret == -ERETRY)
+  {
+    throw TransactionConflict();
+  }
+  if (ret < 0)
+  {
+    throw runtime_error("error " + to_string(-ret));
+  }
+  return ret;
+}
+
+// the inode at the end of path, or -1 if some part is missing
+int resolve(const vector<string> &path, size_t count)
+{
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  for (size_t i = 0; i < count; i++)
+  {
+    inodeNumber = fileSystem->lookup(inodeNumber, path[i]);
+    if (inodeNumber == -ENOTFOUND)
+    {
+      return -1;
+    }
+    check(inodeNumber);
+  }
+  return inodeNumber;
+}
+
+void put(const vector<string> &path, const string &contents)
+{
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  for (size_t i = 0; i + 1 < path.size(); i++)
+  {
+    inodeNumber = check(fileSystem->create(inodeNumber, UFS_DIRECTORY, path[i]));
+  }
+  inodeNumber = check(fileSystem->create(inodeNumber, UFS_REGULAR_FILE, path.back()));
+  check(fileSystem->write(inodeNumber, contents.data(), contents.size()));
+}
+
+// a file in the thread's own tree or the shared directory
+vector<string> pathFor(const string &own, unsigned int *seed)
+{
+  if (rand_r(seed) % 2 == 0)
+  {
+    return {own, "d" + to_string(rand_r(seed) % 4), "f" + to_string(rand_r(seed) % 4)};
+  }
+  return {"shared", own + "-" + to_string(rand_r(seed) % 4)};
+}
+
+string contentsFor(Worker *worker, int round, unsigned int *seed)
+{
+  // up to a few blocks, so writes grow and shrink files
+  int size = rand_r(seed) % (3 * UFS_BLOCK_SIZE + 100);
+  string contents(size, ' ');
+  for (int i = 0; i < size; i++)
+  {
+    contents[i] = 'a' + (worker->id * 7 + round * 13 + i) % 26;
+  }
+  return contents;
+}
+
+void verify(Worker *worker, const vector<string> &path, const string &expected)
+{
+  string where = "thread " + to_string(worker->id) + ": /";
+  for (size_t i = 0; i < path.size(); i++)
+  {
+    where += (i > 0 ? "/" : "") + path[i];
+  }
+
+  int inodeNumber = resolve(path, path.size());
+  if (inodeNumber < 0)
+  {
+    cout << where << " is missing" << endl;
+    worker->mismatches++;
+    return;
+  }
+  // the directory's listing has to agree, cached or not
+  shared_ptr<const DirectoryListing> listing;
+  check(fileSystem->listDirectory(resolve(path, path.size() - 1), &listing));
+  bool listed = false;
+  for (size_t i = 0; i < listing->entries.size(); i++)
+  {
+    if (listing->entries[i].name == path.back())
+    {
+      listed = listing->entries[i].inodeNumber == inodeNumber && listing->entries[i].type == UFS_REGULAR_FILE;
+    }
+  }
+  if (!listed)
+  {
+    cout << where << " isn't listed in its directory" << endl;
+    worker->mismatches++;
+  }
+
+  inode_t inode;
+  check(fileSystem->stat(inodeNumber, &inode));
+  string contents(inode.size, '\0');
+  contents.resize(check(fileSystem->read(inodeNumber, &contents[0], inode.size)));
+  if (contents != expected)
+  {
+    cout << where << " has " << contents.size() << " bytes that don't match the "
+         << expected.size() << " it wrote" << endl;
+    worker->mismatches++;
+  }
+}
+
+void *work(void *arg)
+{
+  Worker *worker = (Worker *)arg;
+  unsigned int seed = worker->id + 1;
+  string own = "t" + to_string(worker->id);
+
+  for (int round = 0; round < rounds; round++)
+  {
+    int choice = rand_r(&seed) % 10;
+    if (choice < 6 || worker->files.empty())
+    {
+      // write a file, in its own tree or the shared directory
+      vector<string> path = pathFor(own, &seed);
+      string contents = contentsFor(worker, round, &seed);
+      transactions->run([&]()
+                        { put(path, contents); });
+      worker->files[path] = contents;
+    }
+    else if (choice < 7)
+    {
+      // move one of its files, over another of them if the name's taken
+      map<vector<string>, string>::iterator victim = worker->files.begin();
+      advance(victim, rand_r(&seed) % worker->files.size());
+      vector<string> from = victim->first;
+      vector<string> to = pathFor(own, &seed);
+      transactions->run([&]()
+                        {
+        int parent = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+        for (size_t i = 0; i + 1 < to.size(); i++) {
+          parent = check(fileSystem->create(parent, UFS_DIRECTORY, to[i]));
+        }
+        check(fileSystem->rename(resolve(from, from.size() - 1), from.back(), parent, to.back())); });
+      string contents = victim->second;
+      worker->files.erase(victim);
+      worker->files[to] = contents;
+    }
+    else if (choice < 8)
+    {
+      // remove one of its files, and its directory if that was the last
+      map<vector<string>, string>::iterator victim = worker->files.begin();
+      advance(victim, rand_r(&seed) % worker->files.size());
+      vector<string> path = victim->first;
+      worker->files.erase(victim);
+
+      bool lastInDirectory = path.size() > 2;
+      map<vector<string>, string>::iterator iter;
+      for (iter = worker->files.begin(); iter != worker->files.end(); iter++)
+      {
+        if (iter->first.size() == path.size() && iter->first[1] == path[1])
+        {
+          lastInDirectory = false;
+        }
+      }
+
+      transactions->run([&]()
+                        {
+        int parent = resolve(path, path.size() - 1);
+        check(fileSystem->unlink(parent, path.back()));
+        if (lastInDirectory) {
+          check(fileSystem->unlink(resolve(path, 1), path[1]));
+        } });
+    }
+    else if (choice < 9)
+    {
+      // change a file and then back out, which must leave it alone
+      map<vector<string>, string>::iterator victim = worker->files.begin();
+      advance(victim, rand_r(&seed) % worker->files.size());
+      string contents = contentsFor(worker, round + 1, &seed);
+      try
+      {
+        transactions->run([&]()
+                          {
+          put(victim->first, contents);
+          put({own, "abandoned"}, contents);
+          throw Abandon(); });
+      }
+      catch (Abandon &e)
+      {
+        worker->abandoned++;
+      }
+    }
+    else
+    {
+      map<vector<string>, string>::iterator iter;
+      for (iter = worker->files.begin(); iter != worker->files.end(); iter++)
+      {
+        verify(worker, iter->first, iter->second);
+      }
+    }
+    worker->transactions++;
+  }
+
+  map<vector<string>, string>::iterator iter;
+  for (iter = worker->files.begin(); iter != worker->files.end(); iter++)
+  {
+    verify(worker, iter->first, iter->second);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 4)
+  {
+    cerr << argv[0] << ": diskImageFile threads rounds" << endl;
+    return 1;
+  }
+
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<LocalFileSystem> localFileSystem = make_unique<LocalFileSystem>(disk.get());
+  unique_ptr<TransactionManager> transactionManager = make_unique<TransactionManager>(disk.get());
+  fileSystem = localFileSystem.get();
+  transactions = transactionManager.get();
+  int threads = stoi(argv[2]);
+  rounds = stoi(argv[3]);
+
+  vector<Worker> workers(threads);
+  for (int i = 0; i < threads; i++)
+  {
+    workers[i].id = i;
+    workers[i].transactions = workers[i].abandoned = workers[i].mismatches = 0;
+    pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+  }
+
+  int total = 0, abandoned = 0, mismatches = 0;
+  for (int i = 0; i < threads; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    total += workers[i].transactions;
+    abandoned += workers[i].abandoned;
+    mismatches += workers[i].mismatches;
+  }
+
+  cout << total << " rounds on " << threads << " threads, " << abandoned << " rolled back" << endl;
+  if (mismatches > 0)
+  {
+    cout << mismatches << " files didn't read back as written" << endl;
+    return 1;
+  }
+  return 0;
+}
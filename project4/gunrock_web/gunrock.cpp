@@ -3,15 +3,18 @@
 #include <assert.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 #include <sstream>
-#include <deque>
+#include <fstream>
 
+#include "Arena.h"
 #include "ClientError.h"
+#include "ConnectionTimer.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
 #include "HttpService.h"
@@ -19,31 +22,63 @@
 #include "FileService.h"
 #include "DistributedFileSystemService.h"
 #include "MySocket.h"
+#include "ReplicationService.h"
 #include "MyServerSocket.h"
+#include "ServiceRouter.h"
+#include "ShardRouterService.h"
+#include "ServerStats.h"
+#include "StringUtils.h"
+#include "TimerWheel.h"
+#include "WorkerPool.h"
 #include "dthread.h"
 
 using namespace std;
 int PORT = 8080;
 int THREAD_POOL_SIZE = 1;
+// 0 lets the pool pick from the number of cores
+int MAX_THREADS = 0;
 int BUFFER_SIZE = 1;
 string BASEDIR = "ds3";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
+// "host:port,host:port", to route ds3 requests to these servers
+// instead of serving a disk image
+string BACKENDS = "";
+// "host:port,host:port" to replicate the image to, and whether writes
+// wait for them
+string REPLICAS = "";
+bool SYNC_REPLICATION = false;
+// serve reads from an image a primary replicates to
+bool REPLICA = false;
+// a file whose first line a primary and its replicas share, so replicas
+// only take changes from the primary
+string KEYFILE = "";
+// answer PUTs once they're in a log beside the image
+bool WRITE_BEHIND = false;
 
-vector<HttpService *> services;
+// services by path prefix, and the methods this server implements
+ServiceRouter router;
 
-HttpService *find_service(HTTPRequest *request) {
-   // find a service that is registered for this path prefix
-  for (unsigned int idx = 0; idx < services.size(); idx++) {
-    if (request->getPath().find(services[idx]->pathPrefix()) == 0) {
-      return services[idx];
-    }
-  }
+// read and write deadlines for every connection
+TimerWheel timers;
 
-  return NULL;
-}
+ServerStats stats;
 
+static const char SERVICE_UNAVAILABLE[] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\n"
+  "Connection: close\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n";
+
+// Turn a connection away without reading its request. This never
+// blocks, so it's safe to do from the accept loop.
+void shed_connection(MySocket *client) {
+  client->shutdown(SERVICE_UNAVAILABLE, strlen(SERVICE_UNAVAILABLE));
+  client->close();
+  delete client;
+}
 
 void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPResponse *response) {
   stringstream payload;
@@ -53,56 +88,89 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
     if (service == NULL) {
       // not found status
       response->setStatus(404);
-    } else if (request->isHead()) {
-      service->head(request, response);
-    } else if (request->isGet()) {
-      service->get(request, response);
-    } else if (request->isPut()) {
-      service->put(request, response);
-    } else if (request->isPost()) {
-      service->post(request, response);
-    } else if (request->isDelete()) {
-      service->del(request, response);
-    } else if (request->isMove()) {
-      service->move(request, response);
-    } else {
+    } else if (router.findHandler(request->getMethod()) == NULL) {
       // The server doesn't know about this method
       response->setStatus(501);
+    } else {
+      (service->*router.findHandler(request->getMethod()))(request, response);
     }
   } catch (ClientError &ce) {
-    response->setStatus(ce.status_code);
+    if (response->isSent()) {
+      // too late for a status, the body just mustn't look complete
+      response->abortStreaming();
+    } else {
+      response->setStatus(ce.status_code);
+    }
   } catch (...) {
-    // reset the response object and return an error
-    response->setBody("");
-    response->setStatus(500);
+    // reset the response object and return an error, unless the
+    // service already started streaming
+    if (response->isSent()) {
+      response->abortStreaming();
+    } else {
+      response->setBody("");
+      response->setStatus(500);
+    }
   }
 }
 
-void handle_request(MySocket *client) {
-  HTTPRequest *request = new HTTPRequest(client, PORT);
-  HTTPResponse *response = new HTTPResponse();
+void handle_request(MySocket *client, Arena *arena) {
+  // everything for this request comes out of the worker's arena, which
+  // the worker resets once we return
+  HTTPRequest *request = arena->create<HTTPRequest>(client, PORT, arena);
+  HTTPResponse *response = arena->create<HTTPResponse>(arena);
+  ConnectionTimer *timer = arena->create<ConnectionTimer>(&timers, client);
   stringstream payload;
   
-  // read in the request
+  // read in the request; services that stream the body read it
+  // themselves once they're invoked
   bool readResult = false;
+  HttpService *service = NULL;
   try {
     payload << "client: " << (void *) client;
     sync_print("read_request_enter", payload.str());
-    readResult = request->readRequest();
+    // the read deadline stops once the whole request is in, even when a
+    // streaming service is the one that reads it and then has work to do
+    request->onRequestRead([timer]() { timer->done(); });
+    timer->readingHeader();
+    readResult = request->readHeader();
+    timer->readingBody();
+    service = router.findService(request->getPathView());
+    if (service == NULL || !service->streamsRequestBody(request)) {
+      readResult = request->readRequest();
+    }
     sync_print("read_request_return", payload.str());
+  } catch (ClientError &ce) {
+    // a request we can't parse still gets an answer
+    readResult = false;
+    response->setStatus(ce.status_code);
   } catch (...) {
     // swallow it
+    readResult = false;
   }    
     
-  if (!readResult) {
-    // there was a problem reading in the request, bail
-    delete response;
-    delete request;
+  if (!readResult || timer->timedOut()) {
+    // there was a problem reading in the request, or the client took
+    // too long and has already been sent a 408, bail
+    if (timer->timedOut()) {
+      stats.timedOut++;
+    } else if (response->getStatus() != 200) {
+      try {
+        timer->writing();
+        response->write(client);
+      } catch (...) {
+        // the client went away
+      }
+    }
+    timer->done();
+    arena->destroy(timer);
+    arena->destroy(response);
+    arena->destroy(request);
     sync_print("read_request_error", payload.str());
+    client->close();
+    delete client;
     return;
   }
   
-  HttpService *service = find_service(request);
   invoke_service_method(service, request, response);
 
   // send data back to the client and clean up
@@ -110,10 +178,26 @@ void handle_request(MySocket *client) {
   payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
   sync_print("write_response", payload.str());
   cout << payload.str() << endl;
-  client->write(response->response());
-    
-  delete response;
-  delete request;
+  try {
+    timer->writing();
+    if (response->isSent()) {
+      // the service streamed its response itself
+      response->finishStreaming();
+    } else {
+      response->write(client);
+    }
+  } catch (...) {
+    // the client went away, nothing more to send
+  }
+  timer->done();
+  if (timer->timedOut()) {
+    stats.timedOut++;
+  }
+  stats.served++;
+
+  arena->destroy(timer);
+  arena->destroy(response);
+  arena->destroy(request);
 
   payload.str(""); payload.clear();
   payload << " client: " << (void *) client;
@@ -127,7 +211,7 @@ int main(int argc, char *argv[]) {
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:t:m:b:s:l:i:r:R:SFk:w")) != -1) {
     switch (option) {
     case 'd':
       BASEDIR = string(optarg);
@@ -138,6 +222,9 @@ int main(int argc, char *argv[]) {
     case 't':
       THREAD_POOL_SIZE = atoi(optarg);
       break;
+    case 'm':
+      MAX_THREADS = atoi(optarg);
+      break;
     case 'b':
       BUFFER_SIZE = atoi(optarg);
       break;
@@ -150,8 +237,35 @@ int main(int argc, char *argv[]) {
     case 'i':
       DISKFILE = string(optarg);
       break;
+    case 'r':
+      BACKENDS = string(optarg);
+      break;
+    case 'R':
+      REPLICAS = string(optarg);
+      break;
+    case 'S':
+      SYNC_REPLICATION = true;
+      break;
+    case 'F':
+      REPLICA = true;
+      break;
+    case 'k':
+      KEYFILE = string(optarg);
+      break;
+    case 'w':
+      WRITE_BEHIND = true;
+      break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
+      cerr<< "usage: " << argv[0] << " [-p port] [-t minThreads] [-m maxThreads] [-b buffers] [-i diskFile [-w] [-R host:port,... [-S] | -F] [-k keyFile] | -r host:port,...]" << endl;
+      exit(1);
+    }
+  }
+
+  string key;
+  if (!REPLICAS.empty() || REPLICA) {
+    ifstream keyFile(KEYFILE);
+    if (KEYFILE.empty() || !getline(keyFile, key) || key.empty()) {
+      cerr << "replication needs a key, the first line of the file given with -k" << endl;
       exit(1);
     }
   }
@@ -164,15 +278,58 @@ int main(int argc, char *argv[]) {
   MyServerSocket *server = new MyServerSocket(PORT);
   MySocket *client;
 
-  // The order that you push services dictates the search order
+  // The order that you add services dictates the search order
   // for path prefix matching
-  services.push_back(new DistributedFileSystemService(DISKFILE));
-  services.push_back(new FileService(BASEDIR));
+  if (BACKENDS.empty()) {
+    DistributedFileSystemService *ds3 = new DistributedFileSystemService(DISKFILE);
+    if (WRITE_BEHIND) {
+      ds3->writeBehind();
+    }
+    if (!REPLICAS.empty()) {
+      router.addService(new ReplicationService(ds3->replicateTo(StringUtils::split(REPLICAS, ','),
+                                                                SYNC_REPLICATION, key)));
+    } else if (REPLICA) {
+      ds3->becomeReplica();
+      router.addService(new ReplicationService(ds3, key));
+    }
+    router.addService(ds3);
+  } else {
+    router.addService(new ShardRouterService(StringUtils::split(BACKENDS, ',')));
+  }
+  router.addService(new FileService(BASEDIR));
+  router.compile();
+
+  router.addMethod(HTTP_HEAD, &HttpService::head);
+  router.addMethod(HTTP_GET, &HttpService::get);
+  router.addMethod(HTTP_PUT, &HttpService::put);
+  router.addMethod(HTTP_POST, &HttpService::post);
+  router.addMethod(HTTP_DELETE, &HttpService::del);
+  router.addMethod(HTTP_MOVE, &HttpService::move);
   
+  timers.start();
+
+  // GETs run side by side on the workers; the ds3 service serialises
+  // changes to the disk image itself
+  WorkerPool pool(handle_request, shed_connection, &stats);
+  pool.setThreads(THREAD_POOL_SIZE, MAX_THREADS);
+  pool.setQueueSize(BUFFER_SIZE);
+  pool.start();
+
   while(true) {
     sync_print("waiting_to_accept", "");
-    client = server->accept();
+    try {
+      client = server->accept();
+    } catch (SocketError &e) {
+      // out of descriptors for the moment, give the workers a chance
+      // to close some
+      usleep(10000);
+      continue;
+    }
+    if (client == NULL) {
+      continue;
+    }
     sync_print("client_accepted", "");
-    handle_request(client);
+    stats.accepted++;
+    pool.submit(client);
   }
 }
@@ -0,0 +1,37 @@
+#ifndef _BACKEND_CONNECTOR_H_
+#define _BACKEND_CONNECTOR_H_
+
+#include <string>
+
+#include "MySocket.h"
+
+/**
+ * Opens the connections to one backend server.
+ *
+ * gunrock closes every connection after one response, so there's no
+ * connection to hand back and reuse, and each request gets a new one.
+ * Nothing is opened ahead of time either: a connection waiting on the
+ * backend ties up one of its workers until a request comes along.
+ */
+class BackendConnector {
+ public:
+  BackendConnector(std::string host, int port);
+
+  /**
+   * A connection to the backend for one request. The caller closes
+   * and deletes it.
+   *
+   * @throws SocketError if the backend can't be reached
+   */
+  MySocket *connect();
+
+  // "host:port"
+  std::string name() { return m_name; }
+
+ private:
+  std::string m_host;
+  int m_port;
+  std::string m_name;
+};
+
+#endif
@@ -17,6 +17,9 @@ class ClientError : public std::runtime_error {
   static ClientError notFound() { return ClientError("Not Found", 404); }
   static ClientError methodNotAllowed() { return ClientError("Method Not Allowed", 405); }
   static ClientError conflict() { return ClientError("Conflict", 409); }
+  static ClientError preconditionFailed() { return ClientError("Precondition Failed", 412); }
+  static ClientError payloadTooLarge() { return ClientError("Content Too Large", 413); }
+  static ClientError badGateway() { return ClientError("Bad Gateway", 502); }
   static ClientError insufficientStorage() { return ClientError("Insufficient Storage", 507); }
 };
 
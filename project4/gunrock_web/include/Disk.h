@@ -1,31 +1,91 @@
 #ifndef _DISK_H_
 #define _DISK_H_
 
+#include <pthread.h>
+
 #include <string>
 #include <deque>
+#include <functional>
+#include <map>
+#include <vector>
 
 struct UndoRecord {
   int blockNumber;
+  // what the write changed, as old ^ new, so undoing it leaves changes
+  // other transactions made to the same block alone
   unsigned char *blockData;
 };
 
 class Disk {
  public:
   Disk(std::string imageFile, int blockSize);
+  ~Disk();
   void readBlock(int blockNumber, void *buffer);
   void writeBlock(int blockNumber, void *buffer);
   int numberOfBlocks();
 
+  /**
+   * Transactions belong to the calling thread: each thread can have
+   * one open, and rolling it back only undoes the bytes that thread
+   * wrote. Keeping other threads off those bytes until the transaction
+   * ends is up to the caller. Writes outside a transaction are synced
+   * to the image one at a time, and a transaction's all at once when
+   * it ends.
+   */
   void beginTransaction();
   void commit();
   void rollback();
+  bool inTransaction();
+  // runs `action` once the calling thread's transaction has committed
+  // or rolled back, with whether it committed. Actions run newest
+  // first, so one added after taking a lock runs before the action
+  // that releases it
+  void atEnd(std::function<void(bool committed)> action);
+
+  /**
+   * Has `listener` told what each commit changed, as UndoRecords whose
+   * blockData is old ^ new, newest first and with a block appearing
+   * once per write to it. It runs in the committing thread once the
+   * writes are synced and before the transaction's end actions, so
+   * while its locks are still held; a write outside a transaction is
+   * reported on its own the same way. Set it before any writes.
+   */
+  void setCommitListener(std::function<void(const std::deque<struct UndoRecord> &changes)> listener);
+  int getBlockSize() { return blockSize; }
+
+  /**
+   * Short-term latches for read-modify-write of blocks that threads
+   * share, like the bitmaps and the inode table. They're striped, so
+   * hold at most one at a time.
+   */
+  void lockBlock(int blockNumber);
+  void unlockBlock(int blockNumber);
   
  private:
+  struct Transaction {
+    std::deque<struct UndoRecord> undoLog;
+    std::vector<std::function<void(bool)> > endActions;
+  };
+
+  static const int BLOCK_LATCHES = 64;
+
+  // the calling thread's transaction, or NULL
+  Transaction *currentTransaction();
+  int writeDescriptor();
+  void writeRaw(int blockNumber, void *buffer);
+  void sync();
+  void endTransaction(bool committed);
+
   std::string imageFile;
   int blockSize;
   int imageFileSize;
-  bool isInTransaction;
-  std::deque<struct UndoRecord> undoLog;
+  // kept open for reads, which use pread so threads can share it
+  int readFd;
+  int writeFd;
+  pthread_mutex_t transactionsLock;
+  std::map<pthread_t, Transaction> transactions;
+  pthread_mutex_t blockLatches[BLOCK_LATCHES];
+  std::function<void(const std::deque<struct UndoRecord> &)> commitListener;
 };
 
 #endif
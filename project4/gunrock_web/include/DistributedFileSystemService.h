@@ -1,21 +1,179 @@
 #ifndef _DISTRIBUTEDFILESYSTEMSERVICE_H_
 #define _DISTRIBUTEDFILESYSTEMSERVICE_H_
 
+#include "ETagStore.h"
 #include "HttpService.h"
+#include "IngestLog.h"
 #include "LocalFileSystem.h"
+#include "Replicator.h"
+#include "TransactionManager.h"
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <vector>
 
+/**
+ * The ds3 REST interface to a LocalFileSystem disk image.
+ *
+ * Besides GET, PUT and DELETE on /ds3/<path>, a POST to /ds3/ applies
+ * a batch of operations in a single transaction. The body is a series
+ * of operations, each a header line followed by the file's contents
+ * for a PUT:
+ *
+ *   PUT a/b/c.txt 5
+ *   hello
+ *   DELETE a/b/old.txt
+ *
+ * Either all of them happen or, if any of them fails, none do, and the
+ * response has the status the failing one would have had on its own.
+ *
+ * MOVE renames a file or directory to the path under /ds3/ in its
+ * Destination header, replacing whatever is there unless the request
+ * says "Overwrite: F". Only directory entries change, so it costs the
+ * same whatever the file's size.
+ *
+ * Files carry an ETag, a hash of their contents kept in an ETagStore
+ * beside the image. GET honours If-None-Match with a 304, and PUT and
+ * DELETE honour If-Match with a 412 when the file has changed.
+ *
+ * The image can be replicated to other servers for reads (see
+ * Replicator). A replica turns down every change with a 405 and only
+ * takes them from its primary, through applyReplicated().
+ *
+ * With write-behind on, an unconditional PUT is answered once it's in
+ * an IngestLog beside the image, and GETs look there first. It still
+ * fails up front if its path is the wrong kind of entry in the image,
+ * or in a PUT that's waiting. Every other change applies what's
+ * waiting before it goes ahead, and doesn't overlap with PUTs. A PUT
+ * answered this way doesn't wait for synchronous replicas.
+ */
 class DistributedFileSystemService : public HttpService {
  public:
   DistributedFileSystemService(std::string driveFile);
 
+  virtual bool streamsRequestBody(HTTPRequest *request);
+
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
+  virtual void move(HTTPRequest *request, HTTPResponse *response);
+
+  // sends every commit to `replicas` ("host:port") from now on,
+  // with `key` to show them it's the primary
+  Replicator *replicateTo(const std::vector<std::string> &replicas, bool synchronous, std::string key);
+  // makes this server a read-only replica
+  void becomeReplica();
+  // answers PUTs once they're in the log, replaying what it holds first
+  void writeBehind();
+  /**
+   * Applies changes from the primary, all of them or, if any is
+   * outside the image, none. GETs wait while it does.
+   */
+  bool applyReplicated(const std::vector<BlockDelta> &deltas);
 
 private:
+  struct BatchOperation {
+    bool isDelete;
+    std::vector<std::string> path;
+    std::string_view contents;
+  };
+
+  // a directory's GET body, made from the listing with this version
+  struct RenderedListing {
+    uint64_t version;
+    std::string body;
+  };
+
+  // the most a batch body can hold
+  static const size_t MAX_BATCH_SIZE = 64 * 1024 * 1024;
+
+  // the path under /ds3/, one entry per directory or file name
+  std::vector<std::string> pathComponents(HTTPRequest *request);
+  // the same for a MOVE's Destination header, a path or URL under /ds3/
+  std::vector<std::string> destinationComponents(HTTPRequest *request);
+  // "a/b/c.txt", the form IngestLog keeps paths in
+  static std::string joinPath(const std::vector<std::string> &path);
+  // converts a negative LocalFileSystem result to the matching ClientError
+  int checkResult(int ret);
+  // the inode reached by following the first `count` components of
+  // `path` from the root; throws notFound if any of them is missing
+  int resolve(const std::vector<std::string> &path, size_t count);
+  // reads the request body into `body`, or throws payloadTooLarge if it's
+  // longer than `limit`
+  void readBody(HTTPRequest *request, size_t limit, std::pmr::string *body);
+
+  // GET for a file: all of it, or the part a Range header asks for,
+  // read while the file is pinned and sent once it isn't
+  void sendFile(HTTPRequest *request, HTTPResponse *response, int inodeNumber);
+  // the same for a PUT that's still in the log
+  void sendPending(HTTPRequest *request, HTTPResponse *response, const PendingPut *put);
+  /**
+   * Sets the headers for a GET of a file of `size` bytes, with the
+   * status for If-None-Match and Range, and works out which part of it
+   * to send.
+   *
+   * @return false if none of it should be sent, for a 304
+   */
+  bool fileHeaders(HTTPRequest *request, HTTPResponse *response, int size, const std::string &etag,
+                   int *first, int *length);
+
+  // the file's ETag, hashing it if the store doesn't have it; the
+  // caller has it pinned
+  std::string etagFor(int inodeNumber, int size);
+  // makes sure the store has an ETag for the file at `path`, if there
+  // is one, before a conditional change compares against it
+  void primeETag(const std::vector<std::string> &path);
+
+  // these run inside a transaction, and return the file's inode;
+  // putFile runs `check` on the file once it's locked and before
+  // anything changes it, so it still sees the file's old ETag
+  int putFile(const std::vector<std::string> &path, std::string_view contents,
+              std::function<void(int inodeNumber)> check = NULL);
+  int deleteEntry(const std::vector<std::string> &path);
+  // throws preconditionFailed unless the file's ETag before this
+  // transaction is in `ifMatch`
+  void checkIfMatch(int inodeNumber, std::string_view ifMatch);
+
+  // throws methodNotAllowed on a replica
+  void checkWritable();
+  // runs a change in a transaction, after any PUTs waiting in the log
+  void change(std::function<void()> body);
+  // the IngestLog's applier
+  std::vector<FailedPut> applyPending(const std::vector<std::shared_ptr<const PendingPut> > &puts);
+  // throws the error putFile would give for `path` because of what's
+  // in the image, for a PUT about to be answered before it's applied;
+  // the IngestLog's validator
+  void checkPutPath(const std::vector<std::string> &path);
+  // after a change commits, holds its answer until the replicas have
+  // it, in synchronous mode
+  void waitForReplicas();
+
+  std::string diskFile;
   LocalFileSystem *fileSystem;
+  // PUTs and DELETEs run in a transaction, and are retried if they
+  // conflict with another one
+  TransactionManager *transactions;
+  ETagStore *etags;
+  // by directory inode
+  pthread_mutex_t listingsLock;
+  std::map<int, RenderedListing> renderedListings;
+
+  // NULL unless this is a primary with replicas
+  Replicator *replicator;
+  bool replica;
+  // on a replica, held shared by GETs and exclusively while changes
+  // from the primary are applied
+  pthread_rwlock_t replicaLock;
+  // NULL unless PUTs are written behind
+  IngestLog *ingest;
 };
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef _ETAG_STORE_H_
+#define _ETAG_STORE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <string_view>
+
+/**
+ * Content hashes for the files in a ds3 disk image, kept beside it in
+ * a sidecar file so the image format stays as it is.
+ *
+ * Entries are keyed by inode number and carry the file's size and the
+ * StringUtils::fnv1a hash of its contents. The sidecar is an append-only log of
+ * changes, compacted when it's loaded. Unless the sidecar was written
+ * after the image last was, it's thrown away (one of the ds3 tools may
+ * have run) and hashes are worked out again as files are read.
+ *
+ * Keeping the entries in step with the image is up to the caller:
+ * change them while holding the file's inode lock. The mtimes can't
+ * tell which of several concurrent commits got recorded, so a file's
+ * entry has to be removed before its contents change and set again
+ * once the change has committed. If the server stops in between, the
+ * file just has no entry.
+ */
+class ETagStore {
+ public:
+  ETagStore(std::string sidecarFile, std::string imageFile);
+  ~ETagStore();
+
+  // the entity tag for a file with this hash and size, quotes included
+  static std::string format(uint64_t hash, int size);
+
+  // the ETag recorded for the file, or false if there isn't one or it
+  // was recorded at a different size
+  bool find(int inodeNumber, int size, std::string *etag);
+  // the same without checking the size, for a file that the caller has
+  // locked and is changing
+  bool find(int inodeNumber, std::string *etag);
+  // records a hash the caller worked out, unless the file already has one
+  void add(int inodeNumber, uint64_t hash, int size);
+  void set(int inodeNumber, uint64_t hash, int size);
+  void remove(int inodeNumber);
+  // forgets every entry, for when the image changed in ways the caller
+  // can't follow file by file
+  void clear();
+  // marks the sidecar as up to date with the image after writes that
+  // didn't change any entries, like a rollback
+  void touch();
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    int size;
+  };
+
+  void load();
+  void append(int inodeNumber, const Entry *entry);
+
+  std::string m_sidecarFile;
+  std::string m_imageFile;
+  int m_fd;
+  pthread_mutex_t m_lock;
+  std::map<int, Entry> m_entries;
+};
+
+#endif
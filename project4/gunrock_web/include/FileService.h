@@ -3,6 +3,8 @@
 
 #include "HttpService.h"
 
+#include <sys/types.h>
+
 #include <string>
 
 class FileService : public HttpService {
@@ -13,8 +15,16 @@ class FileService : public HttpService {
   virtual void head(HTTPRequest *request, HTTPResponse *response);
 
 private:
+  // files this big or bigger are streamed, see streamFile()
+  static const off_t STREAM_THRESHOLD = 64 * 1024;
+
+  void serve(HTTPRequest *request, HTTPResponse *response, bool sendBody);
   bool endswith(std::string str, std::string suffix);
-  std::string readFile(std::string path);
+  std::string readFile(int fd);
+  // sends the file with chunked encoding through a ChunkedWriter, so
+  // only one buffer of it is in memory and a slow client holds up the
+  // reading rather than it piling up
+  void streamFile(HTTPRequest *request, HTTPResponse *response, int fd, off_t size);
 
   std::string m_basedir;
 };
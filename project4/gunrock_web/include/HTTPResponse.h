@@ -1,28 +1,116 @@
 #ifndef HTTP_RESPONSE_H_
 #define HTTP_RESPONSE_H_
 
-#include <map>
+#include <sys/types.h>
+
+#include <functional>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ChunkedWriter.h"
+#include "MySocket.h"
 
 class HTTPResponse {
  public:
-  HTTPResponse();
+  /**
+   * Headers and body are allocated from `memory`, normally the
+   * worker's Arena.
+   */
+  HTTPResponse(std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+  ~HTTPResponse();
   void withStreaming();
-  void setHeader(std::string name, std::string value);
-  void setBody(std::string data);
-  void setContentType(std::string contentType);
+  void setHeader(std::string_view name, std::string_view value);
+  void setBody(std::string_view data);
+  void appendBody(const char *data, size_t len);
+  void reserveBody(size_t len);
+  void setContentType(std::string_view contentType);
+  std::string_view getContentType() { return contentType; }
+
+  /**
+   * Send this Content-Length instead of the body's size. For HEAD
+   * responses, which describe a body without including it.
+   */
+  void setContentLength(size_t length);
+
+  /**
+   * Use `length` bytes of the file `fd` from `offset` as the body. It is
+   * sent with sendfile() after the header, so the contents never pass
+   * through this process. `done` is called when the response no
+   * longer needs the descriptor, whether or not it was sent.
+   */
+  void setBodyFile(int fd, off_t offset, size_t length, std::function<void()> done);
   void setStatus(int status);
   int getStatus();
+
+  /**
+   * Serialize the response and send it. The header is built in a
+   * buffer that is reused across calls and goes out in the same
+   * writev() as the body, so the two are never concatenated.
+   */
+  void write(MySocket *client);
+
+  // the whole response as one string; write() is the fast path
   std::string response();
 
+  /**
+   * Send the status line and headers now with chunked transfer
+   * encoding and return a writer for the body, which sends a chunk
+   * each time `bufferSize` bytes have been written. The writer lives as
+   * long as this response. Headers set after this call are ignored.
+   */
+  ChunkedWriter *beginStreaming(MySocket *client, size_t bufferSize = 64 * 1024);
+
+  /**
+   * For a service that copied a whole response to the client itself,
+   * like a proxy passing one through: records its status for logging
+   * and marks the response as sent so nothing else goes out.
+   */
+  void setRelayed(int status);
+
+  // true once anything has gone out on the wire for this response
+  bool isSent() { return sent; }
+
+  // finish off a streamed body if the service didn't
+  void finishStreaming();
+  // a streamed body was cut short, so finishStreaming() leaves off the
+  // last chunk and the client sees the body end unfinished
+  void abortStreaming();
+
+  /**
+   * Status line ("HTTP/1.1 404 Not Found\r\n") and reason phrase for
+   * any standard status code, from a table built once at startup.
+   */
+  static std::string_view statusLine(int status);
+  static std::string_view reasonPhrase(int status);
+
  private:
   std::string statusToString();
+  void serializeHeader();
+  void releaseBodyFile();
+
+  typedef std::pair<std::pmr::string, std::pmr::string> Header;
 
   int status;
   bool streaming;
-  std::map<std::string, std::string> headers;
-  std::string body;
-  std::string contentType;
+  bool sent;
+  bool aborted;
+  ChunkedWriter *writer;
+  // -1 to use the body's size
+  ssize_t contentLength;
+  // a handful of headers at most, so a flat list in insertion order
+  // beats a map
+  std::pmr::vector<Header> headers;
+  std::pmr::string body;
+  // a body sent from a file instead, when bodyFd >= 0
+  int bodyFd;
+  off_t bodyFileOffset;
+  size_t bodyFileLength;
+  std::function<void()> bodyFileDone;
+  std::pmr::string contentType;
+  std::pmr::string headerBuffer;
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef _HASH_RING_H_
+#define _HASH_RING_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Consistent hashing of keys onto a fixed set of nodes.
+ *
+ * Each node is placed at `replicas` points on a 64-bit ring, hashed
+ * from its name, and a key belongs to the first node point at or after
+ * the key's own hash. Adding or removing a node only moves the keys
+ * next to its points, about 1/n of them, and the replicas keep the
+ * share each node gets close to even. Names and keys are hashed with
+ * FNV-1a so every process maps them the same way.
+ *
+ * Read-only once built, so threads can share it without locking.
+ */
+class HashRing {
+ public:
+  HashRing(const std::vector<std::string> &nodes, int replicas = 64);
+
+  // the index in `nodes` of the node that owns `key`
+  int find(std::string_view key);
+
+ private:
+  static uint64_t hash(std::string_view key);
+
+  // (point, node index), sorted by point
+  std::vector<std::pair<uint64_t, int> > m_points;
+};
+
+#endif
@@ -7,11 +7,26 @@
 #include "MySocket.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
+#include "ChunkedWriter.h"
 
 class HttpService {
  public:
   HttpService(std::string pathPrefix);
-  std::string pathPrefix();
+  const std::string &pathPrefix();
+
+  /**
+   * Whether this service reads the request body itself.
+   *
+   * By default the server buffers the whole body before calling the
+   * handler. A service that returns true here gets called as soon as
+   * the header has been read and is responsible for reading the body
+   * with HTTPRequest::readBody(), which hands it over a piece at a
+   * time as it arrives.
+   *
+   * @param request the request, with only its header read so far
+   * @return true to stream the body
+   */
+  virtual bool streamsRequestBody(HTTPRequest *request);
   
   virtual void head(HTTPRequest *request, HTTPResponse *response);
   virtual void get(HTTPRequest *request, HTTPResponse *response);
@@ -19,6 +34,24 @@ class HttpService {
   virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
   virtual void move(HTTPRequest *request, HTTPResponse *response);
+
+ protected:
+  /**
+   * Start streaming the response body to the client.
+   *
+   * The status and headers already set on the response are sent right
+   * away with chunked transfer encoding, and the returned writer sends
+   * the body as it is produced, a bounded buffer at a time. Once this
+   * has been called the status can no longer change, so check for
+   * errors first.
+   *
+   * @param request the request being answered
+   * @param response the response whose headers should be sent
+   * @param bufferSize how much of the body to collect per chunk
+   * @return a writer for the body, owned by the response
+   */
+  ChunkedWriter *streamResponse(HTTPRequest *request, HTTPResponse *response,
+                                size_t bufferSize = 64 * 1024);
   
  private:
   std::string m_pathPrefix;
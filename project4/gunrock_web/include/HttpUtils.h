@@ -1,7 +1,12 @@
 #ifndef _HTTP_UTILS_H_
 #define _HTTP_UTILS_H_
 
+#include <sys/types.h>
+#include <time.h>
+
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -20,6 +25,51 @@ class HttpUtils {
   static void writeChunk(MySocket *client, const void *buf, int numBytes);
   static void writeLastChunk(MySocket *client);
 
+  /**
+   * Format `when` as an HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT")
+   * into `buffer`, which must hold at least 30 bytes. Returns the
+   * length written.
+   */
+  static size_t formatDate(time_t when, char *buffer);
+
+  /**
+   * The current time as an HTTP date. Each thread caches the formatted
+   * string and only reformats it when the second changes. The view is
+   * valid until the calling thread's next call.
+   */
+  static std::string_view currentDate();
+
+  // an inclusive range of byte offsets
+  struct ByteRange {
+    off_t first;
+    off_t last;
+  };
+
+  typedef enum {RANGE_IGNORE, RANGE_SATISFIABLE, RANGE_NOT_SATISFIABLE} RangeResult;
+
+  /**
+   * Parse a "Range: bytes=..." header for a resource of `size` bytes.
+   *
+   * @return RANGE_SATISFIABLE with the ranges clamped to the resource
+   *   in `ranges`, in order and with any that overlap or touch merged,
+   *   RANGE_NOT_SATISFIABLE when none of them overlap it
+   *   (a 416), or RANGE_IGNORE when the header is malformed, isn't in
+   *   bytes or asks for too many pieces, in which case the whole
+   *   resource should be sent
+   */
+  static RangeResult parseRange(std::string_view header, off_t size,
+                                std::pmr::vector<ByteRange> *ranges);
+
+  // most ranges parseRange() accepts in one header
+  static const size_t MAX_RANGES = 16;
+
+  /**
+   * True if the If-Match/If-None-Match style list `header` ("*" or a
+   * comma separated list of entity tags) contains `etag`. Weak tags
+   * compare equal to their strong form.
+   */
+  static bool matchesETag(std::string_view header, std::string_view etag);
+
   static std::vector<std::string> split(const std::string &s, char delim);
 
  private:
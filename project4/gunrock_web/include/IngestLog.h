@@ -0,0 +1,142 @@
+#ifndef _INGEST_LOG_H_
+#define _INGEST_LOG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// a PUT that's in the log and hasn't reached the image yet
+struct PendingPut {
+  uint64_t sequence;
+  // the path under /ds3/, "a/b/c.txt"
+  std::string path;
+  std::string contents;
+};
+
+// a PUT the applier couldn't apply, and why
+struct FailedPut {
+  std::shared_ptr<const PendingPut> put;
+  std::string reason;
+};
+
+/**
+ * Write-behind for ds3 PUTs.
+ *
+ * A PUT is appended to a log file beside the image and answered once
+ * the log is synced, and a thread applies what's in the log to the
+ * image afterwards, several PUTs to a transaction. Appends that arrive
+ * while one thread syncs share the next sync. Until a PUT is applied
+ * find() returns it, so reads can be answered from it. Once MAX_QUEUED
+ * PUTs or MAX_QUEUED_BYTES of contents are waiting, appends wait for
+ * the applier to catch up.
+ *
+ * Anything that changes the image other than a PUT has to go through
+ * bypass(), which applies everything waiting first and holds new PUTs
+ * off while it runs, so the two kinds of change happen in the order
+ * they were answered. The log is emptied whenever everything in it
+ * has been applied, and replayed when it's opened; PUTs replace a
+ * file whole, so replaying one that was already applied is harmless.
+ *
+ * A PUT that fails once it's being applied, like on a full disk, was
+ * already answered, so it's kept in a file beside the log, "<log>.failed",
+ * in the same form as the log with the reason after the hash, and
+ * synced before the log can be emptied. Nothing reads that file back;
+ * it's there for whoever looks after the server.
+ */
+class IngestLog {
+ public:
+  // applies PUTs in order, and returns once the image has them, along
+  // with any it couldn't apply
+  typedef std::function<std::vector<FailedPut>(const std::vector<std::shared_ptr<const PendingPut> > &puts)> Applier;
+  // throws if a PUT to `path` can't work with what's in the image
+  typedef std::function<void(const std::string &path)> Validator;
+
+  // replays whatever `logFile` holds through `applier` before returning
+  IngestLog(std::string logFile, Applier applier);
+  ~IngestLog();
+
+  /**
+   * Append a PUT and wait until it's durable.
+   *
+   * `validate` runs with no bypass() change in progress, and again if
+   * a PUT reached the image while it ran, so what it saw still holds
+   * when this PUT is applied. It runs without the log's own lock, so other
+   * appends and find() don't wait on it. Whatever it throws
+   * comes out of append() and nothing is appended.
+   *
+   * @return false, without appending, if a PUT still waiting needs
+   *   `path` or one of its parents to be the other kind of entry
+   */
+  bool append(const std::string &path, std::string_view contents, Validator validate);
+
+  // the newest PUT waiting for `path`, or NULL
+  std::shared_ptr<const PendingPut> find(const std::string &path);
+  // whether a PUT waiting is for something inside `directory`, which
+  // is "" for the root
+  bool pendingUnder(const std::string &directory);
+
+  // waits until every PUT appended before the call has been applied
+  void flush();
+  // runs a change that doesn't go through the log, with everything
+  // before it applied and nothing after it appended yet
+  void bypass(std::function<void()> change);
+
+ private:
+  // how many PUTs the applier hands over at once
+  static constexpr size_t MAX_BATCH = 64;
+  // how much can wait to be applied before appends hold off
+  static constexpr size_t MAX_QUEUED = 1024;
+  static constexpr size_t MAX_QUEUED_BYTES = 64 << 20;
+
+  void replay();
+  bool conflicts(const std::string &path);
+  // the caller holds m_pendingLock
+  bool hasPendingUnder(const std::string &directory);
+  static void *applyLoop(void *log);
+  void applyPending();
+  // empties the log file; the caller holds m_lock
+  void truncate();
+  // writes PUTs that couldn't be applied to the failures file
+  void recordFailed(const std::vector<FailedPut> &failed);
+  // the header of a record for `path` and `contents`, without the "\n"
+  static std::string recordHeader(const std::string &path, std::string_view contents);
+
+  std::string m_logFile;
+  int m_fd;
+  Applier m_applier;
+
+  // for the queue and the order of the log file
+  pthread_mutex_t m_lock;
+  // signalled when PUTs are appended or applied
+  pthread_cond_t m_changed;
+  // held shared by appends and exclusively by bypass()
+  pthread_rwlock_t m_bypassLock;
+  pthread_t m_thread;
+  bool m_stopping;
+
+  // oldest first, and the size of their contents
+  std::deque<std::shared_ptr<const PendingPut> > m_queue;
+  size_t m_queuedBytes;
+  // the newest for each path, under m_pendingLock, which is taken
+  // after m_lock when both are held; reads only need this one, so
+  // they don't wait on appends writing to the log
+  pthread_mutex_t m_pendingLock;
+  std::map<std::string, std::shared_ptr<const PendingPut> > m_pending;
+  uint64_t m_appended;
+  uint64_t m_applied;
+
+  // bytes ever written to the log and ever synced, so an append can
+  // tell whether another thread's sync already covered it
+  pthread_mutex_t m_syncLock;
+  uint64_t m_written;
+  uint64_t m_synced;
+};
+
+#endif
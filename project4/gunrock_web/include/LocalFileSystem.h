@@ -1,7 +1,14 @@
 #ifndef _LOCAL_FILE_SYSTEM_H_
 #define _LOCAL_FILE_SYSTEM_H_
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "Disk.h"
 #include "ufs.h"
@@ -43,10 +50,65 @@
 #define EINVALIDTYPE       (9)
 // Unlinking '.' or '..'
 #define EUNLINKNOTALLOWED  (10)
+// Waiting for a lock another thread holds could deadlock; roll the
+// transaction back and try it again
+#define ERETRY             (11)
+// Moving a directory somewhere inside itself
+#define EINVALIDMOVE       (12)
+
+/**
+ * Locking.
+ *
+ * Several threads can use one LocalFileSystem at once. Each inode is
+ * covered by one of a fixed set of reader/writer lock stripes: lookup,
+ * stat and read hold the inode they look at shared for the length of
+ * the call, and create, write, unlink and rename hold the inodes they change
+ * exclusively until the calling thread's Disk transaction ends (or
+ * until the call returns, outside a transaction). Inodes a transaction
+ * allocates are its own until it ends and aren't locked at all.
+ *
+ * Locks are always taken in the order parent directory, then child
+ * inode, then bitmap and inode table blocks, which are latched only
+ * for the read-modify-write of a single block. rename() holds two
+ * parents; when one contains the other it takes the outer one first,
+ * and otherwise the one with the lower inode number. Stripes are shared
+ * between inodes, so that order alone doesn't rule out a deadlock: a
+ * thread that already holds a stripe only waits a short while for
+ * another, and gives up with -ERETRY instead.
+ *
+ * Blocks and inodes freed inside a transaction go back to the bitmaps
+ * when it commits, so nothing else can reuse them while it might
+ * still roll back.
+ */
+
+/**
+ * Directory caching.
+ *
+ * listDirectory() keeps what it reads, with each child's type, until
+ * something adds or removes an entry in that directory (or a
+ * transaction that did rolls back), and lookup() uses it when it's
+ * there instead of reading the directory again.
+ */
+
+// one entry in a DirectoryListing
+struct DirectoryEntry {
+  std::string name;
+  int inodeNumber;
+  int type;
+};
+
+// a directory's entries apart from `.` and `..`, sorted by name
+struct DirectoryListing {
+  // different for every listing built, so callers can cache what they
+  // make from one
+  uint64_t version;
+  std::vector<DirectoryEntry> entries;
+};
 
 class LocalFileSystem {
  public:
   LocalFileSystem(Disk *disk);
+  ~LocalFileSystem();
   /**
    * Lookup an inode.
    *
@@ -55,7 +117,7 @@ class LocalFileSystem {
    * number of name is returned.
    *
    * Success: return inode number of name
-   * Failure: return -ENOTFOUND, -EINVALIDINODE.
+   * Failure: return -ENOTFOUND, -EINVALIDINODE, -ERETRY.
    * Failure modes: invalid parentInodeNumber, name does not exist.
    */
   int lookup(int parentInodeNumber, std::string name);
@@ -67,7 +129,7 @@ class LocalFileSystem {
    * the type of the entry and the size of the data, in bytes, and direct blocks.
    *
    * Success: return 0
-   * Failure: return -EINVALIDINODE
+   * Failure: return -EINVALIDINODE, -ERETRY
    * Failure modes: invalid inodeNumber
    */
   int stat(int inodeNumber, inode_t *inode);
@@ -79,7 +141,8 @@ class LocalFileSystem {
    * in the parent directory specified by parentInodeNumber of name name.
    *
    * Success: return the inode number of the new file or directory
-   * Failure: -EINVALIDINODE, -EINVALIDNAME, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   * Failure: -EINVALIDINODE, -EINVALIDNAME, -EINVALIDTYPE, -ENOTENOUGHSPACE,
+   * -ERETRY.
    * Failure modes: parentInodeNumber does not exist or is not a directory, or
    * name is too long. If name already exists and is of the correct type,
    * return success, but if the name already exists and is of the wrong type,
@@ -94,7 +157,7 @@ class LocalFileSystem {
    * already exists.
    *
    * Success: number of bytes written
-   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE.
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE, -ERETRY.
    * Failure modes: invalid inodeNumber, invalid size, not a regular file
    * (because you can't write to directories).
    */
@@ -108,11 +171,53 @@ class LocalFileSystem {
    * directories should return data in the format specified by dir_ent_t.
    *
    * Success: number of bytes read
-   * Failure: -EINVALIDINODE, -EINVALIDSIZE.
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -ERETRY.
    * Failure modes: invalid inodeNumber, invalid size.
    */
   int read(int inodeNumber, void *buffer, int size);
 
+  /**
+   * Read part of a file or directory.
+   *
+   * Like read, but starting `offset` bytes in, so a large file can be
+   * read a block at a time.
+   *
+   * Success: number of bytes read, 0 at or past the end
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -ERETRY.
+   * Failure modes: invalid inodeNumber, invalid size or offset.
+   */
+  int readAt(int inodeNumber, void *buffer, int offset, int size);
+
+  /**
+   * List a directory, with the type of each entry, from the directory
+   * cache if it's there. The listing is never changed once made, so
+   * callers can keep it as long as they like.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -ERETRY
+   * Failure modes: invalid inodeNumber, not a directory.
+   */
+  int listDirectory(int inodeNumber, std::shared_ptr<const DirectoryListing> *listing);
+
+  /**
+   * Hold an inode shared across several calls, so that reading it in
+   * pieces sees a single version of it. The calling thread can still
+   * use it as usual; other threads wait to change it until it's
+   * unpinned.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -ERETRY
+   */
+  int pinInode(int inodeNumber);
+  void unpinInode(int inodeNumber);
+
+  /**
+   * Drop every cached directory listing, for when the image has been
+   * changed underneath this LocalFileSystem, like on a replica. The
+   * caller keeps other threads out while it does.
+   */
+  void forgetCachedDirectories();
+
   /**
    * Remove a file or directory.
    *
@@ -120,12 +225,33 @@ class LocalFileSystem {
    * parentInodeNumber.
    *
    * Success: 0
-   * Failure: -EINVALIDINODE, -EDIRNOTEMPTY, -EINVALIDNAME, -EUNLINKNOTALLOWED
+   * Failure: -EINVALIDINODE, -EDIRNOTEMPTY, -EINVALIDNAME, -EUNLINKNOTALLOWED,
+   * -ERETRY
    * Failure modes: parentInodeNumber does not exist or isn't a directory,
    * directory is NOT empty, or the name is invalid. Note that the name not
    * existing is NOT a failure by our definition. You can't unlink '.' or '..'
    */
   int unlink(int parentInodeNumber, std::string name);
+
+  /**
+   * Move a file or directory.
+   *
+   * Moves the entry srcName in srcParentInodeNumber to dstName in
+   * dstParentInodeNumber, which can be the same directory. Only
+   * directory entries change; the inode and its data stay where they
+   * are. An existing dstName of the same type is replaced, and unlinked
+   * as unlink() would.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -ENOTFOUND, -EINVALIDNAME, -EUNLINKNOTALLOWED,
+   * -EINVALIDTYPE, -EDIRNOTEMPTY, -ENOTENOUGHSPACE, -EINVALIDMOVE, -ERETRY
+   * Failure modes: either parent does not exist or isn't a directory,
+   * srcName does not exist, a name is invalid or is '.' or '..', dstName
+   * exists with a different type or is a directory that isn't empty,
+   * the destination directory is full, or a directory would end up
+   * inside itself.
+   */
+  int rename(int srcParentInodeNumber, std::string srcName, int dstParentInodeNumber, std::string dstName);
   
   /**
    * Some helper functions that you need to implement and use in your
@@ -147,6 +273,81 @@ class LocalFileSystem {
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+ private:
+  // holds inode locks until the function it's declared in returns
+  class InodeLocks;
+  friend class InodeLocks;
+
+  // what the calling thread holds
+  struct HeldStripe {
+    bool exclusive;
+    int depth;
+  };
+  struct ThreadLocks {
+    std::map<int, HeldStripe> stripes;
+    // inodes its transaction allocated
+    std::set<int> owned;
+    // (bitmap block, bit) pairs to clear when its transaction commits
+    std::vector<std::pair<int, int> > pendingFrees;
+    // directories whose cached listings go if its transaction rolls back
+    std::set<int> changedDirectories;
+    bool waitingForEnd;
+  };
+
+  static const int INODE_STRIPES = 256;
+  // how long a thread that already holds a lock waits for another
+  static const long LOCK_WAIT_MICROS = 50000;
+
+  int lockInode(int inodeNumber, bool exclusive);
+  void unlockInode(int inodeNumber);
+  ThreadLocks *threadLocks();
+  void endTransaction(bool committed);
+
+  struct CachedDirectory {
+    // how many times its entries have changed, so a listing built
+    // while one did isn't kept
+    uint64_t changes;
+    std::shared_ptr<const DirectoryListing> listing;
+  };
+
+  // drops a directory's cached listing; the caller has it locked
+  // exclusively
+  void directoryChanged(int inodeNumber);
+
+  // makes a freshly allocated inode the calling transaction's own
+  void own(int inodeNumber);
+  // has endTransaction run when the calling thread's transaction ends
+  void waitForEnd(ThreadLocks *held);
+
+  // the part of create() that adds a new entry, with the parent locked
+  int addEntry(super_t *super, int parentInodeNumber, inode_t *parentInode, int type, std::string name);
+  // puts an entry for an existing inode at the end of a locked parent
+  // that has room for it
+  void appendEntry(super_t *super, int parentInodeNumber, inode_t *parentInode, int inodeNumber, std::string name);
+  // takes entry `index` out of a locked parent whose entries are in
+  // `directoryBuffer`
+  void removeEntry(super_t *super, int parentInodeNumber, inode_t *parentInode,
+                   std::vector<char> &directoryBuffer, int index);
+
+  bool isAllocated(super_t *super, int inodeNumber);
+  // whether `inodeNumber` is somewhere below `directory`, going by
+  // ".." entries; nothing is held across the walk
+  bool isBelow(super_t *super, int inodeNumber, int directory);
+  // writes one inode back, leaving the rest of its block alone
+  void writeInode(super_t *super, int inodeNumber, inode_t *inode);
+  // set the first clear bit and return it, or -1 when they're all set
+  int allocateBit(int bitmapAddr, int bitmapLen, int bits);
+  // clear a bit now, or when the transaction commits
+  void freeBit(int bitmapAddr, int bit);
+  void clearBit(int bitmapBlock, int bit);
+
+  pthread_rwlock_t inodeStripes[INODE_STRIPES];
+  pthread_mutex_t threadsLock;
+  std::map<pthread_t, ThreadLocks> threads;
+  pthread_mutex_t directoriesLock;
+  std::map<int, CachedDirectory> directories;
+  uint64_t listingVersions;
 };  
 
 #endif
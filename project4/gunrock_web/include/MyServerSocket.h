@@ -13,16 +13,31 @@ class MyServerSocket {
    * if it cannot bind, it will throw a socket exception.
    *
    * @param port the port to bind to
+   * @param backlog how many connections the kernel queues for us
+   *   before it starts turning clients away
    */
-  MyServerSocket(int port);
+  MyServerSocket(int port, int backlog = 10);
   MyServerSocket() { serverFd = -1; }
+
+  /**
+   * wraps a socket that is already bound and listening, such as one
+   * inherited from the process that exec'd us
+   *
+   * @param fd the listening socket
+   */
+  static MyServerSocket *inherit(int fd);
   
   /**
    * this function will accept incoming requests to connect and
-   * return the resulting socket
+   * return the resulting socket. Returns NULL when the call was
+   * interrupted, or the socket is non-blocking and no connection is
+   * waiting.
    */
   MySocket *accept();
 
+  // stop listening; connections already accepted aren't affected
+  void close();
+
   int getFd() { return serverFd; }
  protected:
   int serverFd;
@@ -0,0 +1,54 @@
+#ifndef _REPLICATION_SERVICE_H_
+#define _REPLICATION_SERVICE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "DistributedFileSystemService.h"
+#include "HttpService.h"
+#include "Replicator.h"
+
+/**
+ * /replication/ on either end of ds3 replication.
+ *
+ * On a primary, GET reports each replica's state and how far behind
+ * it is. On a replica, the primary POSTs batches of changes here and
+ * they're applied to the image, as long as they come with the key the
+ * replica was started with (or it's a 403) and carry on from the last
+ * one: the same epoch, and the sequence number after the last entry
+ * applied. Otherwise the answer is a 409, and either way the body says
+ * where the replica is, "<epoch> <sequence>", or "none 0" before
+ * anything has been applied. GET reports that position and how far
+ * behind the primary said it was.
+ */
+class ReplicationService : public HttpService {
+ public:
+  // for a primary
+  ReplicationService(Replicator *replicator);
+  // for a replica, taking batches from a primary that has `key`
+  ReplicationService(DistributedFileSystemService *ds3, std::string key);
+  ~ReplicationService();
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  std::string position();
+
+  Replicator *replicator;
+  DistributedFileSystemService *ds3;
+  std::string key;
+
+  // the replica's side, under positionLock
+  pthread_mutex_t positionLock;
+  std::string epoch;
+  uint64_t applied;
+  // the primary's last entry when it last sent a batch
+  uint64_t primaryHead;
+  // when the last batch was applied, in milliseconds since the epoch
+  long lastApplied;
+};
+
+#endif
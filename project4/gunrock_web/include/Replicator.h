@@ -0,0 +1,133 @@
+#ifndef _REPLICATOR_H_
+#define _REPLICATOR_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BackendConnector.h"
+#include "Disk.h"
+
+// part of one block that a commit changed, to XOR into a replica's copy
+struct BlockDelta {
+  int blockNumber;
+  int offset;
+  std::string_view bytes;
+};
+
+/**
+ * Sends every commit on a primary's Disk to replica servers, which
+ * apply them to their own copy of the image and serve reads from it.
+ *
+ * Each commit becomes one entry in a log, numbered in the order the
+ * commits happened, holding the bytes it changed in each block as old
+ * ^ new. A thread per replica POSTs whatever the replica hasn't
+ * acknowledged to its /replication/ in batches, and entries are
+ * dropped once every replica has them. Because the changes are XORs,
+ * two commits that touched different bits of a shared block, like a
+ * bitmap, don't carry each other's uncommitted bytes.
+ *
+ * Replicas have to start from a copy of the image taken while the
+ * primary was stopped. Log positions only mean something within one
+ * run of the primary (its epoch), so a replica from an earlier run, or
+ * one that fell more than MAX_LOG_BYTES behind, is marked diverged
+ * and needs a fresh copy.
+ *
+ * In synchronous mode a write waits, after it commits and before it's
+ * answered, for the replicas that are keeping up to acknowledge it. A
+ * replica that takes longer than syncTimeoutMillis is left behind as
+ * lagging, and writes stop waiting for it until it catches up again.
+ *
+ * Every batch carries `key` as a bearer token, and replicas turn away
+ * batches without the key they were started with.
+ */
+class Replicator {
+ public:
+  // `replicas` are "host:port"
+  Replicator(Disk *disk, const std::vector<std::string> &replicas, bool synchronous, std::string key);
+  ~Replicator();
+
+  // in synchronous mode, waits for the calling thread's last commit
+  // to reach the replicas that are keeping up
+  void waitForReplicas();
+
+  // one line for the primary and one per replica, with how far behind
+  // it is in entries and milliseconds
+  std::string status();
+
+  /**
+   * Splits a batch as sent to a replica into its changes.
+   *
+   * @return the number of entries, or -1 if the batch is malformed
+   */
+  static int decode(std::string_view batch, std::vector<BlockDelta> *deltas);
+
+  static long syncTimeoutMillis;
+
+ private:
+  enum State { IN_SYNC, LAGGING, UNREACHABLE, DIVERGED };
+
+  struct Entry {
+    uint64_t sequence;
+    // when it committed, in milliseconds on the monotonic clock
+    long committedAt;
+    std::string changes;
+  };
+
+  struct Replica {
+    Replicator *replicator;
+    BackendConnector *backend;
+    pthread_t thread;
+    State state;
+    // the last entry it has applied
+    uint64_t acked;
+    std::string error;
+  };
+
+  // the most the log holds before the replica furthest behind is given up on
+  static const size_t MAX_LOG_BYTES = 64 * 1024 * 1024;
+  // the most one POST carries, unless a single entry is bigger
+  static const size_t MAX_BATCH_BYTES = 1024 * 1024;
+  static const long RETRY_MILLIS = 1000;
+
+  static const char *stateName(State state);
+  static long now();
+  // waits on m_changed until `deadline`, a CLOCK_REALTIME time in
+  // milliseconds; returns false once it has passed
+  bool waitUntil(long deadline);
+  static long realtime();
+
+  // the Disk's commit listener
+  void committed(const std::deque<struct UndoRecord> &changes);
+  static void *ship(void *replica);
+  void shipTo(Replica *replica);
+  // handles a replica's answer to a batch starting at `first`; the
+  // caller holds m_lock
+  void acknowledged(Replica *replica, int status, std::string body, uint64_t first);
+  // drops entries every replica has; the caller holds m_lock
+  void trim();
+
+  // the last entry the calling thread committed
+  static thread_local uint64_t s_lastCommitted;
+
+  Disk *m_disk;
+  std::string m_epoch;
+  bool m_synchronous;
+  std::string m_key;
+
+  pthread_mutex_t m_lock;
+  // signalled when entries are added, acknowledged or stopping
+  pthread_cond_t m_changed;
+  bool m_stopping;
+  // oldest first
+  std::deque<Entry> m_log;
+  size_t m_logBytes;
+  uint64_t m_head;
+  std::vector<Replica *> m_replicas;
+};
+
+#endif
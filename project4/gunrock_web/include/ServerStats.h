@@ -0,0 +1,33 @@
+#ifndef _SERVER_STATS_H_
+#define _SERVER_STATS_H_
+
+#include <atomic>
+
+/**
+ * Counters the accept loop and worker pool update as connections and
+ * workers come and go.
+ */
+struct ServerStats {
+  std::atomic<unsigned long> accepted{0};
+  std::atomic<unsigned long> served{0};
+  // connections waiting for a worker right now
+  std::atomic<unsigned long> queued{0};
+  // turned away with a 503 because the queue was full
+  std::atomic<unsigned long> rejected{0};
+  // shed from the front of a full queue to make room
+  std::atomic<unsigned long> droppedOldest{0};
+  // shed by CoDel for waiting too long
+  std::atomic<unsigned long> codelDropped{0};
+  // connections cut off by a read or write deadline
+  std::atomic<unsigned long> timedOut{0};
+
+  // worker threads running now, and how many of them are waiting for
+  // a connection
+  std::atomic<unsigned long> workers{0};
+  std::atomic<unsigned long> idleWorkers{0};
+  // worker threads started and retired since the server started
+  std::atomic<unsigned long> spawned{0};
+  std::atomic<unsigned long> retired{0};
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _SHARD_ROUTER_SERVICE_H_
+#define _SHARD_ROUTER_SERVICE_H_
+
+#include "BackendConnector.h"
+#include "HashRing.h"
+#include "HttpService.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The ds3 interface spread over several gunrock servers, each with its
+ * own disk image.
+ *
+ * The first component under /ds3/ names a bucket, and a HashRing over
+ * the backends' "host:port" names picks the backend that holds it, so
+ * every router given the same list sends a bucket to the same place.
+ * Requests go through unchanged and the backend's response is copied
+ * back as it arrives, so ranges, ETags and chunked transfers behave as
+ * they do against a single server.
+ *
+ * GET /ds3/ merges the top-level listings of every backend. A batch
+ * can't be atomic across backends, so POST /ds3/ is refused; a MOVE
+ * to a bucket on another backend gets a 502, the WebDAV answer for a
+ * destination on a different server.
+ */
+class ShardRouterService : public HttpService {
+ public:
+  // `backends` are "host:port"
+  ShardRouterService(const std::vector<std::string> &backends);
+  ~ShardRouterService();
+
+  virtual bool streamsRequestBody(HTTPRequest *request);
+
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void put(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
+  virtual void del(HTTPRequest *request, HTTPResponse *response);
+  virtual void move(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  // the bucket a ds3 path or URL is in, empty for /ds3/ itself
+  static std::string bucketOf(std::string_view path);
+
+  BackendConnector *route(HTTPRequest *request);
+  void listBuckets(HTTPRequest *request, HTTPResponse *response);
+
+  /**
+   * Send the request to `backend` and copy its response to the client.
+   *
+   * @throws ClientError 502 if the backend fails before any of its
+   *   response has been passed on
+   */
+  void forward(HTTPRequest *request, HTTPResponse *response, BackendConnector *backend);
+
+  std::vector<BackendConnector *> backends;
+  HashRing *ring;
+};
+
+#endif
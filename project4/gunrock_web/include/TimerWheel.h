@@ -0,0 +1,100 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+class TimerWheel;
+
+/**
+ * Something that goes off at a deadline. A timer is intrusive: the
+ * wheel links it straight into its slot lists, so scheduling one never
+ * allocates. The owner has to make sure it's cancelled (the destructor
+ * does this) before it goes away.
+ */
+class Timer {
+ public:
+  Timer();
+  virtual ~Timer();
+
+  // true while the timer is scheduled on a wheel
+  bool isPending();
+
+ protected:
+  /**
+   * Called on the wheel's thread when the deadline passes, with the
+   * wheel locked, so it must not block or schedule timers itself.
+   *
+   * @return how many milliseconds from now to go off again, or 0 to
+   *   stay idle until the owner schedules the timer again
+   */
+  virtual long expired() = 0;
+
+ private:
+  friend class TimerWheel;
+
+  TimerWheel *m_wheel;
+  Timer *m_prev;
+  Timer *m_next;
+  uint64_t m_expires;
+  int m_level;
+  int m_slot;
+};
+
+/**
+ * A hierarchical timing wheel.
+ *
+ * Time advances in ticks. The first level has a slot for each of the
+ * next 64 ticks, and every level above it covers 64 times the span of
+ * the one below, so four levels reach about 16 million ticks (a couple
+ * of days at 10ms). A timer goes into the slot for its deadline at the
+ * lowest level that can hold it, and when a lower level wraps around
+ * the next slot of the level above is spread back down. Scheduling
+ * and cancelling are a list insert and unlink, and a tick only touches
+ * the timers that are due, however many are pending.
+ *
+ * start() runs a thread that advances the wheel in real time and
+ * fires whatever is due. Every operation is thread safe, and cancel()
+ * doesn't return while the timer is firing, so once it returns the
+ * timer is idle and can be destroyed.
+ */
+class TimerWheel {
+ public:
+  // @param tickMillis the resolution of the wheel
+  TimerWheel(long tickMillis = 10);
+  ~TimerWheel();
+
+  // start the thread that fires timers
+  void start();
+
+  // (re)arm `timer` to go off `millis` from now, rounded up to a tick
+  void schedule(Timer *timer, long millis);
+
+  // disarm `timer`; a timer that isn't pending is left alone
+  void cancel(Timer *timer);
+
+ private:
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 6;
+  static const int SLOTS = 1 << SLOT_BITS;
+
+  static long now();
+  static void *run(void *arg);
+
+  // the rest are called with m_lock held
+  void link(Timer *timer);
+  void unlink(Timer *timer);
+  void cascade(int level);
+  void advance(uint64_t tick);
+
+  long m_tickMillis;
+  // the last tick that has been processed
+  uint64_t m_current;
+  Timer *m_slots[LEVELS][SLOTS];
+
+  pthread_mutex_t m_lock;
+  pthread_t m_thread;
+  bool m_running;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _TRANSACTION_MANAGER_H_
+#define _TRANSACTION_MANAGER_H_
+
+#include <functional>
+
+#include "Disk.h"
+
+// thrown out of a transaction that has to be rolled back and tried
+// again, when LocalFileSystem returns -ERETRY
+class TransactionConflict {};
+
+/**
+ * Transactions for a LocalFileSystem shared by several worker threads.
+ *
+ * Each thread runs its own transaction on the Disk, and LocalFileSystem
+ * locks the inodes it touches until the transaction ends, so changes to
+ * different directories go ahead side by side. When two transactions
+ * could deadlock one of them gets a TransactionConflict, and run()
+ * rolls it back, waits a little and runs it again:
+ *
+ *   transactions->run([&]() {
+ *     ... LocalFileSystem calls, through checkResult() ...
+ *   });
+ *
+ * Any other exception rolls the transaction back and is rethrown.
+ * Reads outside a transaction need nothing from here.
+ */
+class TransactionManager {
+ public:
+  TransactionManager(Disk *disk);
+
+  void run(std::function<void()> body);
+
+  // for callers that can't be retried
+  void begin();
+  void commit();
+  void rollback();
+
+ private:
+  // the longest run() waits before trying again, in microseconds
+  static constexpr long MAX_BACKOFF = 20000;
+
+  Disk *m_disk;
+};
+
+#endif
@@ -26,6 +26,14 @@ HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
   headers["Connection"] = string("close");
 }
 
+HttpClient::HttpClient(MySocket *connection, string host) {
+  this->connection = connection;
+  headers["Host"] = host;
+  headers["User-Agent"] = string("Gunrock/1.0");
+  headers["Accept"] = string("*/*");
+  headers["Connection"] = string("close");
+}
+
 HttpClient::~HttpClient() {
   delete connection;
 }
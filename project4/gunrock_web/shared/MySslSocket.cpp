@@ -74,6 +74,13 @@ void MySslSocket::write(string buffer) {
   }
 }
 
+void MySslSocket::writev(const struct iovec *iov, int count) {
+  // there's no gather write for TLS records, send the pieces in order
+  for (int idx = 0; idx < count; idx++) {
+    write(string((const char *) iov[idx].iov_base, iov[idx].iov_len));
+  }
+}
+
 string MySslSocket::read() {
   char buffer[4096];
   if(sockFd<0 || ssl == NULL) {
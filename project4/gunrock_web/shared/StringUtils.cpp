@@ -45,3 +45,12 @@ vector<string> StringUtils::split(string str, char delimiter) {
 
   return result;
 }
+
+uint64_t StringUtils::fnv1a(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t idx = 0; idx < size; idx++) {
+    hash ^= bytes[idx];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
@@ -23,6 +23,15 @@ class HttpClient {
    * @param port the port to connect to
    */
   HttpClient(const char *inet_addr, int port, bool use_tls=false);
+
+  /**
+   * Constructor for a connection that's already open, like one from a
+   * BackendPool. The client takes ownership of it.
+   *
+   * @param connection the connected socket
+   * @param host the value for the Host header, "host:port"
+   */
+  HttpClient(MySocket *connection, std::string host);
   ~HttpClient();
 
 
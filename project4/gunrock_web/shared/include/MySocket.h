@@ -1,6 +1,10 @@
 #ifndef MYSOCKET_H
 #define MYSOCKET_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <atomic>
 #include <stdexcept>
 #include <string>
 
@@ -50,13 +54,73 @@ class MySocket {
 
 
   virtual std::string read();
+
+  /*
+   * reads whatever has arrived, up to `len` bytes, into `buffer`.
+   * Unlike read() this doesn't allocate, so a caller can keep reusing
+   * one buffer for the whole connection.
+   *
+   * @return the number of bytes read, always greater than zero
+   * @throws SocketReadError when the peer has closed the connection
+   */
+  virtual int read(void *buffer, int len);
+
+  /*
+   * how many bytes the kernel already has queued for us (FIONREAD),
+   * capped at the read high-water mark. Callers use this to size their
+   * buffer before the next read; zero means it isn't known.
+   */
+  int pendingBytes();
+
+  /*
+   * the most a single buffered read should ask for, which bounds how
+   * much memory a connection's read buffer grows to
+   */
+  static int readHighWaterMark();
+  static void setReadHighWaterMark(int bytes);
+
   virtual void write(std::string data);
+
+  /*
+   * gather write: sends every buffer in `iov`, in order, with as few
+   * system calls as the kernel allows
+   */
+  virtual void writev(const struct iovec *iov, int count);
+
+  /*
+   * sends `count` bytes of the file `fd` starting at `offset` without
+   * copying them through user space where the platform allows it. The
+   * file's own offset is left alone, so `fd` can be shared.
+   */
+  virtual void sendfile(int fd, off_t offset, size_t count);
+
+  /*
+   * best-effort send of `notice` without blocking, then shuts the
+   * connection down in both directions so that a read or write blocked
+   * on it in another thread returns with an error. The descriptor
+   * itself stays open until close(), so this is safe to call while
+   * another thread is using the socket.
+   */
+  void shutdown(const char *notice = NULL, size_t len = 0);
   virtual void close(void);
+
+  /*
+   * running totals of the bytes that went through this socket, which
+   * another thread can poll to tell whether the connection is making
+   * progress
+   */
+  unsigned long bytesRead();
+  unsigned long bytesWritten();
   
  protected:
   void call_connect(const char *inetAddr, int port);
   void write_bytes(const void *buffer, int len);
   int sockFd;
+  std::atomic<unsigned long> m_bytesRead;
+  std::atomic<unsigned long> m_bytesWritten;
+
+ private:
+  static int s_readHighWaterMark;
 };
 
 #endif
@@ -21,6 +21,7 @@ class MySslSocket: public MySocket {
 
   std::string read();
   void write(std::string data);
+  void writev(const struct iovec *iov, int count);
   void close(void);
   
  protected:
@@ -1,6 +1,9 @@
 #ifndef _STRING_UTILS_H_
 #define _STRING_UTILS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
@@ -10,6 +13,10 @@ class StringUtils {
   static std::vector<std::string> split(std::string str, char delimiter);
   static std::string createAuthToken();
   static std::string createUserId();
+
+  // 64-bit FNV-1a, continuing from `hash` so data can be hashed in pieces
+  static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS);
+  static const uint64_t FNV1A_OFFSET_BASIS = 0xcbf29ce484222325ULL;
 };
 
 #endif
@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# Test for conditional changes: PUTs and DELETEs with If-Match go
+# ahead only while the file still has the ETag the client saw
+DISK_IMAGE="ifmatch.img"
+PORT=8102
+
+./mkfs -f $DISK_IMAGE -d 2048 -i 512 > /dev/null
+./gunrock_web -p $PORT -i $DISK_IMAGE -t 2 -m 8 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+etag() {
+    curl -s -D - -o /dev/null http://localhost:$PORT/ds3/$1 | grep -i "^ETag:" | cut -d' ' -f2 | tr -d '\r'
+}
+put() {
+    curl -s -o /dev/null -w '%{http_code}' -X PUT "${@:3}" --data-binary "$2" http://localhost:$PORT/ds3/$1
+}
+
+curl -s -X PUT --data-binary "first" http://localhost:$PORT/ds3/a/file > /dev/null
+first=$(etag a/file)
+
+# Test 1: A PUT with the file's current ETag goes ahead
+echo "Test 1: Matching ETag"
+[ -n "$first" ] && [ "$(put a/file second -H "If-Match: $first")" == "200" ] && \
+    [ "$(curl -s http://localhost:$PORT/ds3/a/file)" == "second" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 2: One with the ETag from before that change is turned away
+echo "Test 2: Stale ETag"
+[ "$(put a/file third -H "If-Match: $first")" == "412" ] && \
+    [ "$(curl -s http://localhost:$PORT/ds3/a/file)" == "second" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 3: If-Match: * needs the file to be there
+echo "Test 3: Any ETag"
+[ "$(put a/file third -H "If-Match: *")" == "200" ] && \
+    [ "$(put a/missing new -H "If-Match: *")" == "412" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$PORT/ds3/a/missing)" == "404" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 4: The ETag a PUT leaves behind matches the next one
+echo "Test 4: ETag after a conditional PUT"
+[ "$(put a/file fourth -H "If-Match: $(etag a/file)")" == "200" ] && \
+    [ "$(put a/file fifth -H "If-Match: $(etag a/file)")" == "200" ] && \
+    [ "$(curl -s http://localhost:$PORT/ds3/a/file)" == "fifth" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 5: DELETE is conditional the same way
+echo "Test 5: Conditional DELETE"
+[ "$(curl -s -o /dev/null -w '%{http_code}' -X DELETE -H "If-Match: $first" http://localhost:$PORT/ds3/a/file)" == "412" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' -X DELETE -H "If-Match: $(etag a/file)" http://localhost:$PORT/ds3/a/file)" == "200" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$PORT/ds3/a/file)" == "404" ] \
+    && echo "Test passed." || echo "Test failed."
+
+kill $SERVER
+wait $SERVER 2> /dev/null
+rm -f $DISK_IMAGE $DISK_IMAGE.etag
+echo "All tests completed."
@@ -0,0 +1,72 @@
+#!/bin/bash
+
+# Test for ds3 replication: a primary and a replica started from copies
+# of the same image, checking the replica ends up with the same bytes
+PRIMARY_PORT=8099
+REPLICA_PORT=8100
+
+./mkfs -f primary.img -d 2048 -i 512 > /dev/null
+cp primary.img replica.img
+head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' > replication.key
+./gunrock_web -p $REPLICA_PORT -i replica.img -F -k replication.key -t 2 -m 8 > /dev/null 2>&1 &
+REPLICA=$!
+./gunrock_web -p $PRIMARY_PORT -i primary.img -R localhost:$REPLICA_PORT -S -k replication.key -t 4 -m 16 > /dev/null 2>&1 &
+PRIMARY=$!
+sleep 1
+
+# Test 1: In sync mode a write can be read from the replica straight away
+echo "Test 1: Reading a synchronous write from the replica"
+curl -s -X PUT --data-binary "hello" http://localhost:$PRIMARY_PORT/ds3/a/b/file > /dev/null
+[ "$(curl -s http://localhost:$REPLICA_PORT/ds3/a/b/file)" == "hello" ] && echo "Test passed." || echo "Test failed."
+
+# Test 2: The replica turns writes away, and changes from anyone
+# without the key
+echo "Test 2: The replica is read-only"
+[ "$(curl -s -o /dev/null -w '%{http_code}' -X PUT --data-binary x http://localhost:$REPLICA_PORT/ds3/a/b/file)" == "405" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' -X POST -H "Replication-Epoch: x" -H "Replication-Sequence: 1" \
+         --data-binary x http://localhost:$REPLICA_PORT/replication/)" == "403" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' -X POST -H "Authorization: Bearer wrong" -H "Replication-Epoch: x" \
+         -H "Replication-Sequence: 1" --data-binary x http://localhost:$REPLICA_PORT/replication/)" == "403" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 3: After concurrent writes, moves and deletes the images match
+echo "Test 3: Concurrent changes reach the replica"
+for client in $(seq 1 8); do
+    (
+        for round in $(seq 1 20); do
+            curl -s -X PUT --data-binary "client $client round $round" \
+                 http://localhost:$PRIMARY_PORT/ds3/c$client/d$((round % 3))/f$((round % 5)) > /dev/null
+            curl -s -X MOVE -H "Destination: /ds3/c$client/moved$((round % 2))" \
+                 http://localhost:$PRIMARY_PORT/ds3/c$client/d$((round % 3))/f$(((round + 1) % 5)) > /dev/null
+            curl -s -X DELETE http://localhost:$PRIMARY_PORT/ds3/c$client/d$((round % 3))/f$(((round + 2) % 5)) > /dev/null
+            curl -s http://localhost:$REPLICA_PORT/ds3/c$client/ > /dev/null
+        done
+    ) &
+done
+wait $(jobs -p | grep -v "^$PRIMARY$" | grep -v "^$REPLICA$")
+for wait in $(seq 1 50); do
+    curl -s http://localhost:$PRIMARY_PORT/replication/ | grep -q "in-sync.* behind 0 " && break
+    sleep 0.1
+done
+cmp -s primary.img replica.img && echo "Test passed." || echo "Test failed."
+
+# Test 4: Both ends report where the replica is
+echo "Test 4: Replication status"
+curl -s http://localhost:$PRIMARY_PORT/replication/ | grep -q "^localhost:$REPLICA_PORT in-sync acked [1-9]" && \
+    curl -s http://localhost:$REPLICA_PORT/replication/ | grep -q "^behind 0 " \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 5: With the replica down, sync writes still go ahead after the
+# timeout and the replica shows up as behind
+echo "Test 5: Writes while the replica is down"
+kill $REPLICA
+wait $REPLICA 2> /dev/null
+curl -s -X PUT --data-binary "later" http://localhost:$PRIMARY_PORT/ds3/a/later > /dev/null
+[ "$(curl -s http://localhost:$PRIMARY_PORT/ds3/a/later)" == "later" ] && \
+    curl -s http://localhost:$PRIMARY_PORT/replication/ | grep -q "behind [1-9]" \
+    && echo "Test passed." || echo "Test failed."
+
+kill $PRIMARY
+wait $PRIMARY 2> /dev/null
+rm -f primary.img primary.img.etag replica.img replica.img.etag replication.key
+echo "All tests completed."
@@ -0,0 +1,73 @@
+#!/bin/bash
+
+# Test for the ds3 router: three servers with their own images behind
+# one router, checking each bucket lands on exactly one of them
+ROUTER_PORT=8095
+PORTS="8096 8097 8098"
+BACKENDS=""
+SERVERS=""
+
+for port in $PORTS; do
+    ./mkfs -f shard$port.img -d 1024 -i 256 > /dev/null
+    ./gunrock_web -p $port -i shard$port.img -t 2 -m 8 > /dev/null 2>&1 &
+    SERVERS="$SERVERS${SERVERS:+ }$!"
+    BACKENDS="$BACKENDS${BACKENDS:+,}localhost:$port"
+done
+./gunrock_web -p $ROUTER_PORT -r $BACKENDS -t 2 -m 8 > /dev/null 2>&1 &
+ROUTER=$!
+sleep 1
+
+# Test 1: Files written through the router read back through it
+echo "Test 1: PUT and GET through the router"
+failed=0
+for bucket in $(seq 1 20); do
+    curl -s -X PUT --data-binary "bucket $bucket" http://localhost:$ROUTER_PORT/ds3/b$bucket/dir/file > /dev/null
+done
+for bucket in $(seq 1 20); do
+    [ "$(curl -s http://localhost:$ROUTER_PORT/ds3/b$bucket/dir/file)" == "bucket $bucket" ] || failed=1
+done
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 2: Each bucket is on exactly one server, and they're spread out
+echo "Test 2: Each bucket is on one server"
+failed=0
+used=""
+for bucket in $(seq 1 20); do
+    found=0
+    for port in $PORTS; do
+        if [ "$(curl -s http://localhost:$port/ds3/b$bucket/dir/file)" == "bucket $bucket" ]; then
+            found=$((found + 1))
+            used="$used $port"
+        fi
+    done
+    [ $found == 1 ] || failed=1
+done
+[ $(echo $used | tr ' ' '\n' | sort -u | wc -l) -gt 1 ] || failed=1
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 3: The root listing is every server's merged
+echo "Test 3: Listing /ds3/ through the router"
+expected=$(for bucket in $(seq 1 20); do echo "b$bucket/"; done | sort)
+[ "$(curl -s http://localhost:$ROUTER_PORT/ds3/)" == "$expected" ] && echo "Test passed." || echo "Test failed."
+
+# Test 4: Ranges, deletes and errors come back as the server sent them
+echo "Test 4: Responses pass through unchanged"
+failed=0
+[ "$(curl -s -H 'Range: bytes=0-5' http://localhost:$ROUTER_PORT/ds3/b1/dir/file)" == "bucket" ] || failed=1
+[ "$(curl -s -o /dev/null -w '%{http_code}' -X DELETE http://localhost:$ROUTER_PORT/ds3/b2/dir/file)" == "200" ] || failed=1
+[ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$ROUTER_PORT/ds3/b2/dir/file)" == "404" ] || failed=1
+[ "$(curl -s -o /dev/null -w '%{http_code}' -X POST --data-binary 'DELETE b1/dir/file' http://localhost:$ROUTER_PORT/ds3/)" == "405" ] || failed=1
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 5: A server that's down gets a 502 for its buckets
+echo "Test 5: A server that's down"
+kill ${SERVERS%% *}
+wait ${SERVERS%% *} 2> /dev/null
+[ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$ROUTER_PORT/ds3/)" == "502" ] && echo "Test passed." || echo "Test failed."
+
+kill $ROUTER $SERVERS 2> /dev/null
+wait $ROUTER $SERVERS 2> /dev/null
+for port in $PORTS; do
+    rm -f shard$port.img shard$port.img.etag
+done
+echo "All tests completed."
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Test for streamed responses: big static files go out through a
+# ChunkedWriter a buffer at a time, keep up with slow clients, and
+# never pass a cut-short body off as a whole one
+BASE=streaming-files
+PORT=8103
+
+mkdir -p $BASE
+head -c 16777216 /dev/urandom > $BASE/big.bin
+head -c 1000 /dev/urandom > $BASE/small.bin
+./mkfs -f $BASE.img -d 2048 -i 512 > /dev/null
+./gunrock_web -p $PORT -d $BASE -i $BASE.img -t 2 -m 4 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+# Test 1: A big file arrives whole, in chunks
+echo "Test 1: Streaming a big file"
+curl -s -D $BASE/headers -o $BASE/out.bin http://localhost:$PORT/big.bin
+cmp -s $BASE/out.bin $BASE/big.bin && grep -qi "^Transfer-Encoding: chunked" $BASE/headers && \
+    [ "$(curl -s http://localhost:$PORT/small.bin | cmp - $BASE/small.bin && echo same)" == "same" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 2: HEAD gives the size and no body
+echo "Test 2: HEAD on a big file"
+curl -s -I http://localhost:$PORT/big.bin | grep -qi "^Content-Length: 16777216" \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 3: A slow client is held to its own pace, gets every byte, and
+# doesn't hold up anyone else
+echo "Test 3: A slow client"
+curl -s --limit-rate 8M -o $BASE/slow.bin http://localhost:$PORT/big.bin &
+SLOW=$!
+sleep 0.5
+others=0
+for round in $(seq 1 10); do
+    curl -s http://localhost:$PORT/small.bin | cmp -s - $BASE/small.bin || others=1
+done
+kill -0 $SLOW 2> /dev/null && still=1 || still=0
+wait $SLOW
+cmp -s $BASE/slow.bin $BASE/big.bin && [ $others == 0 ] && [ $still == 1 ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 4: Several big files at once, more than there are workers
+echo "Test 4: Concurrent streams"
+for client in $(seq 1 8); do
+    curl -s -o $BASE/out$client.bin http://localhost:$PORT/big.bin &
+done
+wait $(jobs -p | grep -v "^$SERVER$")
+failed=0
+for client in $(seq 1 8); do
+    cmp -s $BASE/out$client.bin $BASE/big.bin || failed=1
+done
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 5: A file that shrinks part way leaves the body unfinished
+# rather than ending it early
+echo "Test 5: Cut short"
+head -c 33554432 /dev/urandom > $BASE/shrinks.bin
+curl -s --limit-rate 8M -o /dev/null http://localhost:$PORT/shrinks.bin &
+CLIENT=$!
+sleep 1
+head -c 1048576 $BASE/big.bin > $BASE/shrinks.bin
+wait $CLIENT
+[ $? == 18 ] && [ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$PORT/small.bin)" == "200" ] \
+    && echo "Test passed." || echo "Test failed."
+
+kill $SERVER
+wait $SERVER 2> /dev/null
+rm -rf $BASE $BASE.img $BASE.img.etag
+echo "All tests completed."
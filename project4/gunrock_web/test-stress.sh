@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Stress test for concurrent ds3 transactions: hammer one image from
+# several threads, directly and through the server, and check it's
+# still consistent afterwards
+DISK_IMAGE="stress.img"
+PORT=8093
+
+./mkfs -f $DISK_IMAGE -d 2048 -i 512 > /dev/null
+
+# Test 1: Transactions from several threads at once read back as written
+echo "Test 1: 16 threads of writes, removes and rollbacks"
+./ds3stress $DISK_IMAGE 16 500 && echo "Test passed." || echo "Test failed."
+
+# Test 2: The image is consistent afterwards
+echo "Test 2: Checking the image"
+./ds3fsck $DISK_IMAGE && echo "Test passed." || echo "Test failed."
+
+# Test 3: Concurrent PUTs, GETs and DELETEs through the server
+echo "Test 3: Concurrent requests through the server"
+./gunrock_web -p $PORT -i $DISK_IMAGE -t 4 -m 16 -b 64 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+for client in $(seq 1 16); do
+    (
+        for round in $(seq 1 20); do
+            curl -s -X PUT --data-binary "client $client round $round" \
+                 http://localhost:$PORT/ds3/c$client/d$((round % 3))/f$((round % 5)) > /dev/null
+            curl -s -X PUT --data-binary "client $client round $round" \
+                 http://localhost:$PORT/ds3/shared/c$client-$((round % 4)) > /dev/null
+            curl -s http://localhost:$PORT/ds3/shared/ > /dev/null
+            curl -s -X DELETE http://localhost:$PORT/ds3/c$client/d$((round % 3))/f$(((round + 2) % 5)) > /dev/null
+        done
+    ) &
+done
+wait $(jobs -p | grep -v "^$SERVER$")
+kill $SERVER
+wait $SERVER 2> /dev/null
+./ds3fsck $DISK_IMAGE && echo "Test passed." || echo "Test failed."
+
+# Test 4: Pipelined and malformed requests get answers, and the server
+# stays up for the next client
+echo "Test 4: Requests the server doesn't expect"
+./gunrock_web -p $PORT -i $DISK_IMAGE -t 2 -m 4 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+raw() {
+    exec 3<> /dev/tcp/localhost/$PORT
+    printf "$1" >&3
+    head -1 <&3 | tr -d '\r'
+    exec 3<&-
+}
+pipelined=$(raw 'GET /ds3/ HTTP/1.1\r\nHost: x\r\n\r\nGET /ds3/ HTTP/1.1\r\nHost: x\r\n\r\n')
+folded=$(raw 'GET /ds3/ HTTP/1.1\r\nHost: x\r\nX-A: b\r\n c\r\n\r\n')
+[ "$pipelined" == "HTTP/1.1 200 OK" ] && [ "$folded" == "HTTP/1.1 400 Bad Request" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$PORT/ds3/)" == "200" ] \
+    && echo "Test passed." || echo "Test failed."
+kill $SERVER
+wait $SERVER 2> /dev/null
+
+rm -f $DISK_IMAGE $DISK_IMAGE.etag
+echo "All tests completed."
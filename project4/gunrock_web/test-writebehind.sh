@@ -0,0 +1,92 @@
+#!/bin/bash
+
+# Test for write-behind PUTs: answered from the log, readable straight
+# away, and never lost, even when the server is killed
+DISK_IMAGE="writebehind.img"
+PORT=8101
+
+./mkfs -f $DISK_IMAGE -d 2048 -i 512 > /dev/null
+./gunrock_web -p $PORT -i $DISK_IMAGE -w -t 4 -m 16 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+# Test 1: A PUT reads back at once, with the same ETag as once it's applied
+echo "Test 1: Reading your own writes"
+curl -s -X PUT --data-binary "hello" http://localhost:$PORT/ds3/a/b/file > /dev/null
+first=$(curl -s -D - -o /dev/null http://localhost:$PORT/ds3/a/b/file | grep -i "^ETag")
+[ "$(curl -s http://localhost:$PORT/ds3/a/b/file)" == "hello" ] && \
+    [ "$(curl -s http://localhost:$PORT/ds3/a/b/)" == "file" ] && \
+    [ "$(curl -s -D - -o /dev/null http://localhost:$PORT/ds3/a/b/file | grep -i "^ETag")" == "$first" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 2: PUTs that can't work fail before they're answered
+echo "Test 2: Conflicting paths"
+[ "$(curl -s -o /dev/null -w '%{http_code}' -X PUT --data-binary x http://localhost:$PORT/ds3/a/b/file/under)" == "409" ] && \
+    [ "$(curl -s -o /dev/null -w '%{http_code}' -X PUT --data-binary x http://localhost:$PORT/ds3/a/b)" == "409" ] \
+    && echo "Test passed." || echo "Test failed."
+
+# Test 3: DELETEs and MOVEs come after the PUTs answered before them
+echo "Test 3: Other changes stay in order"
+failed=0
+for round in $(seq 1 20); do
+    curl -s -X PUT --data-binary "round $round" http://localhost:$PORT/ds3/order/f > /dev/null
+    curl -s -X MOVE -H "Destination: /ds3/order/g" http://localhost:$PORT/ds3/order/f > /dev/null
+    curl -s -X PUT --data-binary "again $round" http://localhost:$PORT/ds3/order/f > /dev/null
+    curl -s -X DELETE http://localhost:$PORT/ds3/order/f > /dev/null
+    [ "$(curl -s -o /dev/null -w '%{http_code}' http://localhost:$PORT/ds3/order/f)" == "404" ] || failed=1
+    [ "$(curl -s http://localhost:$PORT/ds3/order/g)" == "round $round" ] || failed=1
+done
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 4: Every PUT that was answered survives the server being killed
+echo "Test 4: Killing the server part way"
+for client in $(seq 1 8); do
+    (
+        for round in $(seq 1 20); do
+            curl -s -X PUT --data-binary "client $client round $round" \
+                 http://localhost:$PORT/ds3/c$client/f$((round % 5)) > /dev/null
+        done
+    ) &
+done
+wait $(jobs -p | grep -v "^$SERVER$")
+kill -9 $SERVER
+wait $SERVER 2> /dev/null
+./gunrock_web -p $PORT -i $DISK_IMAGE -w -t 4 -m 16 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+failed=0
+for client in $(seq 1 8); do
+    for round in $(seq 16 20); do
+        [ "$(curl -s http://localhost:$PORT/ds3/c$client/f$((round % 5)))" == "client $client round $round" ] || failed=1
+    done
+done
+[ $failed == 0 ] && echo "Test passed." || echo "Test failed."
+
+# Test 5: The image is consistent afterwards
+echo "Test 5: Checking the image"
+kill $SERVER
+wait $SERVER 2> /dev/null
+./ds3fsck $DISK_IMAGE && echo "Test passed." || echo "Test failed."
+
+# Test 6: A PUT that was answered but doesn't fit in the image is kept
+echo "Test 6: Keeping PUTs that can't be applied"
+./mkfs -f small.img -d 32 -i 32 > /dev/null
+./gunrock_web -p $PORT -i small.img -w -t 2 -m 4 > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+head -c 100000 /dev/zero | tr '\0' x > big.txt
+code=$(curl -s -o /dev/null -w '%{http_code}' -X PUT --data-binary @big.txt http://localhost:$PORT/ds3/one)
+code=$code$(curl -s -o /dev/null -w '%{http_code}' -X PUT --data-binary @big.txt http://localhost:$PORT/ds3/two)
+for wait in $(seq 1 50); do
+    [ -s small.img.ingest.failed ] && break
+    sleep 0.1
+done
+[ "$code" == "200200" ] && [ "$(wc -l < small.img.ingest.failed)" == "1" ] && \
+    head -1 small.img.ingest.failed | grep -q "^PUT 3 100000 [0-9a-f]* .\{1,\}" \
+    && echo "Test passed." || echo "Test failed."
+kill $SERVER
+wait $SERVER 2> /dev/null
+
+rm -f $DISK_IMAGE $DISK_IMAGE.etag $DISK_IMAGE.ingest
+rm -f small.img small.img.etag small.img.ingest small.img.ingest.failed big.txt
+echo "All tests completed."